@@ -0,0 +1,545 @@
+#include "batch.h"
+#include "cache.h"
+#include "lzkn64.h"
+#include "parallel.h"
+#include "stats.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+struct BatchEntry {
+    char *input_path;
+    char *output_path;
+    size_t input_size;
+    size_t output_size;
+    bool successful;
+    bool cached;
+};
+
+// Buffers owned by one worker thread, they only ever grow so every file after the first largest one reuses them.
+struct BatchWorker {
+    u8 *input_buffer;
+    size_t input_capacity;
+    u8 *output_buffer;
+    size_t output_capacity;
+    u8 *verify_buffer;
+    size_t verify_capacity;
+    struct Lzkn64Context *context;
+    size_t index;
+};
+
+struct BatchJob {
+    const struct Arguments *arguments;
+    struct BatchEntry *entries;
+    struct BatchWorker *workers;
+    struct Lzkn64Stats *stats; // One per entry, NULL if no statistics were asked for.
+};
+
+static char *join_path(const char *directory, const char *name) {
+    size_t directory_length = strlen(directory);
+    char *path = malloc(directory_length + strlen(name) + 2);
+
+    if (path != NULL) {
+        strcpy(path, directory);
+
+        if (directory_length > 0 && directory[directory_length - 1] != '/') {
+            strcat(path, "/");
+        }
+
+        strcat(path, name);
+    }
+
+    return path;
+}
+
+static const char *base_name(const char *path) {
+    const char *separator = strrchr(path, '/');
+
+    return separator != NULL ? separator + 1 : path;
+}
+
+static int compare_paths(const void *first, const void *second) {
+    return strcmp(*(char *const *)first, *(char *const *)second);
+}
+
+// Returns the first output path shared by two entries, NULL if every entry writes its own file.
+static const char *find_duplicate_output(const struct BatchEntry *entries, size_t entry_count) {
+    char **output_paths = malloc((entry_count > 0 ? entry_count : 1) * sizeof(char *));
+    const char *duplicate_path = NULL;
+
+    if (output_paths == NULL) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < entry_count; i++) {
+        output_paths[i] = entries[i].output_path;
+    }
+
+    qsort(output_paths, entry_count, sizeof(char *), compare_paths);
+
+    for (size_t i = 1; i < entry_count && duplicate_path == NULL; i++) {
+        if (strcmp(output_paths[i - 1], output_paths[i]) == 0) {
+            duplicate_path = output_paths[i];
+        }
+    }
+
+    free(output_paths);
+
+    return duplicate_path;
+}
+
+static bool add_path(char ***paths, size_t *path_count, size_t *path_capacity, char *path) {
+    if (*path_count == *path_capacity) {
+        size_t capacity = *path_capacity == 0 ? 64 : *path_capacity * 2;
+        char **resized_paths = realloc(*paths, capacity * sizeof(char *));
+
+        if (resized_paths == NULL) {
+            free(path);
+            return false;
+        }
+
+        *paths = resized_paths;
+        *path_capacity = capacity;
+    }
+
+    (*paths)[(*path_count)++] = path;
+
+    return true;
+}
+
+static bool collect_directory(const char *input_directory, char ***paths, size_t *path_count) {
+    DIR *directory = opendir(input_directory);
+    if (directory == NULL) {
+        return false;
+    }
+
+    size_t path_capacity = 0;
+    struct dirent *directory_entry;
+
+    while ((directory_entry = readdir(directory)) != NULL) {
+        char *input_path = join_path(input_directory, directory_entry->d_name);
+        struct stat input_stat;
+
+        if (input_path == NULL) {
+            closedir(directory);
+            return false;
+        }
+
+        if (stat(input_path, &input_stat) != 0 || !S_ISREG(input_stat.st_mode)) {
+            free(input_path);
+            continue;
+        }
+
+        if (!add_path(paths, path_count, &path_capacity, input_path)) {
+            closedir(directory);
+            return false;
+        }
+    }
+
+    closedir(directory);
+
+    // Sort the paths so the order of the output doesn't depend on the file system.
+    qsort(*paths, *path_count, sizeof(char *), compare_paths);
+
+    return true;
+}
+
+static bool collect_manifest(const char *manifest_path, char ***paths, size_t *path_count) {
+    FILE *manifest_file = fopen(manifest_path, "r");
+    if (manifest_file == NULL) {
+        return false;
+    }
+
+    size_t path_capacity = 0;
+    char line[4096];
+
+    while (fgets(line, sizeof(line), manifest_file) != NULL) {
+        size_t length = strcspn(line, "\r\n");
+        line[length] = '\0';
+
+        // Skip empty lines.
+        if (length == 0) {
+            continue;
+        }
+
+        char *input_path = malloc(length + 1);
+        if (input_path == NULL) {
+            fclose(manifest_file);
+            return false;
+        }
+
+        memcpy(input_path, line, length + 1);
+
+        if (!add_path(paths, path_count, &path_capacity, input_path)) {
+            fclose(manifest_file);
+            return false;
+        }
+    }
+
+    fclose(manifest_file);
+
+    return true;
+}
+
+bool batch_collect(const char *input, char ***paths, size_t *path_count) {
+    struct stat input_stat;
+    if (stat(input, &input_stat) != 0) {
+        return false;
+    }
+
+    *paths = NULL;
+    *path_count = 0;
+
+    if (S_ISDIR(input_stat.st_mode)) {
+        return collect_directory(input, paths, path_count);
+    } else {
+        return collect_manifest(input, paths, path_count);
+    }
+}
+
+static bool reserve_buffer(u8 **buffer, size_t *capacity, size_t size) {
+    if (size > *capacity || *buffer == NULL) {
+        u8 *resized_buffer = realloc(*buffer, size > 0 ? size : 1);
+
+        if (resized_buffer == NULL) {
+            return false;
+        }
+
+        *buffer = resized_buffer;
+        *capacity = size;
+    }
+
+    return true;
+}
+
+static bool read_entry(struct BatchWorker *worker, struct BatchEntry *entry) {
+    FILE *input_file = fopen(entry->input_path, "rb");
+    if (input_file == NULL) {
+        return false;
+    }
+
+    fseek(input_file, 0, SEEK_END);
+    long input_size = ftell(input_file);
+    fseek(input_file, 0, SEEK_SET);
+
+    if (input_size < 0 || (size_t)input_size > LZKN64_MAXIMUM_FILE_SIZE) {
+        fclose(input_file);
+        return false;
+    }
+
+    if (!reserve_buffer(&worker->input_buffer, &worker->input_capacity, input_size)) {
+        fclose(input_file);
+        return false;
+    }
+
+    entry->input_size = input_size;
+
+    bool successful = fread(worker->input_buffer, 1, entry->input_size, input_file) == entry->input_size;
+    fclose(input_file);
+
+    return successful;
+}
+
+// Checks that a cached output really decompresses to the input before it is used.
+static bool cache_entry_matches(struct BatchWorker *worker, struct BatchEntry *entry) {
+    size_t decompressed_size = 0;
+
+    if (lzkn64_decompressed_size(worker->output_buffer, entry->output_size, &decompressed_size) != LZKN64_STATUS_OK || decompressed_size != entry->input_size) {
+        return false;
+    }
+
+    if (!reserve_buffer(&worker->verify_buffer, &worker->verify_capacity, entry->input_size)) {
+        return false;
+    }
+
+    if (lzkn64_decompress_safe(worker->output_buffer, entry->output_size, worker->verify_buffer, worker->verify_capacity, &decompressed_size) != LZKN64_STATUS_OK) {
+        return false;
+    }
+
+    return decompressed_size == entry->input_size && memcmp(worker->verify_buffer, worker->input_buffer, entry->input_size) == 0;
+}
+
+static bool process_entry(const struct Arguments *arguments, struct BatchWorker *worker, struct BatchEntry *entry, struct Lzkn64Stats *stats) {
+    if (!read_entry(worker, entry)) {
+        fprintf(stderr, "Error: Could not read input file %s.\n", entry->input_path);
+        return false;
+    }
+
+    size_t output_capacity = 0;
+
+    if (arguments->mode == MODE_COMPRESS) {
+        output_capacity = lzkn64_compress_bound(entry->input_size);
+    } else {
+        enum Lzkn64Status status = lzkn64_decompressed_size(worker->input_buffer, entry->input_size, &output_capacity);
+
+        if (status != LZKN64_STATUS_OK) {
+            fprintf(stderr, "Error: Could not decompress input file %s (%s).\n", entry->input_path, lzkn64_status_string(status));
+            return false;
+        }
+    }
+
+    if (!reserve_buffer(&worker->output_buffer, &worker->output_capacity, output_capacity)) {
+        fprintf(stderr, "Error: Could not allocate memory for output buffer.\n");
+        return false;
+    }
+
+    if (arguments->mode == MODE_COMPRESS) {
+        char key[CACHE_KEY_LENGTH + 1];
+
+        // A verified run has to check cached outputs as well, they come from earlier runs that may not have verified.
+        if (arguments->cache_directory != NULL) {
+            cache_key(worker->input_buffer, entry->input_size, arguments->compression_type, arguments->pad_output, key);
+            entry->cached = cache_load(arguments->cache_directory, key, worker->output_buffer, worker->output_capacity, &entry->output_size) && (!(arguments->cache_verify || arguments->verify) || cache_entry_matches(worker, entry));
+        }
+
+        if (!entry->cached) {
+            struct Lzkn64Mismatch mismatch;
+
+            lzkn64_stats_take_probe_count();
+
+            enum Lzkn64Status status = compress_buffer(arguments, worker->context, worker->input_buffer, worker->output_buffer, entry->input_size, &entry->output_size, &mismatch);
+            if (status != LZKN64_STATUS_OK) {
+                char text[256];
+                format_compress_error(status, &mismatch, text, sizeof(text));
+
+                fprintf(stderr, "Error: Could not compress %s (%s).\n", entry->input_path, text);
+                return false;
+            }
+
+            if (stats != NULL) {
+                stats->probe_count = lzkn64_stats_take_probe_count();
+            }
+
+            // Failing to store an entry only makes the next build slower.
+            if (arguments->cache_directory != NULL) {
+                cache_store(arguments->cache_directory, key, worker->output_buffer, entry->output_size, worker->index);
+            }
+        }
+    } else {
+        enum Lzkn64Status status = lzkn64_decompress_safe(worker->input_buffer, entry->input_size, worker->output_buffer, worker->output_capacity, &entry->output_size);
+
+        if (status != LZKN64_STATUS_OK) {
+            fprintf(stderr, "Error: Could not decompress input file %s (%s).\n", entry->input_path, lzkn64_status_string(status));
+            return false;
+        }
+    }
+
+    // The statistics are always of the compressed side.
+    if (stats != NULL) {
+        lzkn64_stats_collect(arguments->mode == MODE_COMPRESS ? worker->output_buffer : worker->input_buffer, arguments->mode == MODE_COMPRESS ? entry->output_size : entry->input_size, stats);
+    }
+
+    FILE *output_file = fopen(entry->output_path, "wb");
+    if (output_file == NULL) {
+        fprintf(stderr, "Error: Could not open output file %s.\n", entry->output_path);
+        return false;
+    }
+
+    bool successful = fwrite(worker->output_buffer, 1, entry->output_size, output_file) == entry->output_size;
+
+    if (fclose(output_file) != 0 || !successful) {
+        fprintf(stderr, "Error: Could not write output file %s.\n", entry->output_path);
+        return false;
+    }
+
+    return true;
+}
+
+static void batch_task(void *context, size_t task_index, size_t thread_index) {
+    struct BatchJob *job = context;
+    struct BatchEntry *entry = &job->entries[task_index];
+
+    entry->successful = process_entry(job->arguments, &job->workers[thread_index], entry, job->stats != NULL ? &job->stats[task_index] : NULL);
+}
+
+// Frees the paths of every entry and the entries themselves.
+static void batch_entries_free(struct BatchEntry *entries, size_t entry_count) {
+    for (size_t i = 0; i < entry_count; i++) {
+        free(entries[i].input_path);
+        free(entries[i].output_path);
+    }
+
+    free(entries);
+}
+
+int batch_run(const struct Arguments *arguments) {
+    struct stat input_stat;
+    if (stat(arguments->input_file, &input_stat) != 0) {
+        fprintf(stderr, "Error: Could not open input %s.\n", arguments->input_file);
+        return EXIT_FAILURE;
+    }
+
+    if (mkdir(arguments->output_file, 0777) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Error: Could not create output directory %s.\n", arguments->output_file);
+        return EXIT_FAILURE;
+    }
+
+    bool use_cache = arguments->cache_directory != NULL && arguments->mode == MODE_COMPRESS;
+
+    if (use_cache && mkdir(arguments->cache_directory, 0777) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Error: Could not create cache directory %s.\n", arguments->cache_directory);
+        return EXIT_FAILURE;
+    }
+
+    char **input_paths;
+    size_t entry_count;
+
+    if (!batch_collect(arguments->input_file, &input_paths, &entry_count)) {
+        fprintf(stderr, "Error: Could not list the input files.\n");
+        return EXIT_FAILURE;
+    }
+
+    struct BatchEntry *entries = calloc(entry_count > 0 ? entry_count : 1, sizeof(struct BatchEntry));
+    if (entries == NULL) {
+        fprintf(stderr, "Error: Could not allocate memory for entries.\n");
+
+        for (size_t i = 0; i < entry_count; i++) {
+            free(input_paths[i]);
+        }
+
+        free(input_paths);
+        return EXIT_FAILURE;
+    }
+
+    // The entries own the paths from here on, everything below fails through cleanup.
+    for (size_t i = 0; i < entry_count; i++) {
+        entries[i].input_path = input_paths[i];
+    }
+
+    free(input_paths);
+
+    int result = EXIT_FAILURE;
+    struct BatchWorker *workers = NULL;
+    size_t thread_count = 0;
+
+    for (size_t i = 0; i < entry_count; i++) {
+        entries[i].output_path = join_path(arguments->output_file, base_name(entries[i].input_path));
+
+        if (entries[i].output_path == NULL) {
+            fprintf(stderr, "Error: Could not allocate memory for entries.\n");
+            goto cleanup;
+        }
+    }
+
+    // A manifest can list files with the same name from different directories, which would overwrite each other.
+    const char *duplicate_path = find_duplicate_output(entries, entry_count);
+    if (duplicate_path != NULL) {
+        fprintf(stderr, "Error: More than one input file would be written to %s.\n", duplicate_path);
+        goto cleanup;
+    }
+
+    // Every file is handled on a single thread, the parallelism comes from processing many files at once.
+    thread_count = arguments->thread_count_set ? arguments->thread_count : 0;
+    if (thread_count == 0) {
+        thread_count = parallel_default_thread_count();
+    }
+
+    workers = calloc(thread_count, sizeof(struct BatchWorker));
+    if (workers == NULL) {
+        fprintf(stderr, "Error: Could not allocate memory for workers.\n");
+        goto cleanup;
+    }
+
+    // Each worker keeps its compression scratch memory from one file to the next.
+    for (size_t i = 0; i < thread_count; i++) {
+        workers[i].context = lzkn64_context_create(0, 1);
+        workers[i].index = i;
+
+        if (workers[i].context == NULL) {
+            fprintf(stderr, "Error: Could not allocate memory for workers.\n");
+            goto cleanup;
+        }
+    }
+
+    struct BatchJob job;
+    job.arguments = arguments;
+    job.entries = entries;
+    job.workers = workers;
+    job.stats = NULL;
+
+    if (arguments->stats || arguments->stats_json_file != NULL) {
+        job.stats = malloc(entry_count * sizeof(struct Lzkn64Stats));
+
+        if (job.stats == NULL) {
+            fprintf(stderr, "Error: Could not allocate memory for statistics.\n");
+            goto cleanup;
+        }
+
+        for (size_t i = 0; i < entry_count; i++) {
+            lzkn64_stats_init(&job.stats[i]);
+        }
+    }
+
+    f64 start_time = get_time();
+    parallel_for(entry_count, thread_count, batch_task, &job);
+    f64 elapsed_time = get_time() - start_time;
+
+    bool stats_written = true;
+
+    // Only files that went through are in the report.
+    if (job.stats != NULL) {
+        const char **names = malloc(entry_count * sizeof(const char *));
+        size_t name_count = 0;
+
+        for (size_t i = 0; i < entry_count && names != NULL; i++) {
+            if (entries[i].successful) {
+                names[name_count] = entries[i].input_path;
+                job.stats[name_count++] = job.stats[i];
+            }
+        }
+
+        stats_written = names != NULL && stats_report(arguments, names, job.stats, name_count);
+
+        free(names);
+        free(job.stats);
+    }
+
+    size_t failed_count = 0;
+    size_t cached_count = 0;
+    u64 total_input_size = 0;
+    u64 total_output_size = 0;
+
+    for (size_t i = 0; i < entry_count; i++) {
+        if (entries[i].successful) {
+            total_input_size += entries[i].input_size;
+            total_output_size += entries[i].output_size;
+            cached_count += entries[i].cached;
+        } else {
+            failed_count++;
+        }
+    }
+
+    if (use_cache) {
+        cache_trim(arguments->cache_directory, arguments->cache_maximum_size);
+    }
+
+    printf("Processed %zu of %zu files on %zu threads in %.3f s.\n", entry_count - failed_count, entry_count, thread_count, elapsed_time);
+    printf("Read %llu bytes, wrote %llu bytes, %.2f MB/s of input.\n", (unsigned long long)total_input_size, (unsigned long long)total_output_size, elapsed_time > 0.0 ? (f64)total_input_size / elapsed_time / 1e6 : 0.0);
+
+    if (use_cache) {
+        printf("Cache: %zu hits, %zu misses.\n", cached_count, entry_count - failed_count - cached_count);
+    }
+
+    if (!stats_written) {
+        fprintf(stderr, "Error: Could not write statistics file.\n");
+    }
+
+    result = failed_count == 0 && stats_written ? EXIT_SUCCESS : EXIT_FAILURE;
+
+cleanup:
+    for (size_t i = 0; workers != NULL && i < thread_count; i++) {
+        free(workers[i].input_buffer);
+        free(workers[i].output_buffer);
+        free(workers[i].verify_buffer);
+        lzkn64_context_destroy(workers[i].context);
+    }
+
+    free(workers);
+    batch_entries_free(entries, entry_count);
+
+    return result;
+}
@@ -0,0 +1,15 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "main.h"
+
+// Compresses or decompresses every regular file in arguments->input_file if it is a directory, or every path listed
+// in it (one per line) if it is a manifest file, into the arguments->output_file directory using a pool of worker threads.
+// Returns EXIT_SUCCESS only if every file was processed.
+int batch_run(const struct Arguments *arguments);
+
+// Lists every regular file in input, sorted by path, if it is a directory, or every path listed in it if it is a
+// manifest file. The paths and the array are allocated with malloc.
+bool batch_collect(const char *input, char ***paths, size_t *path_count);
+
+#endif // BATCH_H
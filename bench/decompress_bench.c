@@ -0,0 +1,243 @@
+// Benchmark for lzkn64_decompress and lzkn64_decompress_safe against the original byte-at-a-time decompression loop.
+// Every given file is decompressed repeatedly with each of them, and the outputs are compared.
+
+#include "lzkn64.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_REPETITIONS 20
+#define BENCH_OUTPUT_SIZE 0xFFFFFF
+
+typedef size_t (*DecompressFunction)(const u8 *input_buffer, u8 *output_buffer, size_t input_size);
+
+static size_t safe_decompress(const u8 *input_buffer, u8 *output_buffer, size_t input_size) {
+    size_t output_size = 0;
+
+    if (lzkn64_decompress_safe(input_buffer, input_size, output_buffer, BENCH_OUTPUT_SIZE, &output_size) != LZKN64_STATUS_OK) {
+        return 0;
+    }
+
+    return output_size;
+}
+
+// The decompression loop as it was before the fast path, kept as the baseline.
+static size_t reference_decompress(const u8 *input_buffer, u8 *output_buffer, size_t input_size) {
+    size_t input_offset = 4; // Skip the first 4 bytes since they are the compressed file size.
+    size_t output_offset = 0;
+    
+    while (input_offset < input_size) {
+        u8 command = input_buffer[input_offset++];
+
+        if (command <= COMMAND_SLIDING_WINDOW_COPY_END) {
+            u8 length = (command & COMMAND_SLIDING_WINDOW_COPY_LENGTH_MASK) >> 2;
+            u16 offset_first_byte = (command & COMMAND_SLIDING_WINDOW_COPY_OFFSET_FIRST_BYTE_MASK) << 8;
+            u8 offset_second_byte = input_buffer[input_offset++];
+            u16 offset = (offset_first_byte | offset_second_byte) & COMMAND_SLIDING_WINDOW_COPY_OFFSET_MAX_MASK;
+
+            // Add 2 to get the actual length since 2 is the minimum length.
+            length += 2;
+            
+            for (size_t i = 0; i < length; i++) {
+                output_buffer[output_offset] = output_buffer[output_offset - offset];
+                output_offset++;
+            }
+        } else if (command >= COMMAND_RAW_COPY_START && command <= COMMAND_RAW_COPY_END) {
+            u8 length = command & COMMAND_RAW_COPY_LENGTH_MASK;
+            
+            for (size_t i = 0; i < length; i++) {
+                output_buffer[output_offset++] = input_buffer[input_offset++];
+            }
+        } else if (command >= COMMAND_RLE_WRITE_SHORT_ANY_VALUE_START && command <= COMMAND_RLE_WRITE_SHORT_ANY_VALUE_END) {
+            u8 length = command & COMMAND_RLE_WRITE_SHORT_ANY_VALUE_LENGTH_MASK;
+            u8 value = input_buffer[input_offset++];
+ 
+            // Add 2 to get the actual length since 2 is the minimum length.
+            length += 2;
+
+            for (size_t i = 0; i < length; i++) {
+                output_buffer[output_offset++] = value;
+            }
+        } else if (command >= COMMAND_RLE_WRITE_SHORT_ZERO_START && command <= COMMAND_RLE_WRITE_SHORT_ZERO_END) {
+            u8 length = command & COMMAND_RLE_WRITE_SHORT_ZERO_LENGTH_MASK;
+
+            // Add 2 to get the actual length since 2 is the minimum length.
+            length += 2;
+
+            for (size_t i = 0; i < length; i++) {
+                output_buffer[output_offset++] = 0;
+            }
+        } else if (command == COMMAND_RLE_WRITE_LONG_ZERO) {
+            u16 length = input_buffer[input_offset++] & COMMAND_RLE_WRITE_LONG_ZERO_LENGTH_MASK;
+
+            // Add 2 to get the actual length since 2 is the minimum length.
+            length += 2;
+
+            for (size_t i = 0; i < length; i++) {
+                output_buffer[output_offset++] = 0;
+            }
+        } else {
+            // Invalid command.
+        }
+    }
+
+    // Return the output offset as the output size.
+    return output_offset;
+}
+
+static f64 get_time(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+
+    return (f64)time.tv_sec + (f64)time.tv_nsec / 1e9;
+}
+
+static u8 *read_file(const char *path, size_t *size) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    *size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    u8 *buffer = malloc(*size);
+    if (buffer != NULL && fread(buffer, 1, *size, file) != *size) {
+        free(buffer);
+        buffer = NULL;
+    }
+
+    fclose(file);
+
+    return buffer;
+}
+
+// Runs the size pass over every file, returning the best time and the number of compressed bytes walked.
+static f64 run_decompressed_size(u8 **buffers, size_t *sizes, size_t buffer_count, u64 *input_size) {
+    f64 best_time = 0.0;
+
+    for (size_t repetition = 0; repetition < BENCH_REPETITIONS; repetition++) {
+        f64 start_time = get_time();
+
+        *input_size = 0;
+
+        for (size_t i = 0; i < buffer_count; i++) {
+            size_t output_size;
+
+            if (lzkn64_decompressed_size(buffers[i], sizes[i], &output_size) == LZKN64_STATUS_OK) {
+                *input_size += sizes[i];
+            }
+        }
+
+        f64 time = get_time() - start_time;
+
+        if (repetition == 0 || time < best_time) {
+            best_time = time;
+        }
+    }
+
+    return best_time;
+}
+
+// Returns the best time of decompressing every file once, and the total number of bytes written.
+static f64 run_decompress(DecompressFunction function, u8 **buffers, size_t *sizes, size_t buffer_count, u8 *output_buffer, u64 *output_size) {
+    f64 best_time = 0.0;
+
+    for (size_t repetition = 0; repetition < BENCH_REPETITIONS; repetition++) {
+        f64 start_time = get_time();
+
+        *output_size = 0;
+
+        for (size_t i = 0; i < buffer_count; i++) {
+            *output_size += function(buffers[i], output_buffer, sizes[i]);
+        }
+
+        f64 time = get_time() - start_time;
+
+        if (repetition == 0 || time < best_time) {
+            best_time = time;
+        }
+    }
+
+    return best_time;
+}
+
+int main(int argc, const char *argv[]) {
+    if (argc < 2) {
+        printf("Usage: lzkn64_decompress_bench <compressed_file> [<compressed_file> ...]\n");
+        return EXIT_FAILURE;
+    }
+
+    size_t buffer_count = argc - 1;
+    u8 **buffers = calloc(buffer_count, sizeof(u8 *));
+    size_t *sizes = calloc(buffer_count, sizeof(size_t));
+    u8 *reference_output = malloc(BENCH_OUTPUT_SIZE);
+    u8 *output = malloc(BENCH_OUTPUT_SIZE);
+
+    for (size_t i = 0; i < buffer_count; i++) {
+        buffers[i] = read_file(argv[i + 1], &sizes[i]);
+
+        if (buffers[i] == NULL || sizes[i] < 4) {
+            printf("Error: Could not read %s.\n", argv[i + 1]);
+            return EXIT_FAILURE;
+        }
+
+        // Only decompress up to the size in the header, padded files have a trailing byte which isn't a command.
+        size_t header_size = ((size_t)buffers[i][1] << 16) | ((size_t)buffers[i][2] << 8) | buffers[i][3];
+        if (header_size < sizes[i]) {
+            sizes[i] = header_size;
+        }
+    }
+
+    bool matching = true;
+
+    for (size_t i = 0; i < buffer_count; i++) {
+        size_t reference_size = reference_decompress(buffers[i], reference_output, sizes[i]);
+        size_t size = lzkn64_decompress(buffers[i], output, sizes[i]);
+
+        if (size != reference_size || memcmp(output, reference_output, size) != 0) {
+            printf("Mismatch: %s\n", argv[i + 1]);
+            matching = false;
+        }
+
+        size = safe_decompress(buffers[i], output, sizes[i]);
+
+        if (size != reference_size || memcmp(output, reference_output, size) != 0) {
+            printf("Mismatch (safe): %s\n", argv[i + 1]);
+            matching = false;
+        }
+
+        if (lzkn64_decompressed_size(buffers[i], sizes[i], &size) != LZKN64_STATUS_OK || size != reference_size) {
+            printf("Mismatch (size): %s\n", argv[i + 1]);
+            matching = false;
+        }
+    }
+
+    u64 reference_output_size = 0;
+    u64 output_size = 0;
+    f64 reference_time = run_decompress(reference_decompress, buffers, sizes, buffer_count, reference_output, &reference_output_size);
+    f64 time = run_decompress(lzkn64_decompress, buffers, sizes, buffer_count, output, &output_size);
+    u64 safe_output_size = 0;
+    f64 safe_time = run_decompress(safe_decompress, buffers, sizes, buffer_count, output, &safe_output_size);
+    u64 size_input_size = 0;
+    f64 size_time = run_decompressed_size(buffers, sizes, buffer_count, &size_input_size);
+
+    printf("reference  %9.2f MB/s\n", (f64)reference_output_size / reference_time / 1e6);
+    printf("fast       %9.2f MB/s  %.2fx\n", (f64)output_size / time / 1e6, reference_time / time);
+    printf("safe       %9.2f MB/s  %.2fx\n", (f64)safe_output_size / safe_time / 1e6, reference_time / safe_time);
+    printf("size pass  %9.2f MB/s of compressed input\n", (f64)size_input_size / size_time / 1e6);
+
+    for (size_t i = 0; i < buffer_count; i++) {
+        free(buffers[i]);
+    }
+
+    free(buffers);
+    free(sizes);
+    free(reference_output);
+    free(output);
+
+    return matching ? EXIT_SUCCESS : EXIT_FAILURE;
+}
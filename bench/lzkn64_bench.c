@@ -0,0 +1,379 @@
+// Benchmark suite over the bundled test corpus.
+// Every file of tests/uncompressed and tests/compressed is loaded once, then each codec runs over the whole corpus for a
+// number of warm iterations. Reports throughput, per-file latency percentiles, compression ratio, peak memory and the
+// throughput per file size bucket, as text and optionally as JSON for tracking regressions between commits.
+
+#include "lzkn64.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef LZKN64_TEST_DIRECTORY
+#define LZKN64_TEST_DIRECTORY "tests"
+#endif
+
+#define BENCH_DEFAULT_ITERATIONS 5
+#define BENCH_BUCKET_COUNT 5
+
+static const size_t bench_bucket_limits[BENCH_BUCKET_COUNT] = { 0x400, 0x4000, 0x10000, 0x40000, (size_t)-1 };
+static const char *bench_bucket_names[BENCH_BUCKET_COUNT] = { "<1K", "1K-16K", "16K-64K", "64K-256K", ">=256K" };
+
+enum BenchCodec {
+    BENCH_CODEC_ACCURATE,
+    BENCH_CODEC_EFFICIENT,
+    BENCH_CODEC_OPTIMAL,
+    BENCH_CODEC_DECOMPRESS,
+    BENCH_CODEC_COUNT
+};
+
+static const char *bench_codec_names[BENCH_CODEC_COUNT] = { "accurate", "efficient", "optimal", "decompress" };
+
+struct BenchFile {
+    char name[256];
+    u8 *uncompressed;
+    size_t uncompressed_size;
+    u8 *compressed;
+    size_t compressed_size;
+};
+
+struct BenchResult {
+    f64 total_time; // Of one pass over the corpus, averaged over the iterations.
+    f64 throughput; // Megabytes of uncompressed data per second.
+    f64 ratio;
+    f64 latency_p50;
+    f64 latency_p90;
+    f64 latency_p99;
+    f64 latency_max;
+    f64 bucket_throughput[BENCH_BUCKET_COUNT];
+    size_t bucket_file_count[BENCH_BUCKET_COUNT];
+    long peak_memory; // Kilobytes, of a process that only ran this codec after loading the corpus.
+};
+
+static f64 get_time(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+
+    return (f64)time.tv_sec + (f64)time.tv_nsec / 1e9;
+}
+
+static u8 *read_file(const char *path, size_t *size) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    *size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    u8 *buffer = malloc(*size > 0 ? *size : 1);
+    if (buffer != NULL && fread(buffer, 1, *size, file) != *size) {
+        free(buffer);
+        buffer = NULL;
+    }
+
+    fclose(file);
+
+    return buffer;
+}
+
+static int compare_files(const void *first, const void *second) {
+    return strcmp(((const struct BenchFile *)first)->name, ((const struct BenchFile *)second)->name);
+}
+
+static int compare_times(const void *first, const void *second) {
+    f64 difference = *(const f64 *)first - *(const f64 *)second;
+
+    return (difference > 0.0) - (difference < 0.0);
+}
+
+static struct BenchFile *load_corpus(const char *test_directory, size_t *file_count) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/uncompressed", test_directory);
+
+    DIR *directory = opendir(path);
+    if (directory == NULL) {
+        return NULL;
+    }
+
+    struct BenchFile *files = NULL;
+    size_t file_capacity = 0;
+    struct dirent *directory_entry;
+
+    *file_count = 0;
+
+    while ((directory_entry = readdir(directory)) != NULL) {
+        if (directory_entry->d_name[0] == '.') {
+            continue;
+        }
+
+        if (*file_count == file_capacity) {
+            file_capacity = file_capacity == 0 ? 1024 : file_capacity * 2;
+            files = realloc(files, file_capacity * sizeof(struct BenchFile));
+
+            if (files == NULL) {
+                closedir(directory);
+                return NULL;
+            }
+        }
+
+        struct BenchFile *file = &files[*file_count];
+        snprintf(file->name, sizeof(file->name), "%s", directory_entry->d_name);
+
+        snprintf(path, sizeof(path), "%s/uncompressed/%s", test_directory, file->name);
+        file->uncompressed = read_file(path, &file->uncompressed_size);
+
+        snprintf(path, sizeof(path), "%s/compressed/%s", test_directory, file->name);
+        file->compressed = read_file(path, &file->compressed_size);
+
+        if (file->uncompressed == NULL || file->compressed == NULL) {
+            printf("Error: Could not read %s.\n", file->name);
+            closedir(directory);
+            return NULL;
+        }
+
+        (*file_count)++;
+    }
+
+    closedir(directory);
+    qsort(files, *file_count, sizeof(struct BenchFile), compare_files);
+
+    return files;
+}
+
+static size_t run_codec(enum BenchCodec codec, const struct BenchFile *file, u8 *output_buffer, size_t output_capacity) {
+    size_t output_size = 0;
+
+    switch (codec) {
+        case BENCH_CODEC_ACCURATE:
+            output_size = lzkn64_compress_accurate(file->uncompressed, output_buffer, file->uncompressed_size);
+            break;
+        case BENCH_CODEC_EFFICIENT:
+            output_size = lzkn64_compress_efficient(file->uncompressed, output_buffer, file->uncompressed_size);
+            break;
+        case BENCH_CODEC_OPTIMAL:
+            output_size = lzkn64_compress_optimal(file->uncompressed, output_buffer, file->uncompressed_size);
+            break;
+        default:
+            lzkn64_decompress_safe(file->compressed, file->compressed_size, output_buffer, output_capacity, &output_size);
+            break;
+    }
+
+    return output_size;
+}
+
+static void run_benchmark(enum BenchCodec codec, const struct BenchFile *files, size_t file_count, size_t iterations, u8 *output_buffer, size_t output_capacity, struct BenchResult *result) {
+    f64 *latencies = calloc(file_count, sizeof(f64));
+    f64 bucket_time[BENCH_BUCKET_COUNT] = { 0.0 };
+    u64 bucket_size[BENCH_BUCKET_COUNT] = { 0 };
+    u64 total_input_size = 0;
+    u64 total_output_size = 0;
+
+    memset(result, 0, sizeof(struct BenchResult));
+
+    // The first pass only warms up the caches and isn't measured.
+    for (size_t iteration = 0; iteration <= iterations; iteration++) {
+        for (size_t i = 0; i < file_count; i++) {
+            f64 start_time = get_time();
+            size_t output_size = run_codec(codec, &files[i], output_buffer, output_capacity);
+            f64 time = get_time() - start_time;
+
+            if (iteration > 0) {
+                latencies[i] += time / (f64)iterations;
+
+                if (iteration == 1) {
+                    total_input_size += files[i].uncompressed_size;
+                    total_output_size += codec == BENCH_CODEC_DECOMPRESS ? files[i].compressed_size : output_size;
+                }
+            }
+        }
+    }
+
+    for (size_t i = 0; i < file_count; i++) {
+        size_t bucket = 0;
+
+        while (files[i].uncompressed_size >= bench_bucket_limits[bucket]) {
+            bucket++;
+        }
+
+        result->total_time += latencies[i];
+        bucket_time[bucket] += latencies[i];
+        bucket_size[bucket] += files[i].uncompressed_size;
+        result->bucket_file_count[bucket]++;
+    }
+
+    for (size_t bucket = 0; bucket < BENCH_BUCKET_COUNT; bucket++) {
+        result->bucket_throughput[bucket] = bucket_time[bucket] > 0.0 ? (f64)bucket_size[bucket] / bucket_time[bucket] / 1e6 : 0.0;
+    }
+
+    qsort(latencies, file_count, sizeof(f64), compare_times);
+
+    result->throughput = result->total_time > 0.0 ? (f64)total_input_size / result->total_time / 1e6 : 0.0;
+    result->ratio = total_input_size > 0 ? (f64)total_output_size / (f64)total_input_size : 0.0;
+    result->latency_p50 = latencies[(file_count * 50) / 100];
+    result->latency_p90 = latencies[(file_count * 90) / 100];
+    result->latency_p99 = latencies[(file_count * 99) / 100];
+    result->latency_max = latencies[file_count - 1];
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    result->peak_memory = usage.ru_maxrss;
+
+    free(latencies);
+}
+
+// The peak memory of a process never goes down, so every codec runs in a child forked after loading the corpus, which
+// sends its result back through a pipe. Runs in this process instead if the child can't be started.
+static void run_benchmark_isolated(enum BenchCodec codec, const struct BenchFile *files, size_t file_count, size_t iterations, u8 *output_buffer, size_t output_capacity, struct BenchResult *result) {
+    int pipe_descriptors[2];
+    pid_t child = -1;
+
+    if (pipe(pipe_descriptors) == 0) {
+        fflush(stdout);
+        child = fork();
+
+        if (child == 0) {
+            close(pipe_descriptors[0]);
+            run_benchmark(codec, files, file_count, iterations, output_buffer, output_capacity, result);
+            _exit(write(pipe_descriptors[1], result, sizeof(struct BenchResult)) == sizeof(struct BenchResult) ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+
+        close(pipe_descriptors[1]);
+
+        if (child > 0) {
+            bool received = read(pipe_descriptors[0], result, sizeof(struct BenchResult)) == sizeof(struct BenchResult);
+            int status = 0;
+
+            waitpid(child, &status, 0);
+
+            if (!received || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+                child = -1;
+            }
+        }
+
+        close(pipe_descriptors[0]);
+    }
+
+    if (child < 0) {
+        run_benchmark(codec, files, file_count, iterations, output_buffer, output_capacity, result);
+    }
+}
+
+static void write_json(FILE *file, const struct BenchResult *results, size_t file_count, size_t iterations) {
+    fprintf(file, "{\n  \"files\": %zu,\n  \"iterations\": %zu,\n  \"codecs\": {\n", file_count, iterations);
+
+    for (size_t codec = 0; codec < BENCH_CODEC_COUNT; codec++) {
+        const struct BenchResult *result = &results[codec];
+
+        fprintf(file, "    \"%s\": {\n", bench_codec_names[codec]);
+        fprintf(file, "      \"throughput_mb_s\": %.3f,\n", result->throughput);
+        fprintf(file, "      \"corpus_time_s\": %.6f,\n", result->total_time);
+        fprintf(file, "      \"ratio\": %.6f,\n", result->ratio);
+        fprintf(file, "      \"latency_us\": { \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f },\n", result->latency_p50 * 1e6, result->latency_p90 * 1e6, result->latency_p99 * 1e6, result->latency_max * 1e6);
+        fprintf(file, "      \"peak_memory_kb\": %ld,\n", result->peak_memory);
+        fprintf(file, "      \"buckets\": [");
+
+        for (size_t bucket = 0; bucket < BENCH_BUCKET_COUNT; bucket++) {
+            fprintf(file, "%s{ \"size\": \"%s\", \"files\": %zu, \"throughput_mb_s\": %.3f }", bucket > 0 ? ", " : "", bench_bucket_names[bucket], result->bucket_file_count[bucket], result->bucket_throughput[bucket]);
+        }
+
+        fprintf(file, "]\n    }%s\n", codec + 1 < BENCH_CODEC_COUNT ? "," : "");
+    }
+
+    fprintf(file, "  }\n}\n");
+}
+
+int main(int argc, const char *argv[]) {
+    const char *test_directory = LZKN64_TEST_DIRECTORY;
+    const char *json_path = NULL;
+    size_t iterations = BENCH_DEFAULT_ITERATIONS;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-i") == 0 && (i + 1) < argc) {
+            iterations = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-j") == 0 && (i + 1) < argc) {
+            json_path = argv[++i];
+        } else if (argv[i][0] != '-') {
+            test_directory = argv[i];
+        } else {
+            printf("Usage: lzkn64_bench [-i <iterations>] [-j <json_file>] [<test_directory>]\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (iterations == 0) {
+        iterations = 1;
+    }
+
+    size_t file_count = 0;
+    struct BenchFile *files = load_corpus(test_directory, &file_count);
+
+    if (files == NULL || file_count == 0) {
+        printf("Error: Could not load the corpus from %s.\n", test_directory);
+        return EXIT_FAILURE;
+    }
+
+    size_t output_capacity = 0;
+
+    for (size_t i = 0; i < file_count; i++) {
+        size_t capacity = lzkn64_compress_bound(files[i].uncompressed_size);
+
+        if (capacity > output_capacity) {
+            output_capacity = capacity;
+        }
+    }
+
+    u8 *output_buffer = malloc(output_capacity);
+    struct BenchResult results[BENCH_CODEC_COUNT];
+
+    printf("%zu files, %zu iterations\n\n", file_count, iterations);
+    printf("%-10s %10s %8s %10s %10s %10s %10s %10s", "codec", "MB/s", "ratio", "p50 us", "p90 us", "p99 us", "max us", "peak KB");
+
+    for (size_t bucket = 0; bucket < BENCH_BUCKET_COUNT; bucket++) {
+        printf(" %9s", bench_bucket_names[bucket]);
+    }
+
+    printf("\n");
+
+    for (size_t codec = 0; codec < BENCH_CODEC_COUNT; codec++) {
+        struct BenchResult *result = &results[codec];
+
+        run_benchmark_isolated(codec, files, file_count, iterations, output_buffer, output_capacity, result);
+
+        printf("%-10s %10.2f %8.4f %10.2f %10.2f %10.2f %10.2f %10ld", bench_codec_names[codec], result->throughput, result->ratio, result->latency_p50 * 1e6, result->latency_p90 * 1e6, result->latency_p99 * 1e6, result->latency_max * 1e6, result->peak_memory);
+
+        for (size_t bucket = 0; bucket < BENCH_BUCKET_COUNT; bucket++) {
+            printf(" %9.2f", result->bucket_throughput[bucket]);
+        }
+
+        printf("\n");
+    }
+
+    if (json_path != NULL) {
+        FILE *json_file = fopen(json_path, "w");
+
+        if (json_file == NULL) {
+            printf("Error: Could not open %s.\n", json_path);
+            return EXIT_FAILURE;
+        }
+
+        write_json(json_file, results, file_count, iterations);
+        fclose(json_file);
+    }
+
+    for (size_t i = 0; i < file_count; i++) {
+        free(files[i].uncompressed);
+        free(files[i].compressed);
+    }
+
+    free(files);
+    free(output_buffer);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,148 @@
+// Microbenchmark for the match length kernels.
+// Every position of the given files is compared against a spread of offsets in the sliding window, the same kind of
+// comparisons the match finder makes, and each kernel is timed on the exact same comparisons.
+
+#include "match_length.h"
+#include "lzkn64.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BENCH_REPETITIONS 5
+
+static const size_t bench_offsets[] = { 1, 2, 3, 4, 8, 16, 32, 64, 128, 256, 512, SLIDING_WINDOW_SIZE_EFFICIENT };
+
+struct Kernel {
+    const char *name;
+    MatchLengthFunction function;
+};
+
+static f64 get_time(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+
+    return (f64)time.tv_sec + (f64)time.tv_nsec / 1e9;
+}
+
+static u8 *read_file(const char *path, size_t *size) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    *size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    u8 *buffer = malloc(*size);
+    if (buffer != NULL && fread(buffer, 1, *size, file) != *size) {
+        free(buffer);
+        buffer = NULL;
+    }
+
+    fclose(file);
+
+    return buffer;
+}
+
+// Runs every comparison once, returning the sum of the match lengths so the work can't be optimized away.
+static u64 run_kernel(MatchLengthFunction function, u8 **buffers, size_t *sizes, size_t buffer_count, u64 *comparison_count) {
+    u64 total_length = 0;
+
+    *comparison_count = 0;
+
+    for (size_t i = 0; i < buffer_count; i++) {
+        for (size_t offset_index = 0; offset_index < sizeof(bench_offsets) / sizeof(bench_offsets[0]); offset_index++) {
+            size_t offset = bench_offsets[offset_index];
+
+            for (size_t position = offset; position < sizes[i]; position++) {
+                size_t maximum_length = sizes[i] - position;
+
+                if (maximum_length > SLIDING_WINDOW_COPY_MAXIMUM_LENGTH) {
+                    maximum_length = SLIDING_WINDOW_COPY_MAXIMUM_LENGTH;
+                }
+
+                total_length += function(&buffers[i][position - offset], &buffers[i][position], maximum_length);
+            }
+
+            *comparison_count += sizes[i] - offset;
+        }
+    }
+
+    return total_length;
+}
+
+int main(int argc, const char *argv[]) {
+    if (argc < 2) {
+        printf("Usage: lzkn64_match_length_bench <file> [<file> ...]\n");
+        return EXIT_FAILURE;
+    }
+
+    size_t buffer_count = argc - 1;
+    u8 **buffers = calloc(buffer_count, sizeof(u8 *));
+    size_t *sizes = calloc(buffer_count, sizeof(size_t));
+
+    for (size_t i = 0; i < buffer_count; i++) {
+        buffers[i] = read_file(argv[i + 1], &sizes[i]);
+
+        if (buffers[i] == NULL) {
+            printf("Error: Could not read %s.\n", argv[i + 1]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    struct Kernel kernels[] = {
+        { "scalar", match_length_scalar },
+        { "word", match_length_word },
+        { "sse2", match_length_sse2 },
+        { "avx2", match_length_avx2 },
+    };
+
+    MatchLengthFunction selected = match_length_select();
+    u64 reference_length = 0;
+    f64 reference_time = 0.0;
+    bool matching = true;
+
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+        struct Kernel *kernel = &kernels[i];
+
+        // Kernels which weren't built or can't run on this CPU are skipped.
+        if (kernel->function == NULL || (kernel->function == match_length_avx2 && selected != match_length_avx2)) {
+            printf("%-8s unavailable\n", kernel->name);
+            continue;
+        }
+
+        u64 comparison_count = 0;
+        u64 total_length = 0;
+        f64 best_time = 0.0;
+
+        for (size_t repetition = 0; repetition < BENCH_REPETITIONS; repetition++) {
+            f64 start_time = get_time();
+            total_length = run_kernel(kernel->function, buffers, sizes, buffer_count, &comparison_count);
+            f64 time = get_time() - start_time;
+
+            if (repetition == 0 || time < best_time) {
+                best_time = time;
+            }
+        }
+
+        if (i == 0) {
+            reference_length = total_length;
+            reference_time = best_time;
+        } else if (total_length != reference_length) {
+            matching = false;
+        }
+
+        printf("%-8s %8.2f ns/compare  %6.2fx  %s\n", kernel->name, best_time * 1e9 / (f64)comparison_count, reference_time / best_time, total_length == reference_length ? "ok" : "MISMATCH");
+    }
+
+    for (size_t i = 0; i < buffer_count; i++) {
+        free(buffers[i]);
+    }
+
+    free(buffers);
+    free(sizes);
+
+    return matching ? EXIT_SUCCESS : EXIT_FAILURE;
+}
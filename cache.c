@@ -0,0 +1,218 @@
+#include "cache.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+
+#define CACHE_HASH_PRIME_FIRST 0x9E3779B97F4A7C15ull
+#define CACHE_HASH_PRIME_SECOND 0xC2B2AE3D27D4EB4Full
+
+struct CacheFile {
+    char *path;
+    u64 size;
+    s64 time;
+};
+
+static u64 rotate_left(u64 value, unsigned int count) {
+    return (value << count) | (value >> (64 - count));
+}
+
+// Spreads every bit of value over the whole word.
+static u64 cache_mix(u64 value) {
+    value ^= value >> 33;
+    value *= 0xFF51AFD7ED558CCDull;
+    value ^= value >> 33;
+    value *= 0xC4CEB9FE1A85EC53ull;
+    value ^= value >> 33;
+
+    return value;
+}
+
+// Reads 8 bytes as little endian, so the keys are the same on every machine sharing a cache.
+static u64 read_word(const u8 *data) {
+    u64 value = 0;
+
+    for (size_t i = 0; i < 8; i++) {
+        value |= (u64)data[i] << (i * 8);
+    }
+
+    return value;
+}
+
+void cache_hash(const u8 *input_buffer, size_t input_size, u64 seed, u64 hash[2]) {
+    // Two independent lanes over 8 bytes at a time, which is far faster than any of the compressors.
+    u64 first = CACHE_HASH_PRIME_FIRST ^ input_size;
+    u64 second = CACHE_HASH_PRIME_SECOND ^ seed;
+    size_t offset = 0;
+
+    for (; (offset + 8) <= input_size; offset += 8) {
+        u64 word = read_word(&input_buffer[offset]);
+
+        first = rotate_left(first ^ (word * CACHE_HASH_PRIME_SECOND), 31) * CACHE_HASH_PRIME_FIRST;
+        second = rotate_left(second + (word * CACHE_HASH_PRIME_FIRST), 29) * CACHE_HASH_PRIME_SECOND;
+    }
+
+    u8 tail[8] = { 0 };
+    memcpy(tail, &input_buffer[offset], input_size - offset);
+
+    u64 word = read_word(tail);
+    first = cache_mix(first ^ word ^ (u64)(input_size - offset));
+    second = cache_mix(second ^ rotate_left(word, 32) ^ first);
+    first = cache_mix(first + second);
+
+    hash[0] = first;
+    hash[1] = second;
+}
+
+void cache_key(const u8 *input_buffer, size_t input_size, enum Lzkn64CompressionType compression_type, bool pad_output, char key[CACHE_KEY_LENGTH + 1]) {
+    u64 hash[2];
+    cache_hash(input_buffer, input_size, ((u64)CACHE_VERSION << 32) ^ ((u64)compression_type << 8) ^ (u64)pad_output, hash);
+
+    snprintf(key, CACHE_KEY_LENGTH + 1, "%016llx%016llx", (unsigned long long)hash[0], (unsigned long long)hash[1]);
+}
+
+static char *entry_path(const char *directory, const char *name) {
+    size_t length = strlen(directory) + strlen(name) + 2;
+    char *path = malloc(length);
+
+    if (path != NULL) {
+        snprintf(path, length, "%s/%s", directory, name);
+    }
+
+    return path;
+}
+
+bool cache_load(const char *directory, const char *key, u8 *output_buffer, size_t output_capacity, size_t *output_size) {
+    char *path = entry_path(directory, key);
+    if (path == NULL) {
+        return false;
+    }
+
+    FILE *file = fopen(path, "rb");
+    bool successful = false;
+
+    if (file != NULL) {
+        *output_size = fread(output_buffer, 1, output_capacity, file);
+
+        // Anything that doesn't fit can't be the output for this input, so it isn't used.
+        successful = ferror(file) == 0 && fgetc(file) == EOF && *output_size > 0;
+        fclose(file);
+    }
+
+    // The modification time is when the entry was last used.
+    if (successful) {
+        utime(path, NULL);
+    }
+
+    free(path);
+
+    return successful;
+}
+
+bool cache_store(const char *directory, const char *key, const u8 *output_buffer, size_t output_size, size_t unique_index) {
+    char name[CACHE_KEY_LENGTH + 64];
+    snprintf(name, sizeof(name), "%s.%ld.%zu.tmp", key, (long)getpid(), unique_index);
+
+    char *temporary_path = entry_path(directory, name);
+    char *path = entry_path(directory, key);
+    bool successful = false;
+
+    if (temporary_path != NULL && path != NULL) {
+        FILE *file = fopen(temporary_path, "wb");
+
+        if (file != NULL) {
+            successful = fwrite(output_buffer, 1, output_size, file) == output_size;
+            successful &= fclose(file) == 0;
+            successful = successful && rename(temporary_path, path) == 0;
+
+            if (!successful) {
+                remove(temporary_path);
+            }
+        }
+    }
+
+    free(temporary_path);
+    free(path);
+
+    return successful;
+}
+
+static int compare_files(const void *first, const void *second) {
+    const struct CacheFile *first_file = first;
+    const struct CacheFile *second_file = second;
+
+    if (first_file->time != second_file->time) {
+        return first_file->time < second_file->time ? -1 : 1;
+    }
+
+    return strcmp(first_file->path, second_file->path);
+}
+
+void cache_trim(const char *directory, u64 maximum_size) {
+    DIR *cache_directory = opendir(directory);
+    if (cache_directory == NULL) {
+        return;
+    }
+
+    struct CacheFile *files = NULL;
+    size_t file_count = 0;
+    size_t file_capacity = 0;
+    u64 total_size = 0;
+    struct dirent *directory_entry;
+
+    while ((directory_entry = readdir(cache_directory)) != NULL) {
+        // Only complete entries are named after just their key, anything else is left alone.
+        if (strlen(directory_entry->d_name) != CACHE_KEY_LENGTH) {
+            continue;
+        }
+
+        char *path = entry_path(directory, directory_entry->d_name);
+        struct stat file_stat;
+
+        if (path == NULL || stat(path, &file_stat) != 0 || !S_ISREG(file_stat.st_mode)) {
+            free(path);
+            continue;
+        }
+
+        if (file_count == file_capacity) {
+            file_capacity = file_capacity == 0 ? 256 : file_capacity * 2;
+            struct CacheFile *resized_files = realloc(files, file_capacity * sizeof(struct CacheFile));
+
+            if (resized_files == NULL) {
+                free(path);
+                break;
+            }
+
+            files = resized_files;
+        }
+
+        files[file_count].path = path;
+        files[file_count].size = (u64)file_stat.st_size;
+        files[file_count].time = (s64)file_stat.st_mtime;
+        file_count++;
+
+        total_size += (u64)file_stat.st_size;
+    }
+
+    closedir(cache_directory);
+
+    if (total_size > maximum_size) {
+        qsort(files, file_count, sizeof(struct CacheFile), compare_files);
+
+        for (size_t i = 0; i < file_count && total_size > maximum_size; i++) {
+            if (remove(files[i].path) == 0) {
+                total_size -= files[i].size;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < file_count; i++) {
+        free(files[i].path);
+    }
+
+    free(files);
+}
@@ -0,0 +1,32 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "lzkn64.h"
+#include "types.h"
+
+#define CACHE_KEY_LENGTH 32 // Hexadecimal digits of the 128-bit key.
+#define CACHE_DEFAULT_MAXIMUM_SIZE 0x40000000 // 1 GB
+
+// Bump whenever the output of any compression algorithm changes, so entries made by older versions are never used.
+#define CACHE_VERSION 2
+
+// Hashes a buffer into 128 bits, different seeds giving unrelated hashes of the same data. The result is the same on
+// every machine.
+void cache_hash(const u8 *input_buffer, size_t input_size, u64 seed, u64 hash[2]);
+
+// Computes the key a compressed file is stored under, a hash of the input together with everything else that changes
+// the output: the algorithm, the padding and the cache version.
+void cache_key(const u8 *input_buffer, size_t input_size, enum Lzkn64CompressionType compression_type, bool pad_output, char key[CACHE_KEY_LENGTH + 1]);
+
+// Reads the entry for key into output_buffer, and marks it as the most recently used one. Returns false if there is no
+// such entry or it doesn't fit in output_capacity bytes.
+bool cache_load(const char *directory, const char *key, u8 *output_buffer, size_t output_capacity, size_t *output_size);
+
+// Stores an entry, it is written under a temporary name and then renamed so that other threads and processes only ever
+// see complete entries. unique_index has to be different for every thread storing at the same time.
+bool cache_store(const char *directory, const char *key, const u8 *output_buffer, size_t output_size, size_t unique_index);
+
+// Deletes the least recently used entries until the ones left add up to at most maximum_size bytes.
+void cache_trim(const char *directory, u64 maximum_size);
+
+#endif // CACHE_H
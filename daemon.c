@@ -0,0 +1,668 @@
+#include "daemon.h"
+#include "lzkn64.h"
+#include "mapped_file.h"
+#include "parallel.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DAEMON_MAXIMUM_PATH_LENGTH 4096
+#define DAEMON_MESSAGE_SIZE (DAEMON_MAXIMUM_PATH_LENGTH + 64)
+#define DAEMON_ACCEPT_RETRY_DELAY 100000000 // Nanoseconds to wait after accept runs out of descriptors or memory.
+
+enum DaemonRequestType {
+    DAEMON_REQUEST_COMPRESS_FILE,
+    DAEMON_REQUEST_DECOMPRESS_FILE,
+    DAEMON_REQUEST_COMPRESS_DATA,
+    DAEMON_REQUEST_DECOMPRESS_DATA,
+    DAEMON_REQUEST_STATUS,
+    DAEMON_REQUEST_TYPE_COUNT,
+};
+
+static const char *daemon_request_names[DAEMON_REQUEST_TYPE_COUNT] = {
+    "compress file",
+    "decompress file",
+    "compress data",
+    "decompress data",
+    "status",
+};
+
+// Requests and responses never leave the machine, so they are sent in native byte order. A connection can carry any
+// number of requests, each answered before the next one is read.
+struct DaemonRequest {
+    u32 type;
+    u32 compression_type;
+    u32 pad_output;
+    u32 verify;
+    u32 first_size; // Length of the input path that follows, or of the data.
+    u32 second_size; // Length of the output path that follows the input path.
+};
+
+struct DaemonResponse {
+    u32 successful;
+    u32 size; // Length of the output data, error message or status text that follows.
+};
+
+struct DaemonCounters {
+    u64 request_count;
+    u64 error_count;
+    u64 input_size;
+    u64 output_size;
+    f64 total_time;
+    f64 maximum_time;
+};
+
+struct DaemonServer {
+    const struct Arguments *arguments;
+    int socket;
+    size_t worker_count;
+    f64 start_time;
+    pthread_mutex_t mutex;
+    struct DaemonCounters counters[DAEMON_REQUEST_TYPE_COUNT];
+};
+
+// State owned by one worker thread, kept from one request to the next.
+struct DaemonWorker {
+    struct DaemonServer *server;
+    struct Lzkn64Context *context;
+    u8 *input_buffer;
+    size_t input_capacity;
+    u8 *output_buffer;
+    size_t output_capacity;
+};
+
+static bool read_all(int descriptor, void *buffer, size_t size) {
+    u8 *data = buffer;
+
+    while (size > 0) {
+        ssize_t length = read(descriptor, data, size);
+
+        if (length < 0 && errno == EINTR) {
+            continue;
+        } else if (length <= 0) {
+            return false;
+        }
+
+        data += length;
+        size -= length;
+    }
+
+    return true;
+}
+
+static bool write_all(int descriptor, const void *buffer, size_t size) {
+    const u8 *data = buffer;
+
+    while (size > 0) {
+        ssize_t length = send(descriptor, data, size, MSG_NOSIGNAL);
+
+        if (length < 0 && errno == EINTR) {
+            continue;
+        } else if (length <= 0) {
+            return false;
+        }
+
+        data += length;
+        size -= length;
+    }
+
+    return true;
+}
+
+static bool reserve_buffer(u8 **buffer, size_t *capacity, size_t size) {
+    if (size > *capacity || *buffer == NULL) {
+        u8 *resized_buffer = realloc(*buffer, size > 0 ? size : 1);
+
+        if (resized_buffer == NULL) {
+            return false;
+        }
+
+        *buffer = resized_buffer;
+        *capacity = size;
+    }
+
+    return true;
+}
+
+static bool connect_socket(const char *socket_path, int *descriptor) {
+    struct sockaddr_un address;
+
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        return false;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path);
+
+    *descriptor = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (*descriptor < 0) {
+        return false;
+    }
+
+    if (connect(*descriptor, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        close(*descriptor);
+        return false;
+    }
+
+    return true;
+}
+
+// Same as the mapped file path of the CLI, the daemon reads and writes the files itself. Returns the output size, or
+// writes the reason into message.
+static bool process_file(struct DaemonWorker *worker, const struct Arguments *arguments, const char *input_path, const char *output_path, size_t *input_size, size_t *output_size, char *message) {
+    struct MappedFile input_file;
+    struct MappedFile output_file;
+
+    if (!mapped_file_open(&input_file, input_path, mapped_file_same(input_path, output_path))) {
+        snprintf(message, DAEMON_MESSAGE_SIZE, "Could not read input file %s.", input_path);
+        return false;
+    }
+
+    *input_size = input_file.size;
+
+    if (arguments->mode == MODE_COMPRESS) {
+        if (input_file.size > LZKN64_MAXIMUM_FILE_SIZE) {
+            snprintf(message, DAEMON_MESSAGE_SIZE, "Input file is too large, the compressed size has to fit in 24 bits.");
+            mapped_file_close(&input_file);
+            return false;
+        }
+
+        if (!mapped_file_create(&output_file, output_path, lzkn64_compress_bound(input_file.size))) {
+            snprintf(message, DAEMON_MESSAGE_SIZE, "Could not open output file %s.", output_path);
+            mapped_file_close(&input_file);
+            return false;
+        }
+
+        struct Lzkn64Mismatch mismatch;
+
+        enum Lzkn64Status status = compress_buffer(arguments, worker->context, input_file.data, output_file.data, input_file.size, &output_file.size, &mismatch);
+        if (status != LZKN64_STATUS_OK) {
+            char text[256];
+            format_compress_error(status, &mismatch, text, sizeof(text));
+
+            snprintf(message, DAEMON_MESSAGE_SIZE, "Could not compress input file (%s).", text);
+            mapped_file_close(&input_file);
+            mapped_file_close(&output_file);
+            remove(output_path);
+            return false;
+        }
+    } else {
+        size_t decompressed_size = 0;
+
+        enum Lzkn64Status status = lzkn64_decompressed_size(input_file.data, input_file.size, &decompressed_size);
+        if (status != LZKN64_STATUS_OK) {
+            snprintf(message, DAEMON_MESSAGE_SIZE, "Could not decompress input file (%s).", lzkn64_status_string(status));
+            mapped_file_close(&input_file);
+            return false;
+        }
+
+        if (!mapped_file_create(&output_file, output_path, decompressed_size)) {
+            snprintf(message, DAEMON_MESSAGE_SIZE, "Could not open output file %s.", output_path);
+            mapped_file_close(&input_file);
+            return false;
+        }
+
+        status = lzkn64_decompress_safe(input_file.data, input_file.size, output_file.data, decompressed_size, &output_file.size);
+        if (status != LZKN64_STATUS_OK) {
+            snprintf(message, DAEMON_MESSAGE_SIZE, "Could not decompress input file (%s).", lzkn64_status_string(status));
+            mapped_file_close(&input_file);
+            mapped_file_close(&output_file);
+            remove(output_path);
+            return false;
+        }
+    }
+
+    mapped_file_close(&input_file);
+    *output_size = output_file.size;
+
+    if (!mapped_file_close(&output_file)) {
+        snprintf(message, DAEMON_MESSAGE_SIZE, "Could not write output file %s.", output_path);
+        return false;
+    }
+
+    return true;
+}
+
+// Compresses or decompresses the data in the worker's input buffer into its output buffer.
+static bool process_data(struct DaemonWorker *worker, const struct Arguments *arguments, size_t input_size, size_t *output_size, char *message) {
+    size_t output_capacity = 0;
+
+    if (arguments->mode == MODE_COMPRESS) {
+        output_capacity = lzkn64_compress_bound(input_size);
+    } else {
+        enum Lzkn64Status status = lzkn64_decompressed_size(worker->input_buffer, input_size, &output_capacity);
+
+        if (status != LZKN64_STATUS_OK) {
+            snprintf(message, DAEMON_MESSAGE_SIZE, "Could not decompress input file (%s).", lzkn64_status_string(status));
+            return false;
+        }
+    }
+
+    if (!reserve_buffer(&worker->output_buffer, &worker->output_capacity, output_capacity)) {
+        snprintf(message, DAEMON_MESSAGE_SIZE, "Could not allocate memory for output buffer.");
+        return false;
+    }
+
+    if (arguments->mode == MODE_COMPRESS) {
+        struct Lzkn64Mismatch mismatch;
+
+        enum Lzkn64Status status = compress_buffer(arguments, worker->context, worker->input_buffer, worker->output_buffer, input_size, output_size, &mismatch);
+        if (status != LZKN64_STATUS_OK) {
+            char text[256];
+            format_compress_error(status, &mismatch, text, sizeof(text));
+
+            snprintf(message, DAEMON_MESSAGE_SIZE, "Could not compress input file (%s).", text);
+            return false;
+        }
+    } else {
+        enum Lzkn64Status status = lzkn64_decompress_safe(worker->input_buffer, input_size, worker->output_buffer, worker->output_capacity, output_size);
+
+        if (status != LZKN64_STATUS_OK) {
+            snprintf(message, DAEMON_MESSAGE_SIZE, "Could not decompress input file (%s).", lzkn64_status_string(status));
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static size_t format_status(struct DaemonServer *server, char *text, size_t text_capacity) {
+    size_t length = 0;
+
+    pthread_mutex_lock(&server->mutex);
+
+    length += snprintf(&text[length], text_capacity - length, "Up for %.3f s with %zu workers.\n", get_time() - server->start_time, server->worker_count);
+
+    for (size_t i = 0; i < DAEMON_REQUEST_TYPE_COUNT && length < text_capacity; i++) {
+        const struct DaemonCounters *counters = &server->counters[i];
+
+        length += snprintf(&text[length], text_capacity - length, "%s: %llu requests, %llu failed, read %llu bytes, wrote %llu bytes, %.3f ms average, %.3f ms max, %.2f MB/s of input.\n", daemon_request_names[i], (unsigned long long)counters->request_count, (unsigned long long)counters->error_count, (unsigned long long)counters->input_size, (unsigned long long)counters->output_size, counters->request_count > 0 ? counters->total_time * 1e3 / (f64)counters->request_count : 0.0, counters->maximum_time * 1e3, counters->total_time > 0.0 ? (f64)counters->input_size / counters->total_time / 1e6 : 0.0);
+    }
+
+    pthread_mutex_unlock(&server->mutex);
+
+    return length < text_capacity ? length : text_capacity - 1;
+}
+
+// Reads the rest of a request, answers it, and returns false if the connection can't be used anymore.
+static bool handle_request(struct DaemonWorker *worker, int descriptor, const struct DaemonRequest *request) {
+    struct DaemonServer *server = worker->server;
+    struct Arguments arguments = *server->arguments;
+    char message[DAEMON_MESSAGE_SIZE];
+    char input_path[DAEMON_MAXIMUM_PATH_LENGTH + 1];
+    char output_path[DAEMON_MAXIMUM_PATH_LENGTH + 1];
+    const u8 *output_data = NULL;
+    size_t input_size = 0;
+    size_t output_size = 0;
+    bool successful = false;
+    bool file_request = request->type == DAEMON_REQUEST_COMPRESS_FILE || request->type == DAEMON_REQUEST_DECOMPRESS_FILE;
+    f64 start_time = get_time();
+
+    if (request->type >= DAEMON_REQUEST_TYPE_COUNT || request->compression_type > LZKN64_COMPRESSION_TYPE_OPTIMAL) {
+        return false;
+    }
+
+    if (file_request && (request->first_size > DAEMON_MAXIMUM_PATH_LENGTH || request->second_size > DAEMON_MAXIMUM_PATH_LENGTH)) {
+        return false;
+    } else if (!file_request && (request->first_size > LZKN64_MAXIMUM_FILE_SIZE || request->second_size != 0)) {
+        return false;
+    }
+
+    if (!reserve_buffer(&worker->input_buffer, &worker->input_capacity, (size_t)request->first_size + request->second_size)) {
+        return false;
+    }
+
+    if (!read_all(descriptor, worker->input_buffer, (size_t)request->first_size + request->second_size)) {
+        return false;
+    }
+
+    arguments.mode = (request->type == DAEMON_REQUEST_COMPRESS_FILE || request->type == DAEMON_REQUEST_COMPRESS_DATA) ? MODE_COMPRESS : MODE_DECOMPRESS;
+    arguments.compression_type = (enum Lzkn64CompressionType)request->compression_type;
+    arguments.pad_output = request->pad_output != 0;
+    arguments.verify = arguments.verify || request->verify != 0; // A daemon started with -v checks every request.
+
+    if (file_request) {
+        memcpy(input_path, worker->input_buffer, request->first_size);
+        input_path[request->first_size] = '\0';
+        memcpy(output_path, &worker->input_buffer[request->first_size], request->second_size);
+        output_path[request->second_size] = '\0';
+
+        successful = process_file(worker, &arguments, input_path, output_path, &input_size, &output_size, message);
+    } else if (request->type == DAEMON_REQUEST_STATUS) {
+        output_size = format_status(server, message, sizeof(message));
+        output_data = (const u8 *)message;
+        successful = true;
+    } else {
+        input_size = request->first_size;
+        successful = process_data(worker, &arguments, input_size, &output_size, message);
+        output_data = worker->output_buffer;
+    }
+
+    f64 time = get_time() - start_time;
+
+    pthread_mutex_lock(&server->mutex);
+
+    struct DaemonCounters *counters = &server->counters[request->type];
+    counters->request_count++;
+    counters->error_count += !successful;
+    counters->input_size += input_size;
+    counters->output_size += successful ? output_size : 0;
+    counters->total_time += time;
+    counters->maximum_time = time > counters->maximum_time ? time : counters->maximum_time;
+
+    pthread_mutex_unlock(&server->mutex);
+
+    struct DaemonResponse response;
+    response.successful = successful;
+
+    if (!successful) {
+        output_data = (const u8 *)message;
+        output_size = strlen(message);
+    } else if (output_data == NULL) {
+        output_size = 0;
+    }
+
+    response.size = (u32)output_size;
+
+    return write_all(descriptor, &response, sizeof(response)) && write_all(descriptor, output_data, output_size);
+}
+
+static void *daemon_worker_run(void *context) {
+    struct DaemonWorker *worker = context;
+
+    for (;;) {
+        int descriptor = accept(worker->server->socket, NULL, NULL);
+
+        if (descriptor < 0) {
+            // Running out of descriptors or memory doesn't clear up until other connections close, so wait for that
+            // instead of spinning on accept.
+            if (errno != EINTR && errno != ECONNABORTED) {
+                const struct timespec delay = { 0, DAEMON_ACCEPT_RETRY_DELAY };
+                nanosleep(&delay, NULL);
+            }
+
+            continue;
+        }
+
+        struct DaemonRequest request;
+
+        while (read_all(descriptor, &request, sizeof(request)) && handle_request(worker, descriptor, &request)) {
+        }
+
+        close(descriptor);
+    }
+
+    return NULL;
+}
+
+int daemon_run(const struct Arguments *arguments) {
+    struct sockaddr_un address;
+    int descriptor;
+
+    if (strlen(arguments->input_file) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Error: Socket path %s is too long.\n", arguments->input_file);
+        return EXIT_FAILURE;
+    }
+
+    // A socket file that nothing answers on is left over from a daemon that was killed.
+    if (connect_socket(arguments->input_file, &descriptor)) {
+        close(descriptor);
+        fprintf(stderr, "Error: A daemon is already listening on %s.\n", arguments->input_file);
+        return EXIT_FAILURE;
+    }
+
+    // Only a leftover socket is replaced, never a file that happens to be at the path.
+    struct stat path_stat;
+
+    if (lstat(arguments->input_file, &path_stat) == 0) {
+        if (!S_ISSOCK(path_stat.st_mode)) {
+            fprintf(stderr, "Error: %s exists and is not a socket.\n", arguments->input_file);
+            return EXIT_FAILURE;
+        }
+
+        unlink(arguments->input_file);
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, arguments->input_file);
+
+    struct DaemonServer server;
+    memset(&server, 0, sizeof(server));
+    server.arguments = arguments;
+    server.socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    server.worker_count = arguments->thread_count_set ? arguments->thread_count : 0;
+    server.start_time = get_time();
+
+    if (server.worker_count == 0) {
+        server.worker_count = parallel_default_thread_count();
+    }
+
+    if (server.socket < 0 || bind(server.socket, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        fprintf(stderr, "Error: Could not listen on %s.\n", arguments->input_file);
+
+        if (server.socket >= 0) {
+            close(server.socket);
+        }
+
+        return EXIT_FAILURE;
+    }
+
+    // From here on a failed start removes the socket file again, so it isn't left behind with nothing answering on it.
+    struct DaemonWorker *workers = NULL;
+    pthread_t *threads = NULL;
+
+    // Requests name files that are read and written with the daemon's permissions, so only its own user may connect.
+    if (chmod(arguments->input_file, 0600) != 0 || listen(server.socket, SOMAXCONN) != 0) {
+        fprintf(stderr, "Error: Could not listen on %s.\n", arguments->input_file);
+        goto cleanup;
+    }
+
+    // Clients going away in the middle of a response shouldn't take the daemon down with them.
+    signal(SIGPIPE, SIG_IGN);
+    pthread_mutex_init(&server.mutex, NULL);
+
+    workers = calloc(server.worker_count, sizeof(struct DaemonWorker));
+    threads = calloc(server.worker_count, sizeof(pthread_t));
+
+    if (workers == NULL || threads == NULL) {
+        fprintf(stderr, "Error: Could not allocate memory for workers.\n");
+        goto cleanup;
+    }
+
+    for (size_t i = 0; i < server.worker_count; i++) {
+        workers[i].server = &server;
+        workers[i].context = lzkn64_context_create(0, 1);
+
+        if (workers[i].context == NULL) {
+            fprintf(stderr, "Error: Could not allocate memory for workers.\n");
+            goto cleanup;
+        }
+    }
+
+    printf("Listening on %s with %zu workers.\n", arguments->input_file, server.worker_count);
+    fflush(stdout);
+
+    // Every worker takes connections straight off the socket, the calling thread being one of them.
+    for (size_t i = 1; i < server.worker_count; i++) {
+        if (pthread_create(&threads[i], NULL, daemon_worker_run, &workers[i]) != 0) {
+            fprintf(stderr, "Error: Could not start worker threads.\n");
+
+            // The workers already started still use their contexts, they go away when the process exits.
+            close(server.socket);
+            unlink(arguments->input_file);
+            return EXIT_FAILURE;
+        }
+    }
+
+    daemon_worker_run(&workers[0]);
+
+    return EXIT_SUCCESS;
+
+cleanup:
+    close(server.socket);
+    unlink(arguments->input_file);
+
+    for (size_t i = 0; workers != NULL && i < server.worker_count; i++) {
+        lzkn64_context_destroy(workers[i].context);
+    }
+
+    free(workers);
+    free(threads);
+
+    return EXIT_FAILURE;
+}
+
+// Sends a request and reads the response header, the payload is left for the caller.
+static bool send_request(int descriptor, const struct DaemonRequest *request, const void *first_data, const void *second_data, struct DaemonResponse *response) {
+    return write_all(descriptor, request, sizeof(*request)) && write_all(descriptor, first_data, request->first_size) && write_all(descriptor, second_data, request->second_size) && read_all(descriptor, response, sizeof(*response));
+}
+
+int daemon_status_run(const struct Arguments *arguments) {
+    int descriptor;
+
+    if (!connect_socket(arguments->input_file, &descriptor)) {
+        fprintf(stderr, "Error: Could not connect to a daemon on %s.\n", arguments->input_file);
+        return EXIT_FAILURE;
+    }
+
+    struct DaemonRequest request;
+    memset(&request, 0, sizeof(request));
+    request.type = DAEMON_REQUEST_STATUS;
+
+    struct DaemonResponse response;
+    char text[DAEMON_MESSAGE_SIZE];
+
+    bool successful = send_request(descriptor, &request, NULL, NULL, &response) && response.size < sizeof(text) && read_all(descriptor, text, response.size);
+    close(descriptor);
+
+    if (!successful) {
+        fprintf(stderr, "Error: Could not read the status of the daemon.\n");
+        return EXIT_FAILURE;
+    }
+
+    text[response.size] = '\0';
+    printf("%s", text);
+
+    return EXIT_SUCCESS;
+}
+
+// The daemon doesn't share the working directory of the client, so relative paths are made absolute first.
+static char *absolute_path(const char *path) {
+    char working_directory[DAEMON_MAXIMUM_PATH_LENGTH];
+
+    if (path[0] == '/') {
+        return strdup(path);
+    }
+
+    if (getcwd(working_directory, sizeof(working_directory)) == NULL) {
+        return NULL;
+    }
+
+    char *joined_path = malloc(strlen(working_directory) + strlen(path) + 2);
+
+    if (joined_path != NULL) {
+        sprintf(joined_path, "%s/%s", working_directory, path);
+    }
+
+    return joined_path;
+}
+
+bool daemon_client_run(const struct Arguments *arguments, int *exit_code) {
+    int descriptor;
+
+    if (!connect_socket(arguments->daemon_socket, &descriptor)) {
+        return false;
+    }
+
+    bool compress = arguments->mode == MODE_COMPRESS;
+    bool streamed = strcmp(arguments->input_file, "-") == 0 || strcmp(arguments->output_file, "-") == 0;
+
+    struct DaemonRequest request;
+    request.compression_type = arguments->compression_type;
+    request.pad_output = arguments->pad_output;
+    request.verify = arguments->verify;
+
+    struct DaemonResponse response;
+    struct MappedFile input_file;
+    bool sent = false;
+
+    *exit_code = EXIT_FAILURE;
+
+    if (streamed) {
+        // Pipes can't be opened by the daemon, so the data goes over the socket.
+        if (!mapped_file_open(&input_file, arguments->input_file, false)) {
+            fprintf(stderr, "Error: Could not read input file.\n");
+            close(descriptor);
+            return true;
+        }
+
+        request.type = compress ? DAEMON_REQUEST_COMPRESS_DATA : DAEMON_REQUEST_DECOMPRESS_DATA;
+        request.first_size = (u32)input_file.size;
+        request.second_size = 0;
+
+        sent = input_file.size <= LZKN64_MAXIMUM_FILE_SIZE && send_request(descriptor, &request, input_file.data, NULL, &response);
+        mapped_file_close(&input_file);
+    } else {
+        char *input_path = absolute_path(arguments->input_file);
+        char *output_path = absolute_path(arguments->output_file);
+
+        request.type = compress ? DAEMON_REQUEST_COMPRESS_FILE : DAEMON_REQUEST_DECOMPRESS_FILE;
+
+        if (input_path != NULL && output_path != NULL && strlen(input_path) <= DAEMON_MAXIMUM_PATH_LENGTH && strlen(output_path) <= DAEMON_MAXIMUM_PATH_LENGTH) {
+            request.first_size = (u32)strlen(input_path);
+            request.second_size = (u32)strlen(output_path);
+
+            sent = send_request(descriptor, &request, input_path, output_path, &response);
+        }
+
+        free(input_path);
+        free(output_path);
+    }
+
+    if (!sent) {
+        fprintf(stderr, "Error: Could not send the request to the daemon.\n");
+        close(descriptor);
+        return true;
+    }
+
+    u8 *payload = malloc(response.size > 0 ? response.size : 1);
+
+    if (payload == NULL || !read_all(descriptor, payload, response.size)) {
+        fprintf(stderr, "Error: Could not read the response of the daemon.\n");
+    } else if (!response.successful) {
+        fprintf(stderr, "Error: %.*s\n", (int)response.size, (const char *)payload);
+    } else if (streamed) {
+        struct MappedFile output_file;
+
+        if (!mapped_file_create(&output_file, arguments->output_file, response.size)) {
+            fprintf(stderr, "Error: Could not open output file.\n");
+        } else {
+            memcpy(output_file.data, payload, response.size);
+            output_file.size = response.size;
+
+            if (!mapped_file_close(&output_file)) {
+                fprintf(stderr, "Error: Could not write output file.\n");
+            } else {
+                *exit_code = EXIT_SUCCESS;
+            }
+        }
+    } else {
+        *exit_code = EXIT_SUCCESS;
+    }
+
+    free(payload);
+    close(descriptor);
+
+    return true;
+}
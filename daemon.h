@@ -0,0 +1,19 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include "main.h"
+
+// Serves compression and decompression requests on the Unix domain socket arguments->input_file until killed.
+// Every worker thread keeps its own compression context and buffers warm between requests, and takes connections off
+// the socket as soon as it is free. arguments->thread_count_set picks the number of workers, all cores by default.
+int daemon_run(const struct Arguments *arguments);
+
+// Prints the counters of the daemon listening on arguments->input_file.
+int daemon_status_run(const struct Arguments *arguments);
+
+// Sends a -c or -d of a single file to the daemon listening on arguments->daemon_socket instead of doing it here.
+// Files are passed by path and read and written by the daemon, - sends the data along instead. Returns false without
+// doing anything if no daemon could be reached, exit_code is set otherwise.
+bool daemon_client_run(const struct Arguments *arguments, int *exit_code);
+
+#endif // DAEMON_H
@@ -1,430 +1,811 @@
 #include "lzkn64.h"
+#include "match_length.h"
+#include "parallel.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define HASH_CHAIN_BITS 12
+#define HASH_CHAIN_SIZE (1 << HASH_CHAIN_BITS)
+#define HASH_CHAIN_WINDOW_SIZE 0x400
+#define HASH_CHAIN_WINDOW_MASK (HASH_CHAIN_WINDOW_SIZE - 1)
+#define HASH_CHAIN_MINIMUM_LENGTH 3
+#define HASH_CHAIN_NONE 0xFFFFFFFF
+
+#if defined(_MSC_VER)
+#define ALWAYS_INLINE __forceinline
+#else
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#endif
+
+// Instrumentation counters only exist when building with LZKN64_STATS, otherwise they compile to nothing.
+#if defined(LZKN64_STATS)
+#define STATS_ADD(counter, value) ((counter) += (value))
+
+#if defined(_MSC_VER)
+static __declspec(thread) size_t stats_probe_count;
+#else
+static _Thread_local size_t stats_probe_count; // Match candidates compared by compressions started on this thread.
+#endif
+#else
+#define STATS_ADD(counter, value) ((void)0)
+#endif
+
+// Indexes every input position by the hash of its first 3 bytes, so that the sliding window search only has to visit
+// positions which can actually produce a usable match instead of every offset in the window.
+struct HashChain {
+    u32 head[HASH_CHAIN_SIZE];
+    u32 previous[HASH_CHAIN_WINDOW_SIZE];
+    size_t inserted_offset;
+    MatchLengthFunction match_length;
+#if defined(LZKN64_STATS)
+    size_t probe_count;
+#endif
+};
+
+static void hash_chain_init(struct HashChain *hash_chain) {
+    memset(hash_chain->head, 0xFF, sizeof(hash_chain->head));
+    hash_chain->inserted_offset = 0;
+    hash_chain->match_length = match_length_select();
+#if defined(LZKN64_STATS)
+    hash_chain->probe_count = 0;
+#endif
+}
 
-size_t lzkn64_compress_efficient(const u8 *input_buffer, u8 *output_buffer, size_t input_size) {
-    size_t input_offset = 0;
-    size_t output_offset = 4; // Skip the first 4 bytes since they are the compressed file size.
+static u32 hash_chain_hash(const u8 *data) {
+    u32 value = ((u32)data[0] << 16) | ((u32)data[1] << 8) | (u32)data[2];
 
-    size_t input_last_processed_data_offset = 0;
+    return (value * 2654435761u) >> (32 - HASH_CHAIN_BITS);
+}
 
-    while (input_offset < input_size) {
-        size_t sliding_window_copy_maximum_length = 0;
+// Inserts every position before input_offset that hasn't been yet, as long as it has enough bytes left to be hashed.
+static void hash_chain_insert(struct HashChain *hash_chain, const u8 *input_buffer, size_t input_size, size_t input_offset) {
+    while (hash_chain->inserted_offset < input_offset && (hash_chain->inserted_offset + HASH_CHAIN_MINIMUM_LENGTH) <= input_size) {
+        size_t offset = hash_chain->inserted_offset++;
+        u32 hash = hash_chain_hash(&input_buffer[offset]);
 
-        // Find the maximum length of the sliding window copy, e.g. how many bytes can be copied without going out of bounds.
-        if ((input_size - input_offset) >= SLIDING_WINDOW_COPY_MAXIMUM_LENGTH) {
-            sliding_window_copy_maximum_length = SLIDING_WINDOW_COPY_MAXIMUM_LENGTH;
-        } else {
-            sliding_window_copy_maximum_length = input_size - input_offset;
+        hash_chain->previous[offset & HASH_CHAIN_WINDOW_MASK] = hash_chain->head[hash];
+        hash_chain->head[hash] = (u32)offset;
+    }
+}
+
+// Finds the longest match of at least HASH_CHAIN_MINIMUM_LENGTH bytes in the sliding window.
+// The chain is walked from the most recent position backwards, so among matches of equal length the smallest offset is
+// kept, which is the same result the brute-force search over every offset produces.
+static void hash_chain_find_match(struct HashChain *hash_chain, const u8 *input_buffer, size_t input_size, size_t input_offset, size_t maximum_offset, size_t maximum_length, size_t *match_offset, size_t *match_length) {
+    // Insert every position we skipped over since the last search.
+    hash_chain_insert(hash_chain, input_buffer, input_size, input_offset);
+
+    *match_offset = 0;
+    *match_length = 0;
+
+    if (maximum_length < HASH_CHAIN_MINIMUM_LENGTH) {
+        return;
+    }
+
+    u32 candidate = hash_chain->head[hash_chain_hash(&input_buffer[input_offset])];
+
+    while (candidate != HASH_CHAIN_NONE && candidate < input_offset) {
+        size_t offset = input_offset - candidate;
+
+        if (offset > maximum_offset) {
+            break;
         }
 
-        size_t sliding_window_maximum_offset = 0;
+        size_t length = hash_chain->match_length(&input_buffer[candidate], &input_buffer[input_offset], maximum_length);
+        STATS_ADD(hash_chain->probe_count, 1);
 
-        // Find the maximum offset of the sliding window copy, e.g. how far back can we go to copy bytes.
-        if (input_offset >= SLIDING_WINDOW_SIZE_EFFICIENT) {
-            sliding_window_maximum_offset = SLIDING_WINDOW_SIZE_EFFICIENT;
-        } else {
-            sliding_window_maximum_offset = input_offset;
+        if (length >= HASH_CHAIN_MINIMUM_LENGTH && length > *match_length) {
+            *match_offset = offset;
+            *match_length = length;
+
+            if (length == maximum_length) {
+                break;
+            }
         }
 
-        size_t rle_window_maximum_length = 0;
+        u32 next_candidate = hash_chain->previous[candidate & HASH_CHAIN_WINDOW_MASK];
 
-        // Find the maximum length of the RLE window, e.g. how many bytes can be matched without going out of bounds.
-        if ((input_size - input_offset) >= RLE_LONG_MAXIMUM_LENGTH) {
-            rle_window_maximum_length = RLE_LONG_MAXIMUM_LENGTH;
-        } else {
-            rle_window_maximum_length = input_size - input_offset;
+        // Positions only ever link to older positions, anything else is a slot that has been reused.
+        if (next_candidate >= candidate) {
+            break;
         }
 
+        candidate = next_candidate;
+    }
+}
+
+#define MATCH_TABLE_CHUNK_SIZE 0x10000
+
+// The sliding window and RLE searches only depend on the input bytes, so they can be done up front for every position.
+struct MatchTableEntry {
+    u16 sliding_window_match_offset;
+    u8 sliding_window_match_length;
+    u16 rle_run_length; // Length of the run of equal bytes, capped at RLE_LONG_MAXIMUM_LENGTH.
+};
+
+struct MatchTableJob {
+    const u8 *input_buffer;
+    size_t input_size;
+    size_t sliding_window_size;
+    struct MatchTableEntry *match_table;
+#if defined(LZKN64_STATS)
+    size_t probe_count;
+#endif
+};
+
+static void match_table_fill_chunk(void *context, size_t task_index, size_t thread_index) {
+    struct MatchTableJob *job = context;
+    const u8 *input_buffer = job->input_buffer;
+    size_t input_size = job->input_size;
+
+    (void)thread_index;
+
+    size_t chunk_start = task_index * MATCH_TABLE_CHUNK_SIZE;
+    size_t chunk_end = chunk_start + MATCH_TABLE_CHUNK_SIZE;
+
+    if (chunk_end > input_size) {
+        chunk_end = input_size;
+    }
+
+    struct HashChain hash_chain;
+    hash_chain_init(&hash_chain);
+
+    // Start indexing a full window before the chunk so the first positions see the same candidates as a serial search.
+    if (chunk_start > job->sliding_window_size) {
+        hash_chain.inserted_offset = chunk_start - job->sliding_window_size;
+    }
+
+    for (size_t input_offset = chunk_start; input_offset < chunk_end; input_offset++) {
+        struct MatchTableEntry *entry = &job->match_table[input_offset];
+        size_t remaining_size = input_size - input_offset;
+
+        size_t sliding_window_copy_maximum_length = remaining_size < SLIDING_WINDOW_COPY_MAXIMUM_LENGTH ? remaining_size : SLIDING_WINDOW_COPY_MAXIMUM_LENGTH;
+        size_t sliding_window_maximum_offset = input_offset < job->sliding_window_size ? input_offset : job->sliding_window_size;
         size_t sliding_window_match_offset = 0;
         size_t sliding_window_match_length = 0;
 
-        // Find the longest match in the sliding window.
-        for (size_t i = 1; i <= sliding_window_maximum_offset; i++) {
-            size_t match_length = 0;
+        hash_chain_find_match(&hash_chain, input_buffer, input_size, input_offset, sliding_window_maximum_offset, sliding_window_copy_maximum_length, &sliding_window_match_offset, &sliding_window_match_length);
 
-            for (size_t j = 0; j < sliding_window_copy_maximum_length; j++) {
-                if (input_buffer[input_offset - i + j] == input_buffer[input_offset + j]) {
-                    match_length++;
-                } else {
-                    break;
-                }
-            }
+        entry->sliding_window_match_offset = (u16)sliding_window_match_offset;
+        entry->sliding_window_match_length = (u8)sliding_window_match_length;
 
-            if (match_length > sliding_window_match_length) {
-                sliding_window_match_offset = i;
-                sliding_window_match_length = match_length;
-            }
+        size_t rle_window_maximum_length = remaining_size < RLE_LONG_MAXIMUM_LENGTH ? remaining_size : RLE_LONG_MAXIMUM_LENGTH;
+        size_t rle_run_length = 1;
+
+        while (rle_run_length < rle_window_maximum_length && input_buffer[input_offset + rle_run_length] == input_buffer[input_offset]) {
+            rle_run_length++;
         }
 
-        size_t rle_match_value = 0;
-        size_t rle_match_length = 0;
+        entry->rle_run_length = (u16)rle_run_length;
+    }
 
-        // Find the longest match in the RLE window.
-        {
-            size_t match_value = input_buffer[input_offset];
-            size_t match_length = 0;
+#if defined(LZKN64_STATS)
+    __atomic_fetch_add(&job->probe_count, hash_chain.probe_count, __ATOMIC_RELAXED);
+#endif
+}
 
-            if (match_value != 0x00 && rle_window_maximum_length > RLE_SHORT_MAXIMUM_LENGTH) {
-                // We are matching a non-zero value, so the maximum length we are able to match is the maximum copy length.
-                rle_window_maximum_length = RLE_SHORT_MAXIMUM_LENGTH;
-            }
+// Fills in the match table for the whole input across thread_count threads, or the threads of pool if it isn't NULL.
+static void match_table_fill(struct MatchTableEntry *match_table, const u8 *input_buffer, size_t input_size, size_t sliding_window_size, size_t thread_count, struct ParallelPool *pool) {
+    struct MatchTableJob job;
+    job.input_buffer = input_buffer;
+    job.input_size = input_size;
+    job.sliding_window_size = sliding_window_size;
+    job.match_table = match_table;
+#if defined(LZKN64_STATS)
+    job.probe_count = 0;
+#endif
+
+    size_t chunk_count = (input_size + MATCH_TABLE_CHUNK_SIZE - 1) / MATCH_TABLE_CHUNK_SIZE;
+
+    if (pool != NULL) {
+        parallel_pool_run(pool, chunk_count, match_table_fill_chunk, &job);
+    } else {
+        parallel_for(chunk_count, thread_count, match_table_fill_chunk, &job);
+    }
 
-            for (size_t i = 0; i < rle_window_maximum_length; i++) {
-                if (input_buffer[input_offset + i] == match_value) {
-                    match_length++;
-                } else {
-                    break;
-                }
-            }
+    // The chunks ran on other threads, the probes count towards the thread that asked for the table.
+    STATS_ADD(stats_probe_count, job.probe_count);
+}
 
-            if (match_length > rle_match_length) {
-                rle_match_value = match_value;
-                rle_match_length = match_length;
-            }
+// Builds the match table for the whole input across thread_count threads, returns NULL if it couldn't be allocated.
+static struct MatchTableEntry *match_table_create(const u8 *input_buffer, size_t input_size, size_t sliding_window_size, size_t thread_count) {
+    struct MatchTableEntry *match_table = malloc(input_size * sizeof(struct MatchTableEntry));
+
+    if (match_table == NULL) {
+        return NULL;
+    }
+
+    match_table_fill(match_table, input_buffer, input_size, sliding_window_size, thread_count, NULL);
+
+    return match_table;
+}
+
+// Everything that sets one compression algorithm apart from the others. The engine below is inlined into every
+// algorithm with its policy as a constant, so the checks on these fields fold away instead of running for every byte.
+struct CompressPolicy {
+    size_t sliding_window_size;
+    size_t sliding_window_minimum_length; // Shortest match a sliding window copy is used for.
+    bool sliding_window_longer_than_rle; // Only use a sliding window copy if it is longer than the RLE run.
+    bool rle_block_clamp; // Stop RLE runs RLE_SHORT_MAXIMUM_LENGTH bytes into every 0x400 byte block of the input.
+    size_t rle_any_value_maximum_length;
+    size_t rle_short_zero_maximum_length; // Longer zero runs use the long zero RLE command.
+};
+
+// Very slightly more efficient, doesn't match the games.
+// The short zero RLE command can't use the top length value, since 0xFF is the long zero RLE command, so zero runs of
+// exactly RLE_SHORT_MAXIMUM_LENGTH bytes are written as long zero RLE commands.
+static const struct CompressPolicy compress_policy_efficient = {
+    SLIDING_WINDOW_SIZE_EFFICIENT,
+    3,
+    false,
+    false,
+    RLE_SHORT_MAXIMUM_LENGTH,
+    RLE_SHORT_MAXIMUM_LENGTH - 1,
+};
+
+// Matches the games exactly. For some reason, runs of any value other than zero are one byte shorter than they could be,
+// and sliding window copies need to be 4 bytes long.
+static const struct CompressPolicy compress_policy_accurate = {
+    SLIDING_WINDOW_SIZE_ACCURATE,
+    4,
+    true,
+    true,
+    RLE_SHORT_MAXIMUM_LENGTH - 1,
+    RLE_SHORT_MAXIMUM_LENGTH - 1,
+};
+
+// Position and output of a compression, shared by the one-shot functions and the streams.
+struct CompressState {
+    const u8 *input_buffer;
+    size_t input_start; // Offset of the first byte of input_buffer in the whole input, only non-zero for streams.
+    size_t input_offset;
+    size_t input_last_processed_data_offset;
+    size_t rle_run_end; // End of the run of equal bytes around input_offset, if past it. Only grows within a run.
+    u8 *output_buffer;
+    size_t output_offset;
+};
+
+// Most a single compress_step can write: two raw copies of the data left at the end of the input, and one command.
+#define COMPRESS_STEP_MAXIMUM_OUTPUT_SIZE (2 * (1 + RAW_COPY_MAXIMUM_LENGTH) + 2)
+
+// Picks and writes the command for the current position. input_size is how much of input_buffer can be looked at, a
+// position is only decided the same way as with the whole input known if RLE_LONG_MAXIMUM_LENGTH bytes are available
+// or input_size is the end of the input. With a match table the searches are looked up instead of done here.
+static ALWAYS_INLINE void compress_step(const struct CompressPolicy policy, struct CompressState *state, size_t input_size, struct HashChain *hash_chain, const struct MatchTableEntry *match_table) {
+    const u8 *input_buffer = state->input_buffer;
+    u8 *output_buffer = state->output_buffer;
+    size_t input_offset = state->input_offset;
+    size_t output_offset = state->output_offset;
+    size_t input_last_processed_data_offset = state->input_last_processed_data_offset;
+    size_t absolute_input_offset = state->input_start + input_offset;
+    size_t remaining_size = input_size - input_offset;
+
+    // Find the maximum length of the sliding window copy, e.g. how many bytes can be copied without going out of bounds.
+    size_t sliding_window_copy_maximum_length = remaining_size < SLIDING_WINDOW_COPY_MAXIMUM_LENGTH ? remaining_size : SLIDING_WINDOW_COPY_MAXIMUM_LENGTH;
+
+    // Find the maximum offset of the sliding window copy, e.g. how far back can we go to copy bytes.
+    size_t sliding_window_maximum_offset = absolute_input_offset < policy.sliding_window_size ? absolute_input_offset : policy.sliding_window_size;
+
+    // Find the maximum length of the RLE window, e.g. how many bytes can be matched without going out of bounds.
+    size_t rle_window_maximum_length = remaining_size < RLE_LONG_MAXIMUM_LENGTH ? remaining_size : RLE_LONG_MAXIMUM_LENGTH;
+
+    if (policy.rle_block_clamp && rle_window_maximum_length > RLE_SHORT_MAXIMUM_LENGTH) {
+        // The first length past RLE_SHORT_MAXIMUM_LENGTH that ends RLE_SHORT_MAXIMUM_LENGTH bytes into a 0x400 byte block.
+        size_t block_length = (RLE_SHORT_MAXIMUM_LENGTH - absolute_input_offset) & 0x3FF;
+
+        if (block_length <= RLE_SHORT_MAXIMUM_LENGTH) {
+            block_length += 0x400;
         }
 
-        u8 command = COMMAND_UNDEFINED;
+        if (block_length < rle_window_maximum_length) {
+            rle_window_maximum_length = block_length;
+        }
+    }
 
-        // Try to pick a command that works best with the values calculated above.
-        if (sliding_window_match_length >= 3) {
-            command = COMMAND_SLIDING_WINDOW_COPY; // Takes up 2 bytes.
-        } else if (rle_match_length >= 3) {
-            if (rle_match_value == 0x00) {
-                if (rle_match_length <= RLE_SHORT_MAXIMUM_LENGTH) {
-                    command = COMMAND_RLE_WRITE_SHORT_ZERO; // Takes up 1 byte.
-                } else if (rle_match_length <= RLE_LONG_MAXIMUM_LENGTH) {
-                    command = COMMAND_RLE_WRITE_LONG_ZERO; // Takes up 2 bytes.
-                }
-            } else {
-                if (rle_match_length <= RLE_SHORT_MAXIMUM_LENGTH) {
-                    command = COMMAND_RLE_WRITE_SHORT_ANY_VALUE; // Takes up 2 bytes.
-                }
-            }
-        } else if (rle_match_length == 2) {
-            if (rle_match_value == 0x00) {
-                command = COMMAND_RLE_WRITE_SHORT_ZERO; // Takes up 1 byte.
-            }
+    u8 rle_match_value = input_buffer[input_offset];
+    size_t rle_match_length = 0;
+
+    // Find the longest match in the RLE window.
+    if (rle_match_value != 0x00 && rle_window_maximum_length > policy.rle_any_value_maximum_length) {
+        rle_window_maximum_length = policy.rle_any_value_maximum_length;
+    }
+
+    if (match_table != NULL) {
+        rle_match_length = match_table[input_offset].rle_run_length;
+
+        if (rle_match_length > rle_window_maximum_length) {
+            rle_match_length = rle_window_maximum_length;
+        }
+    } else {
+        size_t rle_run_end = state->rle_run_end;
+
+        // Every position of a run shares its end, so each byte is only compared once instead of once per position. The
+        // end is extended from where it was left, since a stream can have more input now than when it was found.
+        if (rle_run_end <= input_offset) {
+            rle_run_end = input_offset + 1;
+        }
+
+        while (rle_run_end < input_size && input_buffer[rle_run_end] == rle_match_value) {
+            rle_run_end++;
+        }
+
+        state->rle_run_end = rle_run_end;
+        rle_match_length = rle_run_end - input_offset;
+
+        if (rle_match_length > rle_window_maximum_length) {
+            rle_match_length = rle_window_maximum_length;
         }
+    }
+
+    size_t sliding_window_match_offset = 0;
+    size_t sliding_window_match_length = 0;
+
+    // Find the longest match in the sliding window. Inside a run, the search is skipped when its result is known already:
+    // either RLE wins over any sliding window copy, or the copy from 1 byte back is the first candidate the chain visits
+    // and already has the maximum length.
+    if (match_table != NULL) {
+        sliding_window_match_offset = match_table[input_offset].sliding_window_match_offset;
+        sliding_window_match_length = match_table[input_offset].sliding_window_match_length;
+    } else if (policy.sliding_window_longer_than_rle && rle_match_length >= sliding_window_copy_maximum_length) {
+        hash_chain_insert(hash_chain, input_buffer, input_size, input_offset);
+    } else if (!policy.sliding_window_longer_than_rle && input_offset > 0 && input_buffer[input_offset - 1] == rle_match_value && (state->rle_run_end - input_offset) >= SLIDING_WINDOW_COPY_MAXIMUM_LENGTH) {
+        hash_chain_insert(hash_chain, input_buffer, input_size, input_offset);
+        sliding_window_match_offset = 1;
+        sliding_window_match_length = SLIDING_WINDOW_COPY_MAXIMUM_LENGTH;
+    } else {
+        hash_chain_find_match(hash_chain, input_buffer, input_size, input_offset, sliding_window_maximum_offset, sliding_window_copy_maximum_length, &sliding_window_match_offset, &sliding_window_match_length);
+    }
 
-        size_t raw_copy_length = input_offset - input_last_processed_data_offset;
+    u8 command = COMMAND_UNDEFINED;
 
-        // Force a raw copy command under the following conditions:
-        // 1. A command has been picked and there is raw data to copy. (This happens when a command couldn't be found for the data.)
-        // 2. The raw data length is at the maximum length or greater.
-        // 3. The input offset is at the end of the input buffer.
-        if ((command != COMMAND_UNDEFINED && raw_copy_length > 0) || raw_copy_length >= RAW_COPY_MAXIMUM_LENGTH || (input_offset + 1) >= input_size) {
-            if ((input_offset + 1) >= input_size) {
-                raw_copy_length = input_size - input_last_processed_data_offset;
+    // Try to pick a command that works best with the values calculated above.
+    if (sliding_window_match_length >= policy.sliding_window_minimum_length && (!policy.sliding_window_longer_than_rle || sliding_window_match_length > rle_match_length)) {
+        command = COMMAND_SLIDING_WINDOW_COPY; // Takes up 2 bytes.
+    } else if (rle_match_length >= 3) {
+        if (rle_match_value == 0x00) {
+            if (rle_match_length <= policy.rle_short_zero_maximum_length) {
+                command = COMMAND_RLE_WRITE_SHORT_ZERO; // Takes up 1 byte.
+            } else if (rle_match_length <= RLE_LONG_MAXIMUM_LENGTH) {
+                command = COMMAND_RLE_WRITE_LONG_ZERO; // Takes up 2 bytes.
+            }
+        } else {
+            if (rle_match_length <= RLE_SHORT_MAXIMUM_LENGTH) {
+                command = COMMAND_RLE_WRITE_SHORT_ANY_VALUE; // Takes up 2 bytes.
             }
+        }
+    } else if (rle_match_length == 2) {
+        if (rle_match_value == 0x00) {
+            command = COMMAND_RLE_WRITE_SHORT_ZERO; // Takes up 1 byte.
+        }
+    }
 
-            while (raw_copy_length > 0) {
-                size_t length = 0;
+    size_t raw_copy_length = input_offset - input_last_processed_data_offset;
 
-                if (raw_copy_length > RAW_COPY_MAXIMUM_LENGTH) {
-                    length = RAW_COPY_MAXIMUM_LENGTH;
-                } else {
-                    length = raw_copy_length;
-                }
+    // Force a raw copy command under the following conditions:
+    // 1. A command has been picked and there is raw data to copy. (This happens when a command couldn't be found for the data.)
+    // 2. The raw data length is at the maximum length or greater.
+    // 3. The input offset is at the end of the input buffer.
+    if ((command != COMMAND_UNDEFINED && raw_copy_length > 0) || raw_copy_length >= RAW_COPY_MAXIMUM_LENGTH || (input_offset + 1) >= input_size) {
+        if ((input_offset + 1) >= input_size) {
+            raw_copy_length = input_size - input_last_processed_data_offset;
+        }
 
-                output_buffer[output_offset++] = COMMAND_RAW_COPY | (length & COMMAND_RAW_COPY_LENGTH_MASK);
+        while (raw_copy_length > 0) {
+            size_t length = raw_copy_length > RAW_COPY_MAXIMUM_LENGTH ? RAW_COPY_MAXIMUM_LENGTH : raw_copy_length;
 
-                for (size_t i = 0; i < length; i++) {
-                    output_buffer[output_offset++] = input_buffer[input_last_processed_data_offset++];
-                }
+            output_buffer[output_offset++] = COMMAND_RAW_COPY | (length & COMMAND_RAW_COPY_LENGTH_MASK);
 
-                raw_copy_length -= length;
-            }
+            memcpy(&output_buffer[output_offset], &input_buffer[input_last_processed_data_offset], length);
+            output_offset += length;
+            input_last_processed_data_offset += length;
+
+            raw_copy_length -= length;
         }
+    }
 
-        if (command == COMMAND_SLIDING_WINDOW_COPY) {
-            output_buffer[output_offset++] = COMMAND_SLIDING_WINDOW_COPY | (((sliding_window_match_length - 2) << 2) & COMMAND_SLIDING_WINDOW_COPY_LENGTH_MASK) | ((sliding_window_match_offset >> 8) & COMMAND_SLIDING_WINDOW_COPY_OFFSET_FIRST_BYTE_MASK);
-            output_buffer[output_offset++] = sliding_window_match_offset & COMMAND_SLIDING_WINDOW_COPY_OFFSET_SECOND_BYTE_MASK;
+    if (command == COMMAND_SLIDING_WINDOW_COPY) {
+        output_buffer[output_offset++] = COMMAND_SLIDING_WINDOW_COPY | (((sliding_window_match_length - 2) << 2) & COMMAND_SLIDING_WINDOW_COPY_LENGTH_MASK) | ((sliding_window_match_offset >> 8) & COMMAND_SLIDING_WINDOW_COPY_OFFSET_FIRST_BYTE_MASK);
+        output_buffer[output_offset++] = sliding_window_match_offset & COMMAND_SLIDING_WINDOW_COPY_OFFSET_SECOND_BYTE_MASK;
+
+        input_offset += sliding_window_match_length;
+        input_last_processed_data_offset = input_offset;
+    } else if (command == COMMAND_RLE_WRITE_SHORT_ANY_VALUE) {
+        // The run lengths are already capped to what a single command can hold.
+        output_buffer[output_offset++] = COMMAND_RLE_WRITE_SHORT_ANY_VALUE | ((rle_match_length - 2) & COMMAND_RLE_WRITE_SHORT_ANY_VALUE_LENGTH_MASK);
+        output_buffer[output_offset++] = rle_match_value;
+
+        input_offset += rle_match_length;
+        input_last_processed_data_offset = input_offset;
+    } else if (command == COMMAND_RLE_WRITE_SHORT_ZERO) {
+        output_buffer[output_offset++] = COMMAND_RLE_WRITE_SHORT_ZERO | ((rle_match_length - 2) & COMMAND_RLE_WRITE_SHORT_ZERO_LENGTH_MASK);
+
+        input_offset += rle_match_length;
+        input_last_processed_data_offset = input_offset;
+    } else if (command == COMMAND_RLE_WRITE_LONG_ZERO) {
+        output_buffer[output_offset++] = COMMAND_RLE_WRITE_LONG_ZERO;
+        output_buffer[output_offset++] = (rle_match_length - 2) & COMMAND_RLE_WRITE_LONG_ZERO_LENGTH_MASK;
+
+        input_offset += rle_match_length;
+        input_last_processed_data_offset = input_offset;
+    } else {
+        input_offset++;
+    }
 
-            input_offset += sliding_window_match_length;
-            input_last_processed_data_offset = input_offset;
-        } else if (command == COMMAND_RLE_WRITE_SHORT_ANY_VALUE) {
-            while (rle_match_length > 0) {
-                size_t length = 0;
+    state->input_offset = input_offset;
+    state->input_last_processed_data_offset = input_last_processed_data_offset;
+    state->output_offset = output_offset;
+}
 
-                if (rle_match_length > RLE_SHORT_MAXIMUM_LENGTH) {
-                    length = RLE_SHORT_MAXIMUM_LENGTH;
-                } else {
-                    length = rle_match_length;
-                }
+// Checks a compression while it runs. The input doubles as the window the commands copy from, since every byte before
+// input_offset already decoded to itself.
+struct CompressVerifier {
+    size_t input_offset;
+    size_t output_offset; // Start of the first command not checked yet.
+    bool failed;
+    struct Lzkn64Mismatch mismatch;
+};
+
+static void compress_verifier_init(struct CompressVerifier *verifier) {
+    verifier->input_offset = 0;
+    verifier->output_offset = 4; // Skip the first 4 bytes since they are the compressed file size.
+    verifier->failed = false;
+}
 
-                output_buffer[output_offset++] = COMMAND_RLE_WRITE_SHORT_ANY_VALUE | ((length - 2) & COMMAND_RLE_WRITE_SHORT_ANY_VALUE_LENGTH_MASK);
-                output_buffer[output_offset++] = rle_match_value;
+static void compress_verifier_fail(struct CompressVerifier *verifier, size_t input_offset, const u8 *output_buffer, size_t output_size) {
+    verifier->failed = true;
+    verifier->mismatch.input_offset = input_offset;
+    verifier->mismatch.output_offset = verifier->output_offset;
+    verifier->mismatch.command = verifier->output_offset < output_size ? output_buffer[verifier->output_offset] : 0x00;
+}
 
-                rle_match_length -= length;
-                input_offset += length;
-            }
+// Decodes every complete command written since the last call and compares what it produces with the input, a command
+// missing some of its bytes is left for the next call. Returns false at the first byte that doesn't match.
+static bool compress_verify(struct CompressVerifier *verifier, const u8 *input_buffer, size_t input_size, const u8 *output_buffer, size_t output_size) {
+    while (!verifier->failed && verifier->output_offset < output_size) {
+        size_t output_offset = verifier->output_offset;
+        size_t input_offset = verifier->input_offset;
+        u8 command = output_buffer[output_offset];
+        size_t command_size = 2;
+        size_t length = 0;
+
+        if (command <= COMMAND_SLIDING_WINDOW_COPY_END) {
+            length = ((command & COMMAND_SLIDING_WINDOW_COPY_LENGTH_MASK) >> 2) + 2;
+        } else if (command <= COMMAND_RAW_COPY_END) {
+            length = command & COMMAND_RAW_COPY_LENGTH_MASK;
+            command_size = 1 + length;
+        } else if (command < COMMAND_RLE_WRITE_SHORT_ANY_VALUE_START) {
+            compress_verifier_fail(verifier, input_offset, output_buffer, output_size);
+            break;
+        } else if (command <= COMMAND_RLE_WRITE_SHORT_ANY_VALUE_END) {
+            length = (command & COMMAND_RLE_WRITE_SHORT_ANY_VALUE_LENGTH_MASK) + 2;
+        } else if (command != COMMAND_RLE_WRITE_LONG_ZERO) {
+            length = (command & COMMAND_RLE_WRITE_SHORT_ZERO_LENGTH_MASK) + 2;
+            command_size = 1;
+        }
 
-            input_last_processed_data_offset = input_offset;
-        } else if (command == COMMAND_RLE_WRITE_SHORT_ZERO) {
-            while (rle_match_length > 0) {
-                size_t length = 0;
+        if (command_size > output_size - output_offset) {
+            break;
+        }
 
-                if (rle_match_length > RLE_SHORT_MAXIMUM_LENGTH) {
-                    length = RLE_SHORT_MAXIMUM_LENGTH;
-                } else {
-                    length = rle_match_length;
-                }
+        if (command == COMMAND_RLE_WRITE_LONG_ZERO) {
+            length = (output_buffer[output_offset + 1] & COMMAND_RLE_WRITE_LONG_ZERO_LENGTH_MASK) + 2;
+        }
 
-                output_buffer[output_offset++] = COMMAND_RLE_WRITE_SHORT_ZERO | ((length - 2) & COMMAND_RLE_WRITE_SHORT_ZERO_LENGTH_MASK);
+        // Only the part of the command that is still within the input can match.
+        size_t compared_length = length < (input_size - input_offset) ? length : (input_size - input_offset);
+        const u8 *expected = &input_buffer[input_offset];
+        size_t matched_length = 0;
 
-                rle_match_length -= length;
-                input_offset += length;
+        if (command <= COMMAND_SLIDING_WINDOW_COPY_END) {
+            size_t offset = (((command & COMMAND_SLIDING_WINDOW_COPY_OFFSET_FIRST_BYTE_MASK) << 8) | output_buffer[output_offset + 1]) & COMMAND_SLIDING_WINDOW_COPY_OFFSET_MAX_MASK;
+
+            if (offset == 0 || offset > input_offset) {
+                compress_verifier_fail(verifier, input_offset, output_buffer, output_size);
+                break;
             }
 
-            input_last_processed_data_offset = input_offset;
-        } else if (command == COMMAND_RLE_WRITE_LONG_ZERO) {
-            while (rle_match_length > 0) {
-                size_t length = 0;
+            const u8 *source = &input_buffer[input_offset - offset];
 
-                if (rle_match_length > RLE_LONG_MAXIMUM_LENGTH) {
-                    length = RLE_LONG_MAXIMUM_LENGTH;
-                } else {
-                    length = rle_match_length;
-                }
+            // Overlapping copies read what they have just written, which the decompressor does byte by byte. Anything
+            // else is compared in one go, only a mismatch is looked for byte by byte.
+            if (offset >= compared_length && memcmp(expected, source, compared_length) == 0) {
+                matched_length = compared_length;
+            }
 
-                output_buffer[output_offset++] = COMMAND_RLE_WRITE_LONG_ZERO;
-                output_buffer[output_offset++] = (length - 2) & COMMAND_RLE_WRITE_LONG_ZERO_LENGTH_MASK;
+            while (matched_length < compared_length && expected[matched_length] == source[matched_length]) {
+                matched_length++;
+            }
+        } else if (command <= COMMAND_RAW_COPY_END) {
+            const u8 *data = &output_buffer[output_offset + 1];
 
-                rle_match_length -= length;
-                input_offset += length;
+            if (memcmp(expected, data, compared_length) == 0) {
+                matched_length = compared_length;
             }
 
-            input_last_processed_data_offset = input_offset;
+            while (matched_length < compared_length && expected[matched_length] == data[matched_length]) {
+                matched_length++;
+            }
         } else {
-            input_offset++;
+            u8 value = command <= COMMAND_RLE_WRITE_SHORT_ANY_VALUE_END ? output_buffer[output_offset + 1] : 0x00;
+
+            while (matched_length < compared_length && expected[matched_length] == value) {
+                matched_length++;
+            }
+        }
+
+        if (matched_length < length) {
+            compress_verifier_fail(verifier, input_offset + matched_length, output_buffer, output_size);
+            break;
         }
+
+        verifier->input_offset += length;
+        verifier->output_offset += command_size;
     }
 
-    // Write the compressed size into the first 4 bytes of the output buffer.
-    output_buffer[0] = 0x00; // The first byte is always 0x00.
-    output_buffer[1] = (output_offset >> 16) & 0xFF;
-    output_buffer[2] = (output_offset >> 8) & 0xFF;
-    output_buffer[3] = output_offset & 0xFF;
-    
-    // Return the output offset as the output size.
-    return output_offset;
+    return !verifier->failed;
 }
 
-size_t lzkn64_compress_accurate(const u8 *input_buffer, u8 *output_buffer, size_t input_size) {
-    size_t input_offset = 0;
-    size_t output_offset = 4; // Skip the first 4 bytes since they are the compressed file size.
+// Checks the rest of the output once the compression is done: every command has to be complete, the commands have to
+// produce the whole input and the header has to hold the compressed size.
+static bool compress_verify_finish(struct CompressVerifier *verifier, const u8 *input_buffer, size_t input_size, const u8 *output_buffer, size_t output_size) {
+    if (!compress_verify(verifier, input_buffer, input_size, output_buffer, output_size)) {
+        return false;
+    }
 
-    size_t input_last_processed_data_offset = 0;
+    if (verifier->output_offset != output_size || verifier->input_offset != input_size) {
+        compress_verifier_fail(verifier, verifier->input_offset, output_buffer, output_size);
+        return false;
+    }
 
-    while (input_offset < input_size) {
-        size_t sliding_window_copy_maximum_length = 0;
+    size_t compressed_size = ((size_t)output_buffer[1] << 16) | ((size_t)output_buffer[2] << 8) | output_buffer[3];
 
-        // Find the maximum length of the sliding window copy, e.g. how many bytes can be copied without going out of bounds.
-        if ((input_size - input_offset) >= SLIDING_WINDOW_COPY_MAXIMUM_LENGTH) {
-            sliding_window_copy_maximum_length = SLIDING_WINDOW_COPY_MAXIMUM_LENGTH;
-        } else {
-            sliding_window_copy_maximum_length = input_size - input_offset;
-        }
+    if (output_buffer[0] != 0x00 || compressed_size != output_size) {
+        verifier->output_offset = 0;
+        compress_verifier_fail(verifier, 0, output_buffer, output_size);
+        return false;
+    }
 
-        size_t sliding_window_maximum_offset = 0;
+    return true;
+}
 
-        //! First difference from the efficient algorithm.
-        // The sliding window size is 0x10 bytes smaller than the efficient algorithm.
-        // Find the maximum offset of the sliding window copy, e.g. how far back can we go to copy bytes.
-        if (input_offset >= SLIDING_WINDOW_SIZE_ACCURATE) {
-            sliding_window_maximum_offset = SLIDING_WINDOW_SIZE_ACCURATE;
-        } else {
-            sliding_window_maximum_offset = input_offset;
-        }
+static ALWAYS_INLINE size_t compress_with_policy(const struct CompressPolicy policy, const u8 *input_buffer, u8 *output_buffer, size_t input_size, const struct MatchTableEntry *match_table, struct CompressVerifier *verifier) {
+    struct CompressState state;
+    state.input_buffer = input_buffer;
+    state.input_start = 0;
+    state.input_offset = 0;
+    state.input_last_processed_data_offset = 0;
+    state.rle_run_end = 0;
+    state.output_buffer = output_buffer;
+    state.output_offset = 4; // Skip the first 4 bytes since they are the compressed file size.
+
+    struct HashChain hash_chain;
+    if (match_table == NULL) {
+        hash_chain_init(&hash_chain);
+    }
 
-        size_t rle_window_maximum_length = 0;
+    while (state.input_offset < input_size) {
+        compress_step(policy, &state, input_size, &hash_chain, match_table);
 
-        // Find the maximum length of the RLE window, e.g. how many bytes can be matched without going out of bounds.
-        if ((input_size - input_offset) >= RLE_LONG_MAXIMUM_LENGTH) {
-            rle_window_maximum_length = RLE_LONG_MAXIMUM_LENGTH;
-        } else {
-            rle_window_maximum_length = input_size - input_offset;
+        // Checked right away, while the commands and the input they cover are still in the cache.
+        if (verifier != NULL && state.output_offset != verifier->output_offset) {
+            compress_verify(verifier, input_buffer, input_size, output_buffer, state.output_offset);
         }
-        
-        //! Second difference from the efficient algorithm.
-        if (rle_window_maximum_length > RLE_SHORT_MAXIMUM_LENGTH) {
-            for (size_t i = (RLE_SHORT_MAXIMUM_LENGTH + 1); i <= rle_window_maximum_length; i++) {
-                size_t j = (input_offset + i) & 0xFFF;
+    }
 
-                // Check every 0x400 to see if we are RLE_SHORT_MAXIMUM_LENGTH bytes away from the start of the 0x400 block.
-                if (j % 0x400 == RLE_SHORT_MAXIMUM_LENGTH) {
-                    rle_window_maximum_length = i;
-                    break;
-                }
-            }
-        }
+#if defined(LZKN64_STATS)
+    if (match_table == NULL) {
+        stats_probe_count += hash_chain.probe_count;
+    }
+#endif
 
-        size_t sliding_window_match_offset = 0;
-        size_t sliding_window_match_length = 0;
+    // Write the compressed size into the first 4 bytes of the output buffer.
+    output_buffer[0] = 0x00; // The first byte is always 0x00.
+    output_buffer[1] = (state.output_offset >> 16) & 0xFF;
+    output_buffer[2] = (state.output_offset >> 8) & 0xFF;
+    output_buffer[3] = state.output_offset & 0xFF;
 
-        // Find the longest match in the sliding window.
-        for (size_t i = 1; i <= sliding_window_maximum_offset; i++) {
-            size_t match_length = 0;
+    if (verifier != NULL) {
+        compress_verify_finish(verifier, input_buffer, input_size, output_buffer, state.output_offset);
+    }
 
-            for (size_t j = 0; j < sliding_window_copy_maximum_length; j++) {
-                if (input_buffer[input_offset - i + j] == input_buffer[input_offset + j]) {
-                    match_length++;
-                } else {
-                    break;
-                }
-            }
+    // Return the output offset as the output size.
+    return state.output_offset;
+}
 
-            if (match_length > sliding_window_match_length) {
-                sliding_window_match_offset = i;
-                sliding_window_match_length = match_length;
-            }
-        }
+// Each branch gets its own copy of the engine, so the loop doesn't check for the match table either. A verifier is
+// passed along as is, checking for it once per command costs nothing next to the search.
+static size_t compress_efficient(const u8 *input_buffer, u8 *output_buffer, size_t input_size, const struct MatchTableEntry *match_table, struct CompressVerifier *verifier) {
+    if (match_table != NULL) {
+        return compress_with_policy(compress_policy_efficient, input_buffer, output_buffer, input_size, match_table, verifier);
+    } else {
+        return compress_with_policy(compress_policy_efficient, input_buffer, output_buffer, input_size, NULL, verifier);
+    }
+}
 
-        size_t rle_match_value = 0;
-        size_t rle_match_length = 0;
+static size_t compress_accurate(const u8 *input_buffer, u8 *output_buffer, size_t input_size, const struct MatchTableEntry *match_table, struct CompressVerifier *verifier) {
+    if (match_table != NULL) {
+        return compress_with_policy(compress_policy_accurate, input_buffer, output_buffer, input_size, match_table, verifier);
+    } else {
+        return compress_with_policy(compress_policy_accurate, input_buffer, output_buffer, input_size, NULL, verifier);
+    }
+}
 
-        // Find the longest match in the RLE window.
-        {
-            size_t match_value = input_buffer[input_offset];
-            size_t match_length = 0;
+size_t lzkn64_compress_efficient(const u8 *input_buffer, u8 *output_buffer, size_t input_size) {
+    return compress_efficient(input_buffer, output_buffer, input_size, NULL, NULL);
+}
 
-            //! Third difference from the efficient algorithm. 
-            // For some reason, when emitting a COMMAND_RLE_WRITE_SHORT_ANY_VALUE, the maximum length is RLE_SHORT_MAXIMUM_LENGTH - 1 instead of RLE_SHORT_MAXIMUM_LENGTH.
-            if (match_value != 0x00 && rle_window_maximum_length > (RLE_SHORT_MAXIMUM_LENGTH - 1)) {
-                // We are matching a non-zero value, so the maximum length we are able to match is the maximum copy length.
-                rle_window_maximum_length = (RLE_SHORT_MAXIMUM_LENGTH - 1);
-            }
+size_t lzkn64_compress_efficient_parallel(const u8 *input_buffer, u8 *output_buffer, size_t input_size, size_t thread_count) {
+    struct MatchTableEntry *match_table = NULL;
 
-            for (size_t i = 0; i < rle_window_maximum_length; i++) {
-                if (input_buffer[input_offset + i] == match_value) {
-                    match_length++;
-                } else {
-                    break;
-                }
-            }
+    if (thread_count != 1) {
+        match_table = match_table_create(input_buffer, input_size, SLIDING_WINDOW_SIZE_EFFICIENT, thread_count);
+    }
 
-            //! Fourth difference from the efficient algorithm.
-            if (match_length > 0) {
-                rle_match_value = match_value;
-                rle_match_length = match_length;
-            }
-        }
+    // Falls back to searching while parsing if there is only one thread or the table couldn't be allocated.
+    size_t output_size = compress_efficient(input_buffer, output_buffer, input_size, match_table, NULL);
 
-        u8 command = COMMAND_UNDEFINED;
+    free(match_table);
 
-        //! Fifth difference from the efficient algorithm.
-        // Try to pick a command that works best with the values calculated above.
-        if (sliding_window_match_length >= 4 && sliding_window_match_length > rle_match_length) {
-            command = COMMAND_SLIDING_WINDOW_COPY; // Takes up 2 bytes.
-        } else if (rle_match_length >= 3) {
-            if (rle_match_value == 0x00) {
-                if (rle_match_length < RLE_SHORT_MAXIMUM_LENGTH) {
-                    command = COMMAND_RLE_WRITE_SHORT_ZERO; // Takes up 1 byte.
-                } else if (rle_match_length <= RLE_LONG_MAXIMUM_LENGTH) {
-                    command = COMMAND_RLE_WRITE_LONG_ZERO; // Takes up 2 bytes.
-                }
-            } else {
-                if (rle_match_length <= RLE_SHORT_MAXIMUM_LENGTH) {
-                    command = COMMAND_RLE_WRITE_SHORT_ANY_VALUE; // Takes up 2 bytes.
-                }
-            }
-        } else if (rle_match_length == 2) {
-            if (rle_match_value == 0x00) {
-                command = COMMAND_RLE_WRITE_SHORT_ZERO; // Takes up 1 byte.
-            }
-        }
+    return output_size;
+}
 
-        size_t raw_copy_length = input_offset - input_last_processed_data_offset;
+size_t lzkn64_compress_accurate(const u8 *input_buffer, u8 *output_buffer, size_t input_size) {
+    return compress_accurate(input_buffer, output_buffer, input_size, NULL, NULL);
+}
 
-        // Force a raw copy command under the following conditions:
-        // 1. A command has been picked and there is raw data to copy. (This happens when a command couldn't be found for the data.)
-        // 2. The raw data length is at the maximum length or greater.
-        // 3. The input offset is at the end of the input buffer.
-        if ((command != COMMAND_UNDEFINED && raw_copy_length > 0) || raw_copy_length >= RAW_COPY_MAXIMUM_LENGTH || (input_offset + 1) >= input_size) {
-            if ((input_offset + 1) >= input_size) {
-                raw_copy_length = input_size - input_last_processed_data_offset;
-            }
+size_t lzkn64_compress_accurate_parallel(const u8 *input_buffer, u8 *output_buffer, size_t input_size, size_t thread_count) {
+    struct MatchTableEntry *match_table = NULL;
 
-            while (raw_copy_length > 0) {
-                size_t length = 0;
+    if (thread_count != 1) {
+        match_table = match_table_create(input_buffer, input_size, SLIDING_WINDOW_SIZE_ACCURATE, thread_count);
+    }
 
-                if (raw_copy_length > RAW_COPY_MAXIMUM_LENGTH) {
-                    length = RAW_COPY_MAXIMUM_LENGTH;
-                } else {
-                    length = raw_copy_length;
-                }
+    // Falls back to searching while parsing if there is only one thread or the table couldn't be allocated.
+    size_t output_size = compress_accurate(input_buffer, output_buffer, input_size, match_table, NULL);
 
-                output_buffer[output_offset++] = COMMAND_RAW_COPY | (length & COMMAND_RAW_COPY_LENGTH_MASK);
+    free(match_table);
 
-                for (size_t i = 0; i < length; i++) {
-                    output_buffer[output_offset++] = input_buffer[input_last_processed_data_offset++];
-                }
+    return output_size;
+}
 
-                raw_copy_length -= length;
+// The short zero RLE command can't use the top length value, since 0xFF is the long zero RLE command.
+#define OPTIMAL_RLE_SHORT_ZERO_MAXIMUM_LENGTH (COMMAND_RLE_WRITE_SHORT_ZERO_END - COMMAND_RLE_WRITE_SHORT_ZERO_START + 2)
+#define OPTIMAL_PAIR_TABLE_SIZE 0x10000
+
+// The cheapest way to encode everything from a position to the end of the input, and the command that starts it.
+struct OptimalNode {
+    u32 cost;
+    u16 length;
+    u8 command;
+};
+
+// Scratch memory of the optimal parse, every buffer but pair_positions has to hold one entry per input byte.
+struct OptimalScratch {
+    struct MatchTableEntry *match_table;
+    struct OptimalNode *nodes; // One more entry than the input size, for the end of the input.
+    u16 *pair_match_offsets;
+    u32 *pair_positions; // OPTIMAL_PAIR_TABLE_SIZE entries.
+};
+
+static size_t compress_optimal(const u8 *input_buffer, u8 *output_buffer, size_t input_size, size_t thread_count, struct ParallelPool *pool, const struct OptimalScratch *scratch) {
+    struct MatchTableEntry *match_table = scratch->match_table;
+    struct OptimalNode *nodes = scratch->nodes;
+    u16 *pair_match_offsets = scratch->pair_match_offsets;
+    u32 *pair_positions = scratch->pair_positions;
+
+    match_table_fill(match_table, input_buffer, input_size, SLIDING_WINDOW_SIZE_EFFICIENT, thread_count, pool);
+
+    // The match table only holds matches of 3 bytes or more, so find the closest 2 byte match separately.
+    memset(pair_positions, 0xFF, OPTIMAL_PAIR_TABLE_SIZE * sizeof(u32));
+
+    for (size_t i = 0; i < input_size; i++) {
+        pair_match_offsets[i] = 0;
+
+        if ((i + 1) < input_size) {
+            u16 pair = (input_buffer[i] << 8) | input_buffer[i + 1];
+            u32 position = pair_positions[pair];
+
+            if (position != HASH_CHAIN_NONE && (i - position) <= SLIDING_WINDOW_SIZE_EFFICIENT) {
+                pair_match_offsets[i] = (u16)(i - position);
             }
+
+            pair_positions[pair] = (u32)i;
         }
+    }
 
-        if (command == COMMAND_SLIDING_WINDOW_COPY) {
-            output_buffer[output_offset++] = COMMAND_SLIDING_WINDOW_COPY | (((sliding_window_match_length - 2) << 2) & COMMAND_SLIDING_WINDOW_COPY_LENGTH_MASK) | ((sliding_window_match_offset >> 8) & COMMAND_SLIDING_WINDOW_COPY_OFFSET_FIRST_BYTE_MASK);
-            output_buffer[output_offset++] = sliding_window_match_offset & COMMAND_SLIDING_WINDOW_COPY_OFFSET_SECOND_BYTE_MASK;
+    nodes[input_size].cost = 0;
 
-            input_offset += sliding_window_match_length;
-            input_last_processed_data_offset = input_offset;
-        } else if (command == COMMAND_RLE_WRITE_SHORT_ANY_VALUE) {
-            while (rle_match_length > 0) {
-                size_t length = 0;
+    // Work backwards from the end, so every command only has to look at the already known cost of what follows it.
+    for (size_t i = input_size; i-- > 0;) {
+        struct OptimalNode *node = &nodes[i];
+        size_t remaining_size = input_size - i;
 
-                if (rle_match_length > RLE_SHORT_MAXIMUM_LENGTH) {
-                    length = RLE_SHORT_MAXIMUM_LENGTH;
-                } else {
-                    length = rle_match_length;
-                }
+        node->cost = 0xFFFFFFFF;
 
-                output_buffer[output_offset++] = COMMAND_RLE_WRITE_SHORT_ANY_VALUE | ((length - 2) & COMMAND_RLE_WRITE_SHORT_ANY_VALUE_LENGTH_MASK);
-                output_buffer[output_offset++] = rle_match_value;
+        // Raw data copy, 1 byte plus the data.
+        for (size_t length = 1; length <= RAW_COPY_MAXIMUM_LENGTH && length <= remaining_size; length++) {
+            u32 cost = 1 + (u32)length + nodes[i + length].cost;
 
-                rle_match_length -= length;
-                input_offset += length;
+            if (cost < node->cost) {
+                node->cost = cost;
+                node->length = (u16)length;
+                node->command = COMMAND_RAW_COPY;
             }
+        }
 
-            input_last_processed_data_offset = input_offset;
-        } else if (command == COMMAND_RLE_WRITE_SHORT_ZERO) {
-            while (rle_match_length > 0) {
-                size_t length = 0;
+        // Sliding window copy, 2 bytes for any length up to the longest match.
+        size_t sliding_window_match_length = match_table[i].sliding_window_match_length;
 
-                if (rle_match_length > RLE_SHORT_MAXIMUM_LENGTH) {
-                    length = RLE_SHORT_MAXIMUM_LENGTH;
-                } else {
-                    length = rle_match_length;
-                }
+        if (sliding_window_match_length == 0 && pair_match_offsets[i] != 0) {
+            sliding_window_match_length = 2;
+        }
 
-                output_buffer[output_offset++] = COMMAND_RLE_WRITE_SHORT_ZERO | ((length - 2) & COMMAND_RLE_WRITE_SHORT_ZERO_LENGTH_MASK);
+        for (size_t length = 2; length <= sliding_window_match_length; length++) {
+            u32 cost = 2 + nodes[i + length].cost;
 
-                rle_match_length -= length;
-                input_offset += length;
+            if (cost < node->cost) {
+                node->cost = cost;
+                node->length = (u16)length;
+                node->command = COMMAND_SLIDING_WINDOW_COPY;
             }
+        }
 
-            input_last_processed_data_offset = input_offset;
-        } else if (command == COMMAND_RLE_WRITE_LONG_ZERO) {
-            while (rle_match_length > 0) {
-                size_t length = 0;
+        // RLE writes, 1 byte for short zero runs and 2 bytes for long zero runs or runs of any other value.
+        size_t rle_run_length = match_table[i].rle_run_length;
 
-                if (rle_match_length > RLE_LONG_MAXIMUM_LENGTH) {
-                    length = RLE_LONG_MAXIMUM_LENGTH;
-                } else {
-                    length = rle_match_length;
-                }
+        if (input_buffer[i] == 0x00) {
+            for (size_t length = 2; length <= rle_run_length; length++) {
+                u32 cost = (length <= OPTIMAL_RLE_SHORT_ZERO_MAXIMUM_LENGTH ? 1 : 2) + nodes[i + length].cost;
 
-                output_buffer[output_offset++] = COMMAND_RLE_WRITE_LONG_ZERO;
-                output_buffer[output_offset++] = (length - 2) & COMMAND_RLE_WRITE_LONG_ZERO_LENGTH_MASK;
+                if (cost < node->cost) {
+                    node->cost = cost;
+                    node->length = (u16)length;
+                    node->command = length <= OPTIMAL_RLE_SHORT_ZERO_MAXIMUM_LENGTH ? COMMAND_RLE_WRITE_SHORT_ZERO : COMMAND_RLE_WRITE_LONG_ZERO;
+                }
+            }
+        } else {
+            for (size_t length = 2; length <= rle_run_length && length <= RLE_SHORT_MAXIMUM_LENGTH; length++) {
+                u32 cost = 2 + nodes[i + length].cost;
 
-                rle_match_length -= length;
-                input_offset += length;
+                if (cost < node->cost) {
+                    node->cost = cost;
+                    node->length = (u16)length;
+                    node->command = COMMAND_RLE_WRITE_SHORT_ANY_VALUE;
+                }
             }
+        }
+    }
 
-            input_last_processed_data_offset = input_offset;
-        } else {
-            input_offset++;
+    size_t input_offset = 0;
+    size_t output_offset = 4; // Skip the first 4 bytes since they are the compressed file size.
+
+    // Follow the cheapest path from the start and write out its commands.
+    while (input_offset < input_size) {
+        struct OptimalNode *node = &nodes[input_offset];
+        size_t length = node->length;
+
+        if (node->command == COMMAND_RAW_COPY) {
+            output_buffer[output_offset++] = COMMAND_RAW_COPY | (length & COMMAND_RAW_COPY_LENGTH_MASK);
+
+            memcpy(&output_buffer[output_offset], &input_buffer[input_offset], length);
+            output_offset += length;
+        } else if (node->command == COMMAND_SLIDING_WINDOW_COPY) {
+            size_t offset = match_table[input_offset].sliding_window_match_length != 0 ? match_table[input_offset].sliding_window_match_offset : pair_match_offsets[input_offset];
+
+            output_buffer[output_offset++] = COMMAND_SLIDING_WINDOW_COPY | (((length - 2) << 2) & COMMAND_SLIDING_WINDOW_COPY_LENGTH_MASK) | ((offset >> 8) & COMMAND_SLIDING_WINDOW_COPY_OFFSET_FIRST_BYTE_MASK);
+            output_buffer[output_offset++] = offset & COMMAND_SLIDING_WINDOW_COPY_OFFSET_SECOND_BYTE_MASK;
+        } else if (node->command == COMMAND_RLE_WRITE_SHORT_ANY_VALUE) {
+            output_buffer[output_offset++] = COMMAND_RLE_WRITE_SHORT_ANY_VALUE | ((length - 2) & COMMAND_RLE_WRITE_SHORT_ANY_VALUE_LENGTH_MASK);
+            output_buffer[output_offset++] = input_buffer[input_offset];
+        } else if (node->command == COMMAND_RLE_WRITE_SHORT_ZERO) {
+            output_buffer[output_offset++] = COMMAND_RLE_WRITE_SHORT_ZERO | ((length - 2) & COMMAND_RLE_WRITE_SHORT_ZERO_LENGTH_MASK);
+        } else if (node->command == COMMAND_RLE_WRITE_LONG_ZERO) {
+            output_buffer[output_offset++] = COMMAND_RLE_WRITE_LONG_ZERO;
+            output_buffer[output_offset++] = (length - 2) & COMMAND_RLE_WRITE_LONG_ZERO_LENGTH_MASK;
         }
+
+        input_offset += length;
     }
 
     // Write the compressed size into the first 4 bytes of the output buffer.
@@ -437,65 +818,1283 @@ size_t lzkn64_compress_accurate(const u8 *input_buffer, u8 *output_buffer, size_
     return output_offset;
 }
 
+size_t lzkn64_compress_optimal(const u8 *input_buffer, u8 *output_buffer, size_t input_size) {
+    return lzkn64_compress_optimal_parallel(input_buffer, output_buffer, input_size, 1);
+}
+
+size_t lzkn64_compress_optimal_parallel(const u8 *input_buffer, u8 *output_buffer, size_t input_size, size_t thread_count) {
+    struct OptimalScratch scratch;
+    scratch.match_table = malloc(input_size * sizeof(struct MatchTableEntry));
+    scratch.nodes = malloc((input_size + 1) * sizeof(struct OptimalNode));
+    scratch.pair_match_offsets = malloc(input_size * sizeof(u16));
+    scratch.pair_positions = malloc(OPTIMAL_PAIR_TABLE_SIZE * sizeof(u32));
+
+    size_t output_size = 0;
+
+    if (scratch.match_table == NULL || scratch.nodes == NULL || scratch.pair_match_offsets == NULL || scratch.pair_positions == NULL) {
+        // Not enough memory for the parse, the efficient algorithm still gives a valid result.
+        output_size = lzkn64_compress_efficient(input_buffer, output_buffer, input_size);
+    } else {
+        output_size = compress_optimal(input_buffer, output_buffer, input_size, thread_count, NULL, &scratch);
+    }
+
+    free(scratch.match_table);
+    free(scratch.nodes);
+    free(scratch.pair_match_offsets);
+    free(scratch.pair_positions);
+
+    return output_size;
+}
+
+// Copies length bytes which start offset bytes back in the output, the source and destination may overlap.
+static void decompress_copy_window(u8 *output, size_t offset, size_t length) {
+    if (offset == 0) {
+        // An offset of 0 copies each byte onto itself, so the output is left as it is.
+        return;
+    } else if (offset >= length) {
+        memcpy(output, output - offset, length);
+    } else if (offset == 1) {
+        memset(output, output[-1], length);
+    } else {
+        // The bytes between output - offset and output repeat, so each copy can take twice as much as the one before it
+        // without the source and destination overlapping.
+        size_t distance = offset;
+
+        while (length > 0) {
+            size_t chunk_length = length < distance ? length : distance;
+
+            memcpy(output, output - distance, chunk_length);
+
+            output += chunk_length;
+            length -= chunk_length;
+            distance *= 2;
+        }
+    }
+}
+
 size_t lzkn64_decompress(const u8 *input_buffer, u8 *output_buffer, size_t input_size) {
     size_t input_offset = 4; // Skip the first 4 bytes since they are the compressed file size.
     size_t output_offset = 0;
-    
+
     while (input_offset < input_size) {
         u8 command = input_buffer[input_offset++];
 
-        if (command >= COMMAND_SLIDING_WINDOW_COPY_START && command <= COMMAND_SLIDING_WINDOW_COPY_END) {
-            u8 length = (command & COMMAND_SLIDING_WINDOW_COPY_LENGTH_MASK) >> 2;
-            u16 offset_first_byte = (command & COMMAND_SLIDING_WINDOW_COPY_OFFSET_FIRST_BYTE_MASK) << 8;
-            u8 offset_second_byte = input_buffer[input_offset++];
-            u16 offset = (offset_first_byte | offset_second_byte) & COMMAND_SLIDING_WINDOW_COPY_OFFSET_MAX_MASK;
-
-            // Add 2 to get the actual length since 2 is the minimum length.
-            length += 2;
-            
-            for (size_t i = 0; i < length; i++) {
-                output_buffer[output_offset] = output_buffer[output_offset - offset];
-                output_offset++;
-            }
-        } else if (command >= COMMAND_RAW_COPY_START && command <= COMMAND_RAW_COPY_END) {
-            u8 length = command & COMMAND_RAW_COPY_LENGTH_MASK;
-            
-            for (size_t i = 0; i < length; i++) {
-                output_buffer[output_offset++] = input_buffer[input_offset++];
+        // Every command type covers a range of 0x20 values (the sliding window copy covers four of them), so the top
+        // 3 bits of the command are enough to dispatch on, which compiles down to a single jump table.
+        switch (command >> 5) {
+            case COMMAND_SLIDING_WINDOW_COPY_START >> 5:
+            case (COMMAND_SLIDING_WINDOW_COPY_START >> 5) + 1:
+            case (COMMAND_SLIDING_WINDOW_COPY_START >> 5) + 2:
+            case COMMAND_SLIDING_WINDOW_COPY_END >> 5: {
+                size_t offset = (((command & COMMAND_SLIDING_WINDOW_COPY_OFFSET_FIRST_BYTE_MASK) << 8) | input_buffer[input_offset++]) & COMMAND_SLIDING_WINDOW_COPY_OFFSET_MAX_MASK;
+
+                // Add 2 to get the actual length since 2 is the minimum length.
+                size_t length = ((command & COMMAND_SLIDING_WINDOW_COPY_LENGTH_MASK) >> 2) + 2;
+
+                decompress_copy_window(&output_buffer[output_offset], offset, length);
+                output_offset += length;
+                break;
             }
-        } else if (command >= COMMAND_RLE_WRITE_SHORT_ANY_VALUE_START && command <= COMMAND_RLE_WRITE_SHORT_ANY_VALUE_END) {
-            u8 length = command & COMMAND_RLE_WRITE_SHORT_ANY_VALUE_LENGTH_MASK;
-            u8 value = input_buffer[input_offset++];
- 
-            // Add 2 to get the actual length since 2 is the minimum length.
-            length += 2;
+            case COMMAND_RAW_COPY_START >> 5: {
+                size_t length = command & COMMAND_RAW_COPY_LENGTH_MASK;
 
-            for (size_t i = 0; i < length; i++) {
-                output_buffer[output_offset++] = value;
+                memcpy(&output_buffer[output_offset], &input_buffer[input_offset], length);
+                input_offset += length;
+                output_offset += length;
+                break;
             }
-        } else if (command >= COMMAND_RLE_WRITE_SHORT_ZERO_START && command <= COMMAND_RLE_WRITE_SHORT_ZERO_END) {
-            u8 length = command & COMMAND_RLE_WRITE_SHORT_ZERO_LENGTH_MASK;
-
-            // Add 2 to get the actual length since 2 is the minimum length.
-            length += 2;
-
-            for (size_t i = 0; i < length; i++) {
-                output_buffer[output_offset++] = 0;
+            case COMMAND_RLE_WRITE_SHORT_ANY_VALUE_START >> 5: {
+                // Add 2 to get the actual length since 2 is the minimum length.
+                size_t length = (command & COMMAND_RLE_WRITE_SHORT_ANY_VALUE_LENGTH_MASK) + 2;
+                u8 value = input_buffer[input_offset++];
+
+                memset(&output_buffer[output_offset], value, length);
+                output_offset += length;
+                break;
             }
-        } else if (command == COMMAND_RLE_WRITE_LONG_ZERO) {
-            u16 length = input_buffer[input_offset++] & COMMAND_RLE_WRITE_LONG_ZERO_LENGTH_MASK;
+            case COMMAND_RLE_WRITE_SHORT_ZERO_START >> 5: {
+                size_t length;
+
+                // The long zero command shares its top 3 bits with the short zero command.
+                if (command == COMMAND_RLE_WRITE_LONG_ZERO) {
+                    length = input_buffer[input_offset++] & COMMAND_RLE_WRITE_LONG_ZERO_LENGTH_MASK;
+                } else {
+                    length = command & COMMAND_RLE_WRITE_SHORT_ZERO_LENGTH_MASK;
+                }
 
-            // Add 2 to get the actual length since 2 is the minimum length.
-            length += 2;
+                // Add 2 to get the actual length since 2 is the minimum length.
+                length += 2;
 
-            for (size_t i = 0; i < length; i++) {
-                output_buffer[output_offset++] = 0;
+                memset(&output_buffer[output_offset], 0, length);
+                output_offset += length;
+                break;
             }
-        } else {
-            // Invalid command.
+            default:
+                // Invalid command.
+                break;
         }
     }
 
     // Return the output offset as the output size.
     return output_offset;
 }
+
+const char *lzkn64_status_string(enum Lzkn64Status status) {
+    switch (status) {
+        case LZKN64_STATUS_OK:
+            return "ok";
+        case LZKN64_STATUS_INVALID_HEADER:
+            return "invalid header";
+        case LZKN64_STATUS_TRUNCATED_INPUT:
+            return "truncated input";
+        case LZKN64_STATUS_BAD_OFFSET:
+            return "sliding window offset out of range";
+        case LZKN64_STATUS_OUTPUT_OVERFLOW:
+            return "output buffer too small";
+        case LZKN64_STATUS_INVALID_COMMAND:
+            return "invalid command";
+        case LZKN64_STATUS_INVALID_INDEX:
+            return "index doesn't match the input";
+        case LZKN64_STATUS_INVALID_RANGE:
+            return "range past the end of the output";
+        case LZKN64_STATUS_MISMATCH:
+            return "output doesn't decompress to the input";
+        case LZKN64_STATUS_OUTPUT_TOO_LARGE:
+            return "compressed size doesn't fit in the header";
+    }
+
+    return "unknown status";
+}
+
+// Reads the compressed size from the header and checks that the whole stream is there.
+static enum Lzkn64Status read_header(const u8 *input_buffer, size_t input_size, size_t *compressed_size) {
+    if (input_size < 4) {
+        return LZKN64_STATUS_TRUNCATED_INPUT;
+    }
+
+    // The size is only 24 bits, the first byte is always 0x00.
+    if (input_buffer[0] != 0x00) {
+        return LZKN64_STATUS_INVALID_HEADER;
+    }
+
+    *compressed_size = ((size_t)input_buffer[1] << 16) | ((size_t)input_buffer[2] << 8) | (size_t)input_buffer[3];
+
+    if (*compressed_size < 4) {
+        return LZKN64_STATUS_INVALID_HEADER;
+    }
+
+    if (*compressed_size > input_size) {
+        return LZKN64_STATUS_TRUNCATED_INPUT;
+    }
+
+    return LZKN64_STATUS_OK;
+}
+
+enum Lzkn64Status lzkn64_decompress_safe(const u8 *input_buffer, size_t input_size, u8 *output_buffer, size_t output_capacity, size_t *output_size) {
+    size_t compressed_size = 0;
+    size_t input_offset = 4; // Skip the first 4 bytes since they are the compressed file size.
+    size_t output_offset = 0;
+
+    *output_size = 0;
+
+    enum Lzkn64Status status = read_header(input_buffer, input_size, &compressed_size);
+    if (status != LZKN64_STATUS_OK) {
+        return status;
+    }
+
+    // Everything is validated once per command, the copies themselves are the same as in lzkn64_decompress.
+    while (input_offset < compressed_size) {
+        u8 command = input_buffer[input_offset++];
+        size_t length;
+
+        switch (command >> 5) {
+            case COMMAND_SLIDING_WINDOW_COPY_START >> 5:
+            case (COMMAND_SLIDING_WINDOW_COPY_START >> 5) + 1:
+            case (COMMAND_SLIDING_WINDOW_COPY_START >> 5) + 2:
+            case COMMAND_SLIDING_WINDOW_COPY_END >> 5: {
+                if (input_offset >= compressed_size) {
+                    status = LZKN64_STATUS_TRUNCATED_INPUT;
+                    break;
+                }
+
+                size_t offset = (((command & COMMAND_SLIDING_WINDOW_COPY_OFFSET_FIRST_BYTE_MASK) << 8) | input_buffer[input_offset++]) & COMMAND_SLIDING_WINDOW_COPY_OFFSET_MAX_MASK;
+
+                // Add 2 to get the actual length since 2 is the minimum length.
+                length = ((command & COMMAND_SLIDING_WINDOW_COPY_LENGTH_MASK) >> 2) + 2;
+
+                if (offset == 0 || offset > output_offset) {
+                    status = LZKN64_STATUS_BAD_OFFSET;
+                } else if (length > (output_capacity - output_offset)) {
+                    status = LZKN64_STATUS_OUTPUT_OVERFLOW;
+                } else {
+                    decompress_copy_window(&output_buffer[output_offset], offset, length);
+                    output_offset += length;
+                }
+                break;
+            }
+            case COMMAND_RAW_COPY_START >> 5:
+                length = command & COMMAND_RAW_COPY_LENGTH_MASK;
+
+                if (length > (compressed_size - input_offset)) {
+                    status = LZKN64_STATUS_TRUNCATED_INPUT;
+                } else if (length > (output_capacity - output_offset)) {
+                    status = LZKN64_STATUS_OUTPUT_OVERFLOW;
+                } else {
+                    memcpy(&output_buffer[output_offset], &input_buffer[input_offset], length);
+                    input_offset += length;
+                    output_offset += length;
+                }
+                break;
+            case COMMAND_RLE_WRITE_SHORT_ANY_VALUE_START >> 5:
+                // Add 2 to get the actual length since 2 is the minimum length.
+                length = (command & COMMAND_RLE_WRITE_SHORT_ANY_VALUE_LENGTH_MASK) + 2;
+
+                if (input_offset >= compressed_size) {
+                    status = LZKN64_STATUS_TRUNCATED_INPUT;
+                } else if (length > (output_capacity - output_offset)) {
+                    status = LZKN64_STATUS_OUTPUT_OVERFLOW;
+                } else {
+                    memset(&output_buffer[output_offset], input_buffer[input_offset++], length);
+                    output_offset += length;
+                }
+                break;
+            case COMMAND_RLE_WRITE_SHORT_ZERO_START >> 5:
+                // The long zero command shares its top 3 bits with the short zero command.
+                if (command == COMMAND_RLE_WRITE_LONG_ZERO) {
+                    if (input_offset >= compressed_size) {
+                        status = LZKN64_STATUS_TRUNCATED_INPUT;
+                        break;
+                    }
+
+                    length = input_buffer[input_offset++] & COMMAND_RLE_WRITE_LONG_ZERO_LENGTH_MASK;
+                } else {
+                    length = command & COMMAND_RLE_WRITE_SHORT_ZERO_LENGTH_MASK;
+                }
+
+                // Add 2 to get the actual length since 2 is the minimum length.
+                length += 2;
+
+                if (length > (output_capacity - output_offset)) {
+                    status = LZKN64_STATUS_OUTPUT_OVERFLOW;
+                } else {
+                    memset(&output_buffer[output_offset], 0, length);
+                    output_offset += length;
+                }
+                break;
+            default:
+                status = LZKN64_STATUS_INVALID_COMMAND;
+                break;
+        }
+
+        if (status != LZKN64_STATUS_OK) {
+            break;
+        }
+    }
+
+    // On errors this is how much was written before the bad command.
+    *output_size = output_offset;
+
+    return status;
+}
+
+enum Lzkn64Status lzkn64_decompressed_size(const u8 *input_buffer, size_t input_size, size_t *output_size) {
+    size_t compressed_size = 0;
+    size_t input_offset = 4; // Skip the first 4 bytes since they are the compressed file size.
+    size_t output_offset = 0;
+
+    *output_size = 0;
+
+    enum Lzkn64Status status = read_header(input_buffer, input_size, &compressed_size);
+    if (status != LZKN64_STATUS_OK) {
+        return status;
+    }
+
+    // Same walk over the commands as lzkn64_decompress_safe, but only the lengths are looked at.
+    while (input_offset < compressed_size) {
+        u8 command = input_buffer[input_offset++];
+
+        if (command <= COMMAND_SLIDING_WINDOW_COPY_END) {
+            if (input_offset >= compressed_size) {
+                return LZKN64_STATUS_TRUNCATED_INPUT;
+            }
+
+            size_t offset = (((command & COMMAND_SLIDING_WINDOW_COPY_OFFSET_FIRST_BYTE_MASK) << 8) | input_buffer[input_offset++]) & COMMAND_SLIDING_WINDOW_COPY_OFFSET_MAX_MASK;
+
+            if (offset == 0 || offset > output_offset) {
+                return LZKN64_STATUS_BAD_OFFSET;
+            }
+
+            output_offset += ((command & COMMAND_SLIDING_WINDOW_COPY_LENGTH_MASK) >> 2) + 2;
+        } else if (command <= COMMAND_RAW_COPY_END) {
+            size_t length = command & COMMAND_RAW_COPY_LENGTH_MASK;
+
+            if (length > (compressed_size - input_offset)) {
+                return LZKN64_STATUS_TRUNCATED_INPUT;
+            }
+
+            input_offset += length;
+            output_offset += length;
+        } else if (command < COMMAND_RLE_WRITE_SHORT_ANY_VALUE_START) {
+            return LZKN64_STATUS_INVALID_COMMAND;
+        } else if (command <= COMMAND_RLE_WRITE_SHORT_ANY_VALUE_END) {
+            if (input_offset >= compressed_size) {
+                return LZKN64_STATUS_TRUNCATED_INPUT;
+            }
+
+            input_offset++;
+            output_offset += (command & COMMAND_RLE_WRITE_SHORT_ANY_VALUE_LENGTH_MASK) + 2;
+        } else if (command <= COMMAND_RLE_WRITE_SHORT_ZERO_END) {
+            output_offset += (command & COMMAND_RLE_WRITE_SHORT_ZERO_LENGTH_MASK) + 2;
+        } else {
+            if (input_offset >= compressed_size) {
+                return LZKN64_STATUS_TRUNCATED_INPUT;
+            }
+
+            output_offset += (input_buffer[input_offset++] & COMMAND_RLE_WRITE_LONG_ZERO_LENGTH_MASK) + 2;
+        }
+    }
+
+    *output_size = output_offset;
+
+    return LZKN64_STATUS_OK;
+}
+
+size_t lzkn64_compress_bound(size_t input_size) {
+    // The header, all the data as raw copies, and one more raw copy command for when a run of raw data gets split up by
+    // another command (every other command saves at least a byte, which pays for any further splits). The last byte
+    // leaves room for the padding.
+    return 4 + input_size + (input_size + RAW_COPY_MAXIMUM_LENGTH - 1) / RAW_COPY_MAXIMUM_LENGTH + 1 + 1;
+}
+
+enum DecompressStreamState {
+    DECOMPRESS_STREAM_STATE_HEADER,
+    DECOMPRESS_STREAM_STATE_COMMAND,
+    DECOMPRESS_STREAM_STATE_OPERAND,
+    DECOMPRESS_STREAM_STATE_RAW_COPY,
+    DECOMPRESS_STREAM_STATE_SLIDING_WINDOW_COPY,
+    DECOMPRESS_STREAM_STATE_RLE_WRITE,
+    DECOMPRESS_STREAM_STATE_FINISHED,
+};
+
+void lzkn64_decompress_stream_init(struct Lzkn64DecompressStream *stream) {
+    memset(stream, 0, sizeof(struct Lzkn64DecompressStream));
+    stream->state = DECOMPRESS_STREAM_STATE_HEADER;
+}
+
+bool lzkn64_decompress_stream_finished(const struct Lzkn64DecompressStream *stream) {
+    return stream->state == DECOMPRESS_STREAM_STATE_FINISHED;
+}
+
+// Reads the command byte and moves to the state that handles the rest of it.
+static enum Lzkn64Status decompress_stream_start_command(struct Lzkn64DecompressStream *stream, u8 command) {
+    stream->command = command;
+
+    if (command <= COMMAND_SLIDING_WINDOW_COPY_END || (command >= COMMAND_RLE_WRITE_SHORT_ANY_VALUE_START && command <= COMMAND_RLE_WRITE_SHORT_ANY_VALUE_END) || command == COMMAND_RLE_WRITE_LONG_ZERO) {
+        // These commands need one more byte before anything can be written.
+        stream->state = DECOMPRESS_STREAM_STATE_OPERAND;
+    } else if (command >= COMMAND_RAW_COPY_START && command <= COMMAND_RAW_COPY_END) {
+        stream->remaining_length = command & COMMAND_RAW_COPY_LENGTH_MASK;
+        stream->state = DECOMPRESS_STREAM_STATE_RAW_COPY;
+    } else if (command >= COMMAND_RLE_WRITE_SHORT_ZERO_START && command <= COMMAND_RLE_WRITE_SHORT_ZERO_END) {
+        // Add 2 to get the actual length since 2 is the minimum length.
+        stream->remaining_length = (command & COMMAND_RLE_WRITE_SHORT_ZERO_LENGTH_MASK) + 2;
+        stream->value = 0x00;
+        stream->state = DECOMPRESS_STREAM_STATE_RLE_WRITE;
+    } else {
+        return LZKN64_STATUS_INVALID_COMMAND;
+    }
+
+    return LZKN64_STATUS_OK;
+}
+
+static enum Lzkn64Status decompress_stream_read_operand(struct Lzkn64DecompressStream *stream, u8 operand) {
+    u8 command = stream->command;
+
+    if (command <= COMMAND_SLIDING_WINDOW_COPY_END) {
+        stream->offset = (((command & COMMAND_SLIDING_WINDOW_COPY_OFFSET_FIRST_BYTE_MASK) << 8) | operand) & COMMAND_SLIDING_WINDOW_COPY_OFFSET_MAX_MASK;
+
+        // Add 2 to get the actual length since 2 is the minimum length.
+        stream->remaining_length = ((command & COMMAND_SLIDING_WINDOW_COPY_LENGTH_MASK) >> 2) + 2;
+        stream->state = DECOMPRESS_STREAM_STATE_SLIDING_WINDOW_COPY;
+
+        if (stream->offset == 0 || stream->offset > stream->output_offset) {
+            return LZKN64_STATUS_BAD_OFFSET;
+        }
+    } else if (command == COMMAND_RLE_WRITE_LONG_ZERO) {
+        stream->remaining_length = (operand & COMMAND_RLE_WRITE_LONG_ZERO_LENGTH_MASK) + 2;
+        stream->value = 0x00;
+        stream->state = DECOMPRESS_STREAM_STATE_RLE_WRITE;
+    } else {
+        stream->remaining_length = (command & COMMAND_RLE_WRITE_SHORT_ANY_VALUE_LENGTH_MASK) + 2;
+        stream->value = operand;
+        stream->state = DECOMPRESS_STREAM_STATE_RLE_WRITE;
+    }
+
+    return LZKN64_STATUS_OK;
+}
+
+// Appends freshly written output to the history, wrapping around at the end of it.
+static void decompress_stream_record_history(struct Lzkn64DecompressStream *stream, const u8 *data, size_t length) {
+    size_t history_offset = stream->output_offset & LZKN64_HISTORY_MASK;
+
+    // Only the last LZKN64_HISTORY_SIZE bytes can end up in the history.
+    if (length > LZKN64_HISTORY_SIZE) {
+        data += length - LZKN64_HISTORY_SIZE;
+        history_offset = (history_offset + length - LZKN64_HISTORY_SIZE) & LZKN64_HISTORY_MASK;
+        length = LZKN64_HISTORY_SIZE;
+    }
+
+    size_t first_length = LZKN64_HISTORY_SIZE - history_offset;
+
+    if (first_length > length) {
+        first_length = length;
+    }
+
+    memcpy(&stream->history[history_offset], data, first_length);
+    memcpy(stream->history, &data[first_length], length - first_length);
+}
+
+enum Lzkn64Status lzkn64_decompress_stream(struct Lzkn64DecompressStream *stream, const u8 *input_buffer, size_t input_size, size_t *input_consumed, u8 *output_buffer, size_t output_capacity, size_t *output_produced) {
+    enum Lzkn64Status status = LZKN64_STATUS_OK;
+    size_t input_offset = 0;
+    size_t output_offset = 0;
+
+    while (status == LZKN64_STATUS_OK) {
+        if (stream->state == DECOMPRESS_STREAM_STATE_HEADER) {
+            if (input_offset == input_size) {
+                break;
+            }
+
+            stream->header[stream->input_offset++] = input_buffer[input_offset++];
+
+            if (stream->input_offset == 4) {
+                status = read_header(stream->header, 4, &stream->compressed_size);
+
+                // The header only says how much input is still to come, so it can't be checked against it yet.
+                if (status == LZKN64_STATUS_TRUNCATED_INPUT) {
+                    status = LZKN64_STATUS_OK;
+                }
+
+                stream->state = DECOMPRESS_STREAM_STATE_COMMAND;
+            }
+        } else if (stream->state == DECOMPRESS_STREAM_STATE_COMMAND) {
+            if (stream->input_offset == stream->compressed_size) {
+                stream->state = DECOMPRESS_STREAM_STATE_FINISHED;
+            } else if (input_offset == input_size) {
+                break;
+            } else {
+                stream->input_offset++;
+                status = decompress_stream_start_command(stream, input_buffer[input_offset++]);
+            }
+        } else if (stream->state == DECOMPRESS_STREAM_STATE_OPERAND) {
+            if (stream->input_offset == stream->compressed_size) {
+                status = LZKN64_STATUS_TRUNCATED_INPUT;
+            } else if (input_offset == input_size) {
+                break;
+            } else {
+                stream->input_offset++;
+                status = decompress_stream_read_operand(stream, input_buffer[input_offset++]);
+            }
+        } else if (stream->state == DECOMPRESS_STREAM_STATE_FINISHED) {
+            break;
+        } else {
+            if (stream->remaining_length == 0) {
+                stream->state = DECOMPRESS_STREAM_STATE_COMMAND;
+                continue;
+            }
+
+            if (output_offset == output_capacity) {
+                break;
+            }
+
+            size_t length = stream->remaining_length;
+
+            if (length > (output_capacity - output_offset)) {
+                length = output_capacity - output_offset;
+            }
+
+            if (stream->state == DECOMPRESS_STREAM_STATE_RAW_COPY) {
+                if (stream->input_offset == stream->compressed_size) {
+                    status = LZKN64_STATUS_TRUNCATED_INPUT;
+                    break;
+                }
+
+                if (length > (input_size - input_offset)) {
+                    length = input_size - input_offset;
+                }
+
+                if (length > (stream->compressed_size - stream->input_offset)) {
+                    length = stream->compressed_size - stream->input_offset;
+                }
+
+                if (length == 0) {
+                    break;
+                }
+
+                memcpy(&output_buffer[output_offset], &input_buffer[input_offset], length);
+                decompress_stream_record_history(stream, &output_buffer[output_offset], length);
+                input_offset += length;
+                stream->input_offset += length;
+            } else if (stream->state == DECOMPRESS_STREAM_STATE_RLE_WRITE) {
+                memset(&output_buffer[output_offset], stream->value, length);
+                decompress_stream_record_history(stream, &output_buffer[output_offset], length);
+            } else {
+                // The source can be in the history or in what was just written, so go through the history one byte at a time.
+                for (size_t i = 0; i < length; i++) {
+                    u8 value = stream->history[(stream->output_offset + i - stream->offset) & LZKN64_HISTORY_MASK];
+
+                    output_buffer[output_offset + i] = value;
+                    stream->history[(stream->output_offset + i) & LZKN64_HISTORY_MASK] = value;
+                }
+            }
+
+            output_offset += length;
+            stream->output_offset += length;
+            stream->remaining_length -= length;
+        }
+    }
+
+    *input_consumed = input_offset;
+    *output_produced = output_offset;
+
+    return status;
+}
+
+#define INDEX_MAGIC "LZKI"
+
+static void write_u32(u8 *buffer, size_t value) {
+    buffer[0] = (value >> 24) & 0xFF;
+    buffer[1] = (value >> 16) & 0xFF;
+    buffer[2] = (value >> 8) & 0xFF;
+    buffer[3] = value & 0xFF;
+}
+
+static size_t read_u32(const u8 *buffer) {
+    return ((size_t)buffer[0] << 24) | ((size_t)buffer[1] << 16) | ((size_t)buffer[2] << 8) | (size_t)buffer[3];
+}
+
+size_t lzkn64_index_bound(size_t decompressed_size, size_t interval) {
+    if (interval == 0) {
+        return LZKN64_INDEX_HEADER_SIZE;
+    }
+
+    return LZKN64_INDEX_HEADER_SIZE + (decompressed_size / interval) * LZKN64_INDEX_CHECKPOINT_SIZE;
+}
+
+enum Lzkn64Status lzkn64_index_build(const u8 *input_buffer, size_t input_size, const u8 *output_buffer, size_t output_size, size_t interval, u8 *index_buffer, size_t index_capacity, size_t *index_size) {
+    size_t compressed_size = 0;
+    size_t input_offset = 4; // Skip the first 4 bytes since they are the compressed file size.
+    size_t output_offset = 0;
+    size_t checkpoint_count = 0;
+    size_t checkpoint_output_offset = interval;
+
+    *index_size = 0;
+
+    enum Lzkn64Status status = read_header(input_buffer, input_size, &compressed_size);
+    if (status != LZKN64_STATUS_OK) {
+        return status;
+    }
+
+    if (interval == 0 || index_capacity < LZKN64_INDEX_HEADER_SIZE) {
+        return LZKN64_STATUS_OUTPUT_OVERFLOW;
+    }
+
+    // Same walk over the commands as lzkn64_decompressed_size, stopping at the first command boundary of every interval.
+    while (input_offset < compressed_size) {
+        if (output_offset >= checkpoint_output_offset) {
+            u8 *checkpoint = &index_buffer[LZKN64_INDEX_HEADER_SIZE + checkpoint_count * LZKN64_INDEX_CHECKPOINT_SIZE];
+
+            if ((size_t)(checkpoint - index_buffer) + LZKN64_INDEX_CHECKPOINT_SIZE > index_capacity) {
+                return LZKN64_STATUS_OUTPUT_OVERFLOW;
+            }
+
+            if (output_offset > output_size) {
+                return LZKN64_STATUS_INVALID_INDEX;
+            }
+
+            // The history is the output right before the checkpoint, zero filled where the output hasn't started yet.
+            size_t history_length = output_offset < LZKN64_HISTORY_SIZE ? output_offset : LZKN64_HISTORY_SIZE;
+
+            write_u32(&checkpoint[0], input_offset);
+            write_u32(&checkpoint[4], output_offset);
+            memset(&checkpoint[8], 0x00, LZKN64_HISTORY_SIZE - history_length);
+            memcpy(&checkpoint[8 + LZKN64_HISTORY_SIZE - history_length], &output_buffer[output_offset - history_length], history_length);
+
+            // A single command can cover more than one interval, the next checkpoint is in the next one that isn't covered.
+            checkpoint_count++;
+            checkpoint_output_offset = ((output_offset / interval) + 1) * interval;
+        }
+
+        u8 command = input_buffer[input_offset++];
+        size_t operand_size = 0;
+
+        if (command <= COMMAND_SLIDING_WINDOW_COPY_END) {
+            operand_size = 1;
+            output_offset += ((command & COMMAND_SLIDING_WINDOW_COPY_LENGTH_MASK) >> 2) + 2;
+        } else if (command <= COMMAND_RAW_COPY_END) {
+            operand_size = command & COMMAND_RAW_COPY_LENGTH_MASK;
+            output_offset += operand_size;
+        } else if (command < COMMAND_RLE_WRITE_SHORT_ANY_VALUE_START) {
+            return LZKN64_STATUS_INVALID_COMMAND;
+        } else if (command <= COMMAND_RLE_WRITE_SHORT_ANY_VALUE_END) {
+            operand_size = 1;
+            output_offset += (command & COMMAND_RLE_WRITE_SHORT_ANY_VALUE_LENGTH_MASK) + 2;
+        } else if (command <= COMMAND_RLE_WRITE_SHORT_ZERO_END) {
+            output_offset += (command & COMMAND_RLE_WRITE_SHORT_ZERO_LENGTH_MASK) + 2;
+        } else {
+            if (input_offset >= compressed_size) {
+                return LZKN64_STATUS_TRUNCATED_INPUT;
+            }
+
+            output_offset += (input_buffer[input_offset] & COMMAND_RLE_WRITE_LONG_ZERO_LENGTH_MASK) + 2;
+            operand_size = 1;
+        }
+
+        if (operand_size > (compressed_size - input_offset)) {
+            return LZKN64_STATUS_TRUNCATED_INPUT;
+        }
+
+        input_offset += operand_size;
+    }
+
+    // The output has to be the one of this input, or the histories would be wrong.
+    if (output_offset != output_size) {
+        return LZKN64_STATUS_INVALID_INDEX;
+    }
+
+    memcpy(index_buffer, INDEX_MAGIC, 4);
+    write_u32(&index_buffer[4], interval);
+    write_u32(&index_buffer[8], compressed_size);
+    write_u32(&index_buffer[12], output_size);
+    write_u32(&index_buffer[16], checkpoint_count);
+    *index_size = LZKN64_INDEX_HEADER_SIZE + checkpoint_count * LZKN64_INDEX_CHECKPOINT_SIZE;
+
+    return LZKN64_STATUS_OK;
+}
+
+// Checks an index against the input it was made for. Without an index, the size comes from walking the commands.
+static enum Lzkn64Status index_read(const u8 *input_buffer, size_t input_size, const u8 *index_buffer, size_t index_size, size_t *compressed_size, size_t *decompressed_size, size_t *checkpoint_count) {
+    enum Lzkn64Status status = read_header(input_buffer, input_size, compressed_size);
+    if (status != LZKN64_STATUS_OK) {
+        return status;
+    }
+
+    if (index_buffer == NULL) {
+        *checkpoint_count = 0;
+
+        return lzkn64_decompressed_size(input_buffer, input_size, decompressed_size);
+    }
+
+    if (index_size < LZKN64_INDEX_HEADER_SIZE || memcmp(index_buffer, INDEX_MAGIC, 4) != 0 || read_u32(&index_buffer[8]) != *compressed_size) {
+        return LZKN64_STATUS_INVALID_INDEX;
+    }
+
+    *decompressed_size = read_u32(&index_buffer[12]);
+    *checkpoint_count = read_u32(&index_buffer[16]);
+
+    if ((index_size - LZKN64_INDEX_HEADER_SIZE) / LZKN64_INDEX_CHECKPOINT_SIZE != *checkpoint_count) {
+        return LZKN64_STATUS_INVALID_INDEX;
+    }
+
+    return LZKN64_STATUS_OK;
+}
+
+enum Lzkn64Status lzkn64_decompress_range(const u8 *input_buffer, size_t input_size, const u8 *index_buffer, size_t index_size, size_t range_offset, size_t range_size, u8 *output_buffer) {
+    size_t compressed_size = 0;
+    size_t decompressed_size = 0;
+    size_t checkpoint_count = 0;
+
+    enum Lzkn64Status status = index_read(input_buffer, input_size, index_buffer, index_size, &compressed_size, &decompressed_size, &checkpoint_count);
+    if (status != LZKN64_STATUS_OK) {
+        return status;
+    }
+
+    if (range_offset > decompressed_size || range_size > (decompressed_size - range_offset)) {
+        return LZKN64_STATUS_INVALID_RANGE;
+    }
+
+    struct Lzkn64DecompressStream stream;
+    lzkn64_decompress_stream_init(&stream);
+
+    size_t input_offset = 0;
+    size_t low = 0;
+    size_t high = checkpoint_count;
+
+    // Find the last checkpoint at or before the start of the range.
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+
+        if (read_u32(&index_buffer[LZKN64_INDEX_HEADER_SIZE + middle * LZKN64_INDEX_CHECKPOINT_SIZE + 4]) <= range_offset) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    // Resume the stream from the checkpoint as if everything before it had been decompressed already.
+    if (low > 0) {
+        const u8 *checkpoint = &index_buffer[LZKN64_INDEX_HEADER_SIZE + (low - 1) * LZKN64_INDEX_CHECKPOINT_SIZE];
+
+        input_offset = read_u32(&checkpoint[0]);
+
+        if (input_offset < 4 || input_offset > compressed_size) {
+            return LZKN64_STATUS_INVALID_INDEX;
+        }
+
+        stream.state = DECOMPRESS_STREAM_STATE_COMMAND;
+        stream.input_offset = input_offset;
+        stream.output_offset = read_u32(&checkpoint[4]);
+        stream.compressed_size = compressed_size;
+
+        for (size_t i = 0; i < LZKN64_HISTORY_SIZE; i++) {
+            stream.history[(stream.output_offset - LZKN64_HISTORY_SIZE + i) & LZKN64_HISTORY_MASK] = checkpoint[8 + i];
+        }
+    }
+
+    u8 skip_buffer[LZKN64_HISTORY_SIZE];
+    size_t output_offset = 0;
+
+    // Decompress up to the start of the range without keeping anything, then the range itself.
+    while (status == LZKN64_STATUS_OK && (stream.output_offset < range_offset || output_offset < range_size)) {
+        bool skipping = stream.output_offset < range_offset;
+        size_t input_consumed = 0;
+        size_t output_produced = 0;
+        size_t output_capacity = skipping ? range_offset - stream.output_offset : range_size - output_offset;
+
+        if (skipping && output_capacity > sizeof(skip_buffer)) {
+            output_capacity = sizeof(skip_buffer);
+        }
+
+        status = lzkn64_decompress_stream(&stream, &input_buffer[input_offset], input_size - input_offset, &input_consumed, skipping ? skip_buffer : &output_buffer[output_offset], output_capacity, &output_produced);
+        input_offset += input_consumed;
+
+        if (!skipping) {
+            output_offset += output_produced;
+        }
+
+        // The index said there would be more output than the commands hold.
+        if (status == LZKN64_STATUS_OK && output_produced == 0) {
+            status = LZKN64_STATUS_INVALID_INDEX;
+        }
+    }
+
+    return status;
+}
+
+struct DecompressParallelJob {
+    const u8 *input_buffer;
+    size_t input_size;
+    const u8 *index_buffer;
+    size_t index_size;
+    size_t checkpoint_count;
+    size_t decompressed_size;
+    u8 *output_buffer;
+    enum Lzkn64Status *statuses;
+};
+
+static size_t decompress_parallel_segment_start(const struct DecompressParallelJob *job, size_t segment_index) {
+    if (segment_index == 0) {
+        return 0;
+    } else if (segment_index > job->checkpoint_count) {
+        return job->decompressed_size;
+    }
+
+    return read_u32(&job->index_buffer[LZKN64_INDEX_HEADER_SIZE + (segment_index - 1) * LZKN64_INDEX_CHECKPOINT_SIZE + 4]);
+}
+
+static void decompress_parallel_segment(void *context, size_t task_index, size_t thread_index) {
+    struct DecompressParallelJob *job = context;
+    size_t segment_start = decompress_parallel_segment_start(job, task_index);
+    size_t segment_end = decompress_parallel_segment_start(job, task_index + 1);
+
+    (void)thread_index;
+
+    if (segment_end < segment_start || segment_end > job->decompressed_size) {
+        job->statuses[task_index] = LZKN64_STATUS_INVALID_INDEX;
+        return;
+    }
+
+    job->statuses[task_index] = lzkn64_decompress_range(job->input_buffer, job->input_size, job->index_buffer, job->index_size, segment_start, segment_end - segment_start, &job->output_buffer[segment_start]);
+}
+
+enum Lzkn64Status lzkn64_decompress_parallel(const u8 *input_buffer, size_t input_size, const u8 *index_buffer, size_t index_size, u8 *output_buffer, size_t output_capacity, size_t thread_count, size_t *output_size) {
+    size_t compressed_size = 0;
+
+    struct DecompressParallelJob job;
+    job.input_buffer = input_buffer;
+    job.input_size = input_size;
+    job.index_buffer = index_buffer;
+    job.index_size = index_size;
+    job.output_buffer = output_buffer;
+
+    *output_size = 0;
+
+    enum Lzkn64Status status = index_read(input_buffer, input_size, index_buffer, index_size, &compressed_size, &job.decompressed_size, &job.checkpoint_count);
+    if (status != LZKN64_STATUS_OK) {
+        return status;
+    }
+
+    if (job.decompressed_size > output_capacity) {
+        return LZKN64_STATUS_OUTPUT_OVERFLOW;
+    }
+
+    // Without checkpoints there is nothing to split, and the regular decompressor is faster than the stream.
+    if (job.checkpoint_count == 0) {
+        return lzkn64_decompress_safe(input_buffer, input_size, output_buffer, output_capacity, output_size);
+    }
+
+    job.statuses = malloc((job.checkpoint_count + 1) * sizeof(enum Lzkn64Status));
+    if (job.statuses == NULL) {
+        return lzkn64_decompress_safe(input_buffer, input_size, output_buffer, output_capacity, output_size);
+    }
+
+    // Every segment between two checkpoints only needs the history stored with the first one.
+    parallel_for(job.checkpoint_count + 1, thread_count, decompress_parallel_segment, &job);
+
+    for (size_t i = 0; i <= job.checkpoint_count && status == LZKN64_STATUS_OK; i++) {
+        status = job.statuses[i];
+    }
+
+    free(job.statuses);
+
+    if (status == LZKN64_STATUS_OK) {
+        *output_size = job.decompressed_size;
+    }
+
+    return status;
+}
+
+#define COMPRESS_STREAM_BUFFER_SIZE 0x4000
+#define COMPRESS_STREAM_OUTPUT_BUFFER_SIZE 0x400
+
+// Every position needs this many bytes after it to pick the same command as when the whole input is known.
+#define COMPRESS_STREAM_LOOKAHEAD RLE_LONG_MAXIMUM_LENGTH
+
+struct Lzkn64CompressStream {
+    enum Lzkn64CompressionType compression_type;
+    Lzkn64WriteFunction write;
+    void *user_data;
+    struct HashChain hash_chain;
+
+    // Holds the sliding window, the raw data that hasn't been written yet and the lookahead, and gets moved down in steps
+    // of HASH_CHAIN_WINDOW_SIZE bytes so that positions keep their slot in the hash chain.
+    u8 buffer[COMPRESS_STREAM_BUFFER_SIZE];
+    size_t buffer_length;
+
+    // Offsets are relative to the start of the buffer, and the output offset to the start of the output buffer.
+    struct CompressState state;
+
+    u8 output_buffer[COMPRESS_STREAM_OUTPUT_BUFFER_SIZE];
+    size_t output_size; // Everything passed to write so far.
+};
+
+static void compress_stream_flush(struct Lzkn64CompressStream *stream) {
+    if (stream->state.output_offset > 0) {
+        stream->write(stream->user_data, stream->output_buffer, stream->state.output_offset);
+        stream->output_size += stream->state.output_offset;
+        stream->state.output_offset = 0;
+    }
+}
+
+// Compresses positions until fewer than minimum_remaining_size bytes of the buffer are left.
+static ALWAYS_INLINE void compress_stream_run_policy(const struct CompressPolicy policy, struct Lzkn64CompressStream *stream, size_t minimum_remaining_size) {
+    struct CompressState *state = &stream->state;
+
+    while ((stream->buffer_length - state->input_offset) >= minimum_remaining_size) {
+        if (state->output_offset > (COMPRESS_STREAM_OUTPUT_BUFFER_SIZE - COMPRESS_STEP_MAXIMUM_OUTPUT_SIZE)) {
+            compress_stream_flush(stream);
+        }
+
+        compress_step(policy, state, stream->buffer_length, &stream->hash_chain, NULL);
+    }
+}
+
+static void compress_stream_run(struct Lzkn64CompressStream *stream, size_t minimum_remaining_size) {
+    if (stream->compression_type == LZKN64_COMPRESSION_TYPE_ACCURATE) {
+        compress_stream_run_policy(compress_policy_accurate, stream, minimum_remaining_size);
+    } else {
+        compress_stream_run_policy(compress_policy_efficient, stream, minimum_remaining_size);
+    }
+}
+
+// Drops everything before the start of the sliding window or the unwritten raw data from the buffer.
+static void compress_stream_shift(struct Lzkn64CompressStream *stream) {
+    struct CompressState *state = &stream->state;
+    size_t keep_offset = state->input_offset > HASH_CHAIN_WINDOW_SIZE ? state->input_offset - HASH_CHAIN_WINDOW_SIZE : 0;
+
+    if (keep_offset > state->input_last_processed_data_offset) {
+        keep_offset = state->input_last_processed_data_offset;
+    }
+
+    size_t shift = keep_offset & ~(size_t)HASH_CHAIN_WINDOW_MASK;
+
+    if (shift == 0) {
+        return;
+    }
+
+    memmove(stream->buffer, &stream->buffer[shift], stream->buffer_length - shift);
+    stream->buffer_length -= shift;
+    state->input_start += shift;
+    state->input_offset -= shift;
+    state->input_last_processed_data_offset -= shift;
+    state->rle_run_end = state->rle_run_end > shift ? state->rle_run_end - shift : 0;
+
+    // Move the hash chain along with the buffer, anything that falls off the front is out of the window anyway.
+    struct HashChain *hash_chain = &stream->hash_chain;
+
+    for (size_t i = 0; i < HASH_CHAIN_SIZE; i++) {
+        hash_chain->head[i] = (hash_chain->head[i] != HASH_CHAIN_NONE && hash_chain->head[i] >= shift) ? hash_chain->head[i] - (u32)shift : HASH_CHAIN_NONE;
+    }
+
+    for (size_t i = 0; i < HASH_CHAIN_WINDOW_SIZE; i++) {
+        hash_chain->previous[i] = (hash_chain->previous[i] != HASH_CHAIN_NONE && hash_chain->previous[i] >= shift) ? hash_chain->previous[i] - (u32)shift : HASH_CHAIN_NONE;
+    }
+
+    hash_chain->inserted_offset -= shift;
+}
+
+struct Lzkn64CompressStream *lzkn64_compress_stream_create(enum Lzkn64CompressionType compression_type, Lzkn64WriteFunction write, void *user_data) {
+    // The optimal algorithm needs the whole input up front.
+    if (compression_type != LZKN64_COMPRESSION_TYPE_ACCURATE && compression_type != LZKN64_COMPRESSION_TYPE_EFFICIENT) {
+        return NULL;
+    }
+
+    struct Lzkn64CompressStream *stream = malloc(sizeof(struct Lzkn64CompressStream));
+    if (stream == NULL) {
+        return NULL;
+    }
+
+    stream->compression_type = compression_type;
+    stream->write = write;
+    stream->user_data = user_data;
+    hash_chain_init(&stream->hash_chain);
+    memset(stream->hash_chain.previous, 0xFF, sizeof(stream->hash_chain.previous));
+    stream->buffer_length = 0;
+    stream->state.input_buffer = stream->buffer;
+    stream->state.input_start = 0;
+    stream->state.input_offset = 0;
+    stream->state.input_last_processed_data_offset = 0;
+    stream->state.rle_run_end = 0;
+    stream->state.output_buffer = stream->output_buffer;
+    stream->output_size = 0;
+
+    // Leave room for the header, it is only known once the stream is finished.
+    memset(stream->output_buffer, 0x00, 4);
+    stream->state.output_offset = 4;
+
+    return stream;
+}
+
+void lzkn64_compress_stream_write(struct Lzkn64CompressStream *stream, const u8 *input_buffer, size_t input_size) {
+    while (input_size > 0) {
+        if (stream->buffer_length == COMPRESS_STREAM_BUFFER_SIZE) {
+            compress_stream_shift(stream);
+        }
+
+        size_t length = COMPRESS_STREAM_BUFFER_SIZE - stream->buffer_length;
+
+        if (length > input_size) {
+            length = input_size;
+        }
+
+        memcpy(&stream->buffer[stream->buffer_length], input_buffer, length);
+        stream->buffer_length += length;
+        input_buffer += length;
+        input_size -= length;
+
+        // Only positions with the full lookahead behind them can be decided before the end of the input is known.
+        compress_stream_run(stream, COMPRESS_STREAM_LOOKAHEAD);
+    }
+
+    compress_stream_flush(stream);
+}
+
+size_t lzkn64_compress_stream_finish(struct Lzkn64CompressStream *stream, u8 header[4]) {
+    compress_stream_run(stream, 1);
+    compress_stream_flush(stream);
+
+#if defined(LZKN64_STATS)
+    stats_probe_count += stream->hash_chain.probe_count;
+    stream->hash_chain.probe_count = 0;
+#endif
+
+    header[0] = 0x00; // The first byte is always 0x00.
+    header[1] = (stream->output_size >> 16) & 0xFF;
+    header[2] = (stream->output_size >> 8) & 0xFF;
+    header[3] = stream->output_size & 0xFF;
+
+    return stream->output_size;
+}
+
+void lzkn64_compress_stream_destroy(struct Lzkn64CompressStream *stream) {
+    free(stream);
+}
+
+struct Lzkn64Context {
+    size_t thread_count;
+    struct ParallelPool *pool; // Fills the match table when thread_count isn't 1, NULL otherwise.
+    size_t capacity; // Largest input the buffers below can hold.
+    struct MatchTableEntry *match_table;
+    struct OptimalNode *nodes;
+    u16 *pair_match_offsets;
+    u32 pair_positions[OPTIMAL_PAIR_TABLE_SIZE];
+};
+
+// Grows the buffers to hold input_size bytes, they never shrink so inputs up to the largest one so far don't allocate.
+static bool context_reserve(struct Lzkn64Context *context, size_t input_size) {
+    if (context->nodes != NULL && input_size <= context->capacity) {
+        return true;
+    }
+
+    // Each buffer is only replaced once it has been grown, so they all still hold the old capacity if one fails.
+    struct MatchTableEntry *match_table = realloc(context->match_table, (input_size + 1) * sizeof(struct MatchTableEntry));
+    if (match_table == NULL) {
+        return false;
+    }
+
+    context->match_table = match_table;
+
+    u16 *pair_match_offsets = realloc(context->pair_match_offsets, (input_size + 1) * sizeof(u16));
+    if (pair_match_offsets == NULL) {
+        return false;
+    }
+
+    context->pair_match_offsets = pair_match_offsets;
+
+    struct OptimalNode *nodes = realloc(context->nodes, (input_size + 1) * sizeof(struct OptimalNode));
+    if (nodes == NULL) {
+        return false;
+    }
+
+    context->nodes = nodes;
+    context->capacity = input_size;
+
+    return true;
+}
+
+struct Lzkn64Context *lzkn64_context_create(size_t maximum_input_size, size_t thread_count) {
+    struct Lzkn64Context *context = calloc(1, sizeof(struct Lzkn64Context));
+
+    if (context == NULL) {
+        return NULL;
+    }
+
+    context->thread_count = thread_count;
+
+    if (thread_count != 1) {
+        context->pool = parallel_pool_create(thread_count);
+    }
+
+    if ((thread_count != 1 && context->pool == NULL) || !context_reserve(context, maximum_input_size)) {
+        lzkn64_context_destroy(context);
+        return NULL;
+    }
+
+    return context;
+}
+
+void lzkn64_context_destroy(struct Lzkn64Context *context) {
+    if (context == NULL) {
+        return;
+    }
+
+    free(context->match_table);
+    free(context->nodes);
+    free(context->pair_match_offsets);
+    parallel_pool_destroy(context->pool);
+    free(context);
+}
+
+static size_t context_compress(struct Lzkn64Context *context, enum Lzkn64CompressionType compression_type, const u8 *input_buffer, u8 *output_buffer, size_t input_size, struct CompressVerifier *verifier) {
+    // Falls back to what the functions without a context do if the buffers couldn't be grown.
+    if (compression_type == LZKN64_COMPRESSION_TYPE_OPTIMAL) {
+        if (!context_reserve(context, input_size)) {
+            return compress_efficient(input_buffer, output_buffer, input_size, NULL, verifier);
+        }
+
+        struct OptimalScratch scratch;
+        scratch.match_table = context->match_table;
+        scratch.nodes = context->nodes;
+        scratch.pair_match_offsets = context->pair_match_offsets;
+        scratch.pair_positions = context->pair_positions;
+
+        size_t output_size = compress_optimal(input_buffer, output_buffer, input_size, context->thread_count, context->pool, &scratch);
+
+        // The optimal parse only writes its commands at the very end, so they are checked in one go.
+        if (verifier != NULL) {
+            compress_verify_finish(verifier, input_buffer, input_size, output_buffer, output_size);
+        }
+
+        return output_size;
+    }
+
+    bool accurate = compression_type == LZKN64_COMPRESSION_TYPE_ACCURATE;
+    struct MatchTableEntry *match_table = NULL;
+
+    if (context->thread_count != 1 && context_reserve(context, input_size)) {
+        match_table = context->match_table;
+        match_table_fill(match_table, input_buffer, input_size, accurate ? SLIDING_WINDOW_SIZE_ACCURATE : SLIDING_WINDOW_SIZE_EFFICIENT, context->thread_count, context->pool);
+    }
+
+    if (accurate) {
+        return compress_accurate(input_buffer, output_buffer, input_size, match_table, verifier);
+    } else {
+        return compress_efficient(input_buffer, output_buffer, input_size, match_table, verifier);
+    }
+}
+
+size_t lzkn64_context_compress(struct Lzkn64Context *context, enum Lzkn64CompressionType compression_type, const u8 *input_buffer, u8 *output_buffer, size_t input_size) {
+    return context_compress(context, compression_type, input_buffer, output_buffer, input_size, NULL);
+}
+
+enum Lzkn64Status lzkn64_context_compress_verified(struct Lzkn64Context *context, enum Lzkn64CompressionType compression_type, const u8 *input_buffer, u8 *output_buffer, size_t input_size, size_t *output_size, struct Lzkn64Mismatch *mismatch) {
+    struct CompressVerifier verifier;
+    compress_verifier_init(&verifier);
+
+    *output_size = context_compress(context, compression_type, input_buffer, output_buffer, input_size, &verifier);
+
+    // The header check of the verifier would fail as well, this says why.
+    if (*output_size > LZKN64_MAXIMUM_COMPRESSED_SIZE) {
+        return LZKN64_STATUS_OUTPUT_TOO_LARGE;
+    }
+
+    if (verifier.failed) {
+        *mismatch = verifier.mismatch;
+        return LZKN64_STATUS_MISMATCH;
+    }
+
+    return LZKN64_STATUS_OK;
+}
+
+enum Lzkn64Status lzkn64_context_decompress(struct Lzkn64Context *context, const u8 *input_buffer, size_t input_size, u8 *output_buffer, size_t output_capacity, size_t *output_size) {
+    (void)context;
+
+    return lzkn64_decompress_safe(input_buffer, input_size, output_buffer, output_capacity, output_size);
+}
+
+enum Lzkn64Status lzkn64_context_decompressed_size(struct Lzkn64Context *context, const u8 *input_buffer, size_t input_size, size_t *output_size) {
+    (void)context;
+
+    return lzkn64_decompressed_size(input_buffer, input_size, output_size);
+}
+
+void lzkn64_stats_init(struct Lzkn64Stats *stats) {
+    memset(stats, 0, sizeof(struct Lzkn64Stats));
+}
+
+// Bucket n holds the values from 2^n to 2^(n + 1) - 1, values below 2 all go into the first one.
+static void stats_count(size_t *histogram, size_t bucket_count, size_t value) {
+    size_t bucket = 0;
+
+    while ((value >> (bucket + 1)) != 0 && (bucket + 1) < bucket_count) {
+        bucket++;
+    }
+
+    histogram[bucket]++;
+}
+
+enum Lzkn64Status lzkn64_stats_collect(const u8 *input_buffer, size_t input_size, struct Lzkn64Stats *stats) {
+    size_t compressed_size = 0;
+    size_t input_offset = 4; // Skip the first 4 bytes since they are the compressed file size.
+    size_t output_offset = 0;
+
+    enum Lzkn64Status status = read_header(input_buffer, input_size, &compressed_size);
+    if (status != LZKN64_STATUS_OK) {
+        return status;
+    }
+
+    // Same walk over the commands as lzkn64_decompressed_size, so a file that can't be decompressed isn't counted.
+    struct Lzkn64Stats file_stats;
+    lzkn64_stats_init(&file_stats);
+
+    while (input_offset < compressed_size) {
+        u8 command = input_buffer[input_offset++];
+        enum Lzkn64StatsCommand stats_command;
+        size_t operand_size = 0;
+        size_t length = 0;
+
+        if (command <= COMMAND_SLIDING_WINDOW_COPY_END) {
+            if (input_offset >= compressed_size) {
+                return LZKN64_STATUS_TRUNCATED_INPUT;
+            }
+
+            stats_command = LZKN64_STATS_SLIDING_WINDOW_COPY;
+            operand_size = 1;
+            length = ((command & COMMAND_SLIDING_WINDOW_COPY_LENGTH_MASK) >> 2) + 2;
+            stats_count(file_stats.offset_histogram, LZKN64_STATS_OFFSET_BUCKETS, ((command & COMMAND_SLIDING_WINDOW_COPY_OFFSET_FIRST_BYTE_MASK) << 8) | input_buffer[input_offset]);
+        } else if (command <= COMMAND_RAW_COPY_END) {
+            stats_command = LZKN64_STATS_RAW_COPY;
+            operand_size = command & COMMAND_RAW_COPY_LENGTH_MASK;
+            length = operand_size;
+        } else if (command < COMMAND_RLE_WRITE_SHORT_ANY_VALUE_START) {
+            return LZKN64_STATUS_INVALID_COMMAND;
+        } else if (command <= COMMAND_RLE_WRITE_SHORT_ANY_VALUE_END) {
+            stats_command = LZKN64_STATS_RLE_WRITE_SHORT_ANY_VALUE;
+            operand_size = 1;
+            length = (command & COMMAND_RLE_WRITE_SHORT_ANY_VALUE_LENGTH_MASK) + 2;
+        } else if (command <= COMMAND_RLE_WRITE_SHORT_ZERO_END) {
+            stats_command = LZKN64_STATS_RLE_WRITE_SHORT_ZERO;
+            length = (command & COMMAND_RLE_WRITE_SHORT_ZERO_LENGTH_MASK) + 2;
+        } else {
+            if (input_offset >= compressed_size) {
+                return LZKN64_STATUS_TRUNCATED_INPUT;
+            }
+
+            stats_command = LZKN64_STATS_RLE_WRITE_LONG_ZERO;
+            operand_size = 1;
+            length = (input_buffer[input_offset] & COMMAND_RLE_WRITE_LONG_ZERO_LENGTH_MASK) + 2;
+        }
+
+        if (operand_size > (compressed_size - input_offset)) {
+            return LZKN64_STATUS_TRUNCATED_INPUT;
+        }
+
+        file_stats.command_counts[stats_command]++;
+        file_stats.command_compressed_bytes[stats_command] += 1 + operand_size;
+        file_stats.command_decompressed_bytes[stats_command] += length;
+        stats_count(file_stats.length_histograms[stats_command], LZKN64_STATS_LENGTH_BUCKETS, length);
+
+        input_offset += operand_size;
+        output_offset += length;
+    }
+
+    file_stats.file_count = 1;
+    file_stats.compressed_size = compressed_size;
+    file_stats.decompressed_size = output_offset;
+
+    lzkn64_stats_add(stats, &file_stats);
+
+    return LZKN64_STATUS_OK;
+}
+
+void lzkn64_stats_add(struct Lzkn64Stats *total, const struct Lzkn64Stats *stats) {
+    total->file_count += stats->file_count;
+    total->compressed_size += stats->compressed_size;
+    total->decompressed_size += stats->decompressed_size;
+    total->probe_count += stats->probe_count;
+
+    for (size_t i = 0; i < LZKN64_STATS_COMMAND_COUNT; i++) {
+        total->command_counts[i] += stats->command_counts[i];
+        total->command_compressed_bytes[i] += stats->command_compressed_bytes[i];
+        total->command_decompressed_bytes[i] += stats->command_decompressed_bytes[i];
+
+        for (size_t j = 0; j < LZKN64_STATS_LENGTH_BUCKETS; j++) {
+            total->length_histograms[i][j] += stats->length_histograms[i][j];
+        }
+    }
+
+    for (size_t i = 0; i < LZKN64_STATS_OFFSET_BUCKETS; i++) {
+        total->offset_histogram[i] += stats->offset_histogram[i];
+    }
+}
+
+size_t lzkn64_stats_take_probe_count(void) {
+#if defined(LZKN64_STATS)
+    size_t probe_count = stats_probe_count;
+    stats_probe_count = 0;
+
+    return probe_count;
+#else
+    return 0;
+#endif
+}
@@ -45,6 +45,61 @@
 #define RAW_COPY_MAXIMUM_LENGTH 0x1F
 #define RLE_SHORT_MAXIMUM_LENGTH 0x1F + 2
 #define RLE_LONG_MAXIMUM_LENGTH 0xFF + 2
+#define LZKN64_MAXIMUM_COMPRESSED_SIZE 0xFFFFFF // Largest compressed size the 24-bit header can hold.
+
+enum Lzkn64Status {
+    LZKN64_STATUS_OK,
+    LZKN64_STATUS_INVALID_HEADER,
+    LZKN64_STATUS_TRUNCATED_INPUT,
+    LZKN64_STATUS_BAD_OFFSET,
+    LZKN64_STATUS_OUTPUT_OVERFLOW,
+    LZKN64_STATUS_INVALID_COMMAND,
+    LZKN64_STATUS_INVALID_INDEX,
+    LZKN64_STATUS_INVALID_RANGE,
+    LZKN64_STATUS_MISMATCH,
+    LZKN64_STATUS_OUTPUT_TOO_LARGE,
+};
+
+#define LZKN64_HISTORY_SIZE 0x400
+#define LZKN64_HISTORY_MASK (LZKN64_HISTORY_SIZE - 1)
+
+// An index is a header followed by checkpoints, every number in it is a big endian u32 like in the LZKN64 header.
+// Header: "LZKI", interval, compressed size, decompressed size, checkpoint count.
+// Checkpoint: command offset in the compressed data, output offset, then the LZKN64_HISTORY_SIZE bytes of output before it.
+#define LZKN64_INDEX_HEADER_SIZE 20
+#define LZKN64_INDEX_CHECKPOINT_SIZE (8 + LZKN64_HISTORY_SIZE)
+#define LZKN64_INDEX_DEFAULT_INTERVAL 0x4000
+
+// State of a decompression that is fed its input and drains its output in pieces of any size.
+// Only the last LZKN64_HISTORY_SIZE bytes of output are kept, since no sliding window copy can reach further back.
+struct Lzkn64DecompressStream {
+    u8 history[LZKN64_HISTORY_SIZE];
+    u8 header[4];
+    u8 state;
+    u8 command;
+    u8 value;
+    size_t offset;
+    size_t remaining_length;
+    size_t input_offset;
+    size_t output_offset;
+    size_t compressed_size;
+};
+
+enum Lzkn64CompressionType {
+    LZKN64_COMPRESSION_TYPE_ACCURATE,
+    LZKN64_COMPRESSION_TYPE_EFFICIENT,
+    LZKN64_COMPRESSION_TYPE_OPTIMAL,
+};
+
+// Receives compressed data as soon as it is final.
+typedef void (*Lzkn64WriteFunction)(void *user_data, const u8 *data, size_t size);
+
+// State of a compression that is fed its input in pieces of any size, only the sliding window and the lookahead are kept.
+struct Lzkn64CompressStream;
+
+// None of the compression functions can store a compressed size above LZKN64_MAXIMUM_COMPRESSED_SIZE in the header, the
+// header of a larger output is cut off and the output won't decompress. Callers have to reject such outputs, or use
+// lzkn64_context_compress_verified, which does it for them.
 
 // Very slightly more efficient compression algorithm that doesn't match the games exactly.
 size_t lzkn64_compress_efficient(const u8 *input_buffer, u8 *output_buffer, size_t input_size);
@@ -52,6 +107,133 @@ size_t lzkn64_compress_efficient(const u8 *input_buffer, u8 *output_buffer, size
 // Matches the compression algorithm used in the actual games exactly.
 size_t lzkn64_compress_accurate(const u8 *input_buffer, u8 *output_buffer, size_t input_size);
 
+// Same output as the functions above, but the sliding window and RLE searches for every input position are done up front
+// across thread_count threads (0 uses every online processor) before the commands are picked.
+size_t lzkn64_compress_efficient_parallel(const u8 *input_buffer, u8 *output_buffer, size_t input_size, size_t thread_count);
+size_t lzkn64_compress_accurate_parallel(const u8 *input_buffer, u8 *output_buffer, size_t input_size, size_t thread_count);
+
+// Smallest possible output, picks the cheapest sequence of commands for the whole input instead of the locally best one.
+// Doesn't match the games either, and needs about 16 bytes of scratch memory per input byte.
+size_t lzkn64_compress_optimal(const u8 *input_buffer, u8 *output_buffer, size_t input_size);
+size_t lzkn64_compress_optimal_parallel(const u8 *input_buffer, u8 *output_buffer, size_t input_size, size_t thread_count);
+
+// Doesn't do any validation, input_size is trusted over the size in the header and the output buffer has to be large enough.
 size_t lzkn64_decompress(const u8 *input_buffer, u8 *output_buffer, size_t input_size);
 
+// Only decompresses up to the compressed size in the header, and never reads past input_size or writes past output_capacity.
+// Stops at the first invalid command, output_size is set to the number of bytes written either way.
+enum Lzkn64Status lzkn64_decompress_safe(const u8 *input_buffer, size_t input_size, u8 *output_buffer, size_t output_capacity, size_t *output_size);
+
+void lzkn64_decompress_stream_init(struct Lzkn64DecompressStream *stream);
+
+// Consumes as much of the input and fills as much of the output as possible, and returns after running out of either.
+// input_consumed and output_produced are set to how much was used. Input past the compressed size in the header is
+// never consumed, and the same errors as lzkn64_decompress_safe are returned, after which the stream can't continue.
+enum Lzkn64Status lzkn64_decompress_stream(struct Lzkn64DecompressStream *stream, const u8 *input_buffer, size_t input_size, size_t *input_consumed, u8 *output_buffer, size_t output_capacity, size_t *output_produced);
+
+// Returns true once every command up to the compressed size in the header has been written out.
+bool lzkn64_decompress_stream_finished(const struct Lzkn64DecompressStream *stream);
+
+// Only the accurate and efficient algorithms can be streamed, returns NULL for anything else or if out of memory.
+// The first 4 bytes passed to write are a placeholder for the header, which lzkn64_compress_stream_finish returns.
+struct Lzkn64CompressStream *lzkn64_compress_stream_create(enum Lzkn64CompressionType compression_type, Lzkn64WriteFunction write, void *user_data);
+void lzkn64_compress_stream_write(struct Lzkn64CompressStream *stream, const u8 *input_buffer, size_t input_size);
+
+// Writes out everything that is left and fills in the header that has to replace the first 4 bytes of the output,
+// which then matches lzkn64_compress_accurate or lzkn64_compress_efficient byte for byte. Returns the compressed size.
+size_t lzkn64_compress_stream_finish(struct Lzkn64CompressStream *stream, u8 header[4]);
+void lzkn64_compress_stream_destroy(struct Lzkn64CompressStream *stream);
+
+// Returns the exact size lzkn64_decompress_safe would write, by walking the commands without writing anything.
+// Fails on the same malformed input lzkn64_decompress_safe does.
+enum Lzkn64Status lzkn64_decompressed_size(const u8 *input_buffer, size_t input_size, size_t *output_size);
+
+// Largest output any of the compression functions can produce for input_size bytes, including 1 byte of padding.
+size_t lzkn64_compress_bound(size_t input_size);
+
+const char *lzkn64_status_string(enum Lzkn64Status status);
+
+// Largest index lzkn64_index_build can produce for this much output.
+size_t lzkn64_index_bound(size_t decompressed_size, size_t interval);
+
+// Builds an index with a checkpoint at the first command starting in every interval bytes of output, from the compressed
+// input and the output it decompresses to.
+enum Lzkn64Status lzkn64_index_build(const u8 *input_buffer, size_t input_size, const u8 *output_buffer, size_t output_size, size_t interval, u8 *index_buffer, size_t index_capacity, size_t *index_size);
+
+// Decompresses range_size bytes of output starting at range_offset into output_buffer, starting from the closest
+// checkpoint before it. index_buffer can be NULL, which decompresses from the start. As safe as lzkn64_decompress_safe.
+enum Lzkn64Status lzkn64_decompress_range(const u8 *input_buffer, size_t input_size, const u8 *index_buffer, size_t index_size, size_t range_offset, size_t range_size, u8 *output_buffer);
+
+// Decompresses the whole input across thread_count threads (0 uses every online processor), one task per checkpoint.
+enum Lzkn64Status lzkn64_decompress_parallel(const u8 *input_buffer, size_t input_size, const u8 *index_buffer, size_t index_size, u8 *output_buffer, size_t output_capacity, size_t thread_count, size_t *output_size);
+
+// Owns the match table and the scratch memory of the compression functions, so compressing many inputs in a row only
+// allocates when an input is larger than any before it. A context must only be used by one thread at a time.
+struct Lzkn64Context;
+
+// Preallocates for inputs of up to maximum_input_size bytes, 0 leaves it to the first call. thread_count is used like in
+// the parallel functions, with 1 the accurate and efficient algorithms don't need any scratch memory. Otherwise the
+// worker threads are started here and wait between calls until lzkn64_context_destroy, so compressing never starts
+// threads. Returns NULL if out of memory.
+struct Lzkn64Context *lzkn64_context_create(size_t maximum_input_size, size_t thread_count);
+void lzkn64_context_destroy(struct Lzkn64Context *context);
+
+// Same output as the compression function of the given type.
+size_t lzkn64_context_compress(struct Lzkn64Context *context, enum Lzkn64CompressionType compression_type, const u8 *input_buffer, u8 *output_buffer, size_t input_size);
+
+// Where the output of a verified compression first stops decompressing to its input.
+struct Lzkn64Mismatch {
+    size_t input_offset; // First byte of input that isn't reproduced, the input size if the output decodes to more.
+    size_t output_offset; // Offset of the command that should have reproduced it, 0 for a bad header.
+    u8 command; // First byte of that command.
+};
+
+// Same output as lzkn64_context_compress, with every command decoded as soon as it is written and compared with the
+// input, which costs a small part of the compression instead of decompressing the output again. The optimal algorithm
+// writes all of its commands at the end, they are checked then. Returns LZKN64_STATUS_MISMATCH and fills in mismatch if
+// the output doesn't decompress to the input, or LZKN64_STATUS_OUTPUT_TOO_LARGE if its size doesn't fit in the header.
+enum Lzkn64Status lzkn64_context_compress_verified(struct Lzkn64Context *context, enum Lzkn64CompressionType compression_type, const u8 *input_buffer, u8 *output_buffer, size_t input_size, size_t *output_size, struct Lzkn64Mismatch *mismatch);
+
+// Decompression doesn't need any scratch memory, these are lzkn64_decompress_safe and lzkn64_decompressed_size.
+enum Lzkn64Status lzkn64_context_decompress(struct Lzkn64Context *context, const u8 *input_buffer, size_t input_size, u8 *output_buffer, size_t output_capacity, size_t *output_size);
+enum Lzkn64Status lzkn64_context_decompressed_size(struct Lzkn64Context *context, const u8 *input_buffer, size_t input_size, size_t *output_size);
+
+// Commands as counted in the statistics below.
+enum Lzkn64StatsCommand {
+    LZKN64_STATS_SLIDING_WINDOW_COPY,
+    LZKN64_STATS_RAW_COPY,
+    LZKN64_STATS_RLE_WRITE_SHORT_ANY_VALUE,
+    LZKN64_STATS_RLE_WRITE_SHORT_ZERO,
+    LZKN64_STATS_RLE_WRITE_LONG_ZERO,
+    LZKN64_STATS_COMMAND_COUNT,
+};
+
+// Histogram bucket n holds the values from 2^n to 2^(n + 1) - 1, values below 2 all go into the first one.
+#define LZKN64_STATS_LENGTH_BUCKETS 9 // Lengths go up to RLE_LONG_MAXIMUM_LENGTH.
+#define LZKN64_STATS_OFFSET_BUCKETS 10 // Sliding window offsets go up to COMMAND_SLIDING_WINDOW_COPY_OFFSET_MAX_MASK.
+
+// What the commands of one or more compressed files are made of.
+struct Lzkn64Stats {
+    size_t file_count;
+    size_t compressed_size; // Up to the compressed size in the header, without padding.
+    size_t decompressed_size;
+    size_t command_counts[LZKN64_STATS_COMMAND_COUNT];
+    size_t command_compressed_bytes[LZKN64_STATS_COMMAND_COUNT]; // Including operands and raw data.
+    size_t command_decompressed_bytes[LZKN64_STATS_COMMAND_COUNT];
+    size_t length_histograms[LZKN64_STATS_COMMAND_COUNT][LZKN64_STATS_LENGTH_BUCKETS];
+    size_t offset_histogram[LZKN64_STATS_OFFSET_BUCKETS];
+    size_t probe_count; // Match candidates compared while compressing, only counted when built with LZKN64_STATS.
+};
+
+void lzkn64_stats_init(struct Lzkn64Stats *stats);
+
+// Adds the commands of a compressed file to stats. The commands are walked after the fact, so none of this slows down
+// compression. Fails on the same malformed input lzkn64_decompressed_size does, without changing stats.
+enum Lzkn64Status lzkn64_stats_collect(const u8 *input_buffer, size_t input_size, struct Lzkn64Stats *stats);
+void lzkn64_stats_add(struct Lzkn64Stats *total, const struct Lzkn64Stats *stats);
+
+// Returns and resets the number of match candidates compared by compressions called on this thread, including the ones
+// their worker threads compared. Always 0 unless the library was built with LZKN64_STATS.
+size_t lzkn64_stats_take_probe_count(void);
+
 #endif // LZKN64_H
@@ -1,12 +1,27 @@
 #include "main.h"
+#include "batch.h"
+#include "cache.h"
+#include "daemon.h"
 #include "lzkn64.h"
+#include "mapped_file.h"
+#include "pack.h"
+#include "scan.h"
+#include "stats.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+static bool parse_size(const char *text, size_t *value) {
+    char *end;
+    *value = strtoul(text, &end, 0);
+
+    return *text != '\0' && *end == '\0';
+}
 
 bool parse_arguments(int argc, const char *argv[], struct Arguments *arguments) {
-    if (argc < 4) {
+    if (argc < 3) {
         return false;
     }
 
@@ -14,37 +29,505 @@ bool parse_arguments(int argc, const char *argv[], struct Arguments *arguments)
         arguments->mode = MODE_COMPRESS;
     } else if (strcmp(argv[1], "-d") == 0) {
         arguments->mode = MODE_DECOMPRESS;
+    } else if (strcmp(argv[1], "-s") == 0) {
+        arguments->mode = MODE_SCAN;
+    } else if (strcmp(argv[1], "-i") == 0) {
+        arguments->mode = MODE_INDEX;
+    } else if (strcmp(argv[1], "-k") == 0) {
+        arguments->mode = MODE_PACK;
+    } else if (strcmp(argv[1], "-u") == 0) {
+        arguments->mode = MODE_UNPACK;
+    } else if (strcmp(argv[1], "-D") == 0) {
+        arguments->mode = MODE_DAEMON;
+    } else if (strcmp(argv[1], "-Q") == 0) {
+        arguments->mode = MODE_DAEMON_STATUS;
     } else {
         return false;
     }
 
+    // The daemon modes only take the socket path.
+    int first_option = (arguments->mode == MODE_DAEMON || arguments->mode == MODE_DAEMON_STATUS) ? 3 : 4;
+
+    if (argc < first_option) {
+        return false;
+    }
+
     arguments->input_file = argv[2];
-    arguments->output_file = argv[3];
+    arguments->output_file = first_option > 3 ? argv[3] : NULL;
 
-    for (int i = 4; i < argc; i++) {
+    for (int i = first_option; i < argc; i++) {
         if (strcmp(argv[i], "-a") == 0) {
-            arguments->compression_type = COMPRESSION_TYPE_ACCURATE;
+            arguments->compression_type = LZKN64_COMPRESSION_TYPE_ACCURATE;
         } else if (strcmp(argv[i], "-e") == 0) {
-            arguments->compression_type = COMPRESSION_TYPE_EFFICIENT;
+            arguments->compression_type = LZKN64_COMPRESSION_TYPE_EFFICIENT;
+        } else if (strcmp(argv[i], "-o") == 0) {
+            arguments->compression_type = LZKN64_COMPRESSION_TYPE_OPTIMAL;
         } else if (strcmp(argv[i], "-p") == 0) {
             arguments->pad_output = true;
+        } else if (strcmp(argv[i], "-b") == 0) {
+            arguments->batch = true;
+        } else if (strcmp(argv[i], "-t") == 0 && (i + 1) < argc) {
+            if (!parse_size(argv[++i], &arguments->thread_count)) {
+                return false;
+            }
+
+            arguments->thread_count_set = true;
+        } else if (strcmp(argv[i], "-A") == 0 && (i + 1) < argc) {
+            if (!parse_size(argv[++i], &arguments->scan_alignment) || arguments->scan_alignment == 0) {
+                return false;
+            }
+        } else if (strcmp(argv[i], "-m") == 0 && (i + 1) < argc) {
+            if (!parse_size(argv[++i], &arguments->scan_minimum_size)) {
+                return false;
+            }
+        } else if (strcmp(argv[i], "-C") == 0 && (i + 1) < argc) {
+            arguments->cache_directory = argv[++i];
+        } else if (strcmp(argv[i], "-M") == 0 && (i + 1) < argc) {
+            if (!parse_size(argv[++i], &arguments->cache_maximum_size)) {
+                return false;
+            }
+        } else if (strcmp(argv[i], "-V") == 0) {
+            arguments->cache_verify = true;
+        } else if (strcmp(argv[i], "-x") == 0 && (i + 1) < argc) {
+            arguments->index_file = argv[++i];
+        } else if (strcmp(argv[i], "-I") == 0 && (i + 1) < argc) {
+            if (!parse_size(argv[++i], &arguments->index_interval) || arguments->index_interval == 0) {
+                return false;
+            }
+        } else if (strcmp(argv[i], "-O") == 0 && (i + 1) < argc) {
+            if (!parse_size(argv[++i], &arguments->range_offset)) {
+                return false;
+            }
+
+            arguments->range_set = true;
+        } else if (strcmp(argv[i], "-L") == 0 && (i + 1) < argc) {
+            if (!parse_size(argv[++i], &arguments->range_length)) {
+                return false;
+            }
+
+            arguments->range_set = true;
+        } else if (strcmp(argv[i], "-S") == 0) {
+            arguments->stats = true;
+        } else if (strcmp(argv[i], "-J") == 0 && (i + 1) < argc) {
+            arguments->stats_json_file = argv[++i];
+        } else if (strcmp(argv[i], "-f") == 0 && (i + 1) < argc) {
+            if (!parse_size(argv[++i], &arguments->fit_size) || arguments->fit_size == 0) {
+                return false;
+            }
+        } else if (strcmp(argv[i], "-F") == 0 && (i + 1) < argc) {
+            arguments->fit_file = argv[++i];
+        } else if (strcmp(argv[i], "-X") == 0 && (i + 1) < argc) {
+            arguments->daemon_socket = argv[++i];
+        } else if (strcmp(argv[i], "-n") == 0 && (i + 1) < argc) {
+            arguments->pack_entry_name = argv[++i];
+        } else if (strcmp(argv[i], "-z") == 0) {
+            arguments->pack_decompress = true;
+        } else if (strcmp(argv[i], "-v") == 0) {
+            arguments->verify = true;
         } else {
             return false;
         }
     }
 
+    // Fitting is only done for a single file.
+    if ((arguments->fit_size != 0 || arguments->fit_file != NULL) && (arguments->mode != MODE_COMPRESS || arguments->batch)) {
+        return false;
+    }
+
     return true;
 }
 
+enum Lzkn64Status compress_buffer(const struct Arguments *arguments, struct Lzkn64Context *context, const u8 *input_buffer, u8 *output_buffer, size_t input_size, size_t *output_size, struct Lzkn64Mismatch *mismatch) {
+    enum Lzkn64Status status = LZKN64_STATUS_OK;
+
+    if (arguments->verify) {
+        status = lzkn64_context_compress_verified(context, arguments->compression_type, input_buffer, output_buffer, input_size, output_size, mismatch);
+    } else {
+        *output_size = lzkn64_context_compress(context, arguments->compression_type, input_buffer, output_buffer, input_size);
+
+        if (*output_size > LZKN64_MAXIMUM_COMPRESSED_SIZE) {
+            status = LZKN64_STATUS_OUTPUT_TOO_LARGE;
+        }
+    }
+
+    if (status == LZKN64_STATUS_OK && arguments->pad_output && (*output_size & 1) != 0) {
+        output_buffer[(*output_size)++] = 0x00;
+    }
+
+    return status;
+}
+
+void format_compress_error(enum Lzkn64Status status, const struct Lzkn64Mismatch *mismatch, char *text, size_t text_capacity) {
+    if (status == LZKN64_STATUS_MISMATCH) {
+        snprintf(text, text_capacity, "output doesn't decompress to the input from input offset 0x%zX, command 0x%02X at output offset 0x%zX", mismatch->input_offset, mismatch->command, mismatch->output_offset);
+    } else {
+        snprintf(text, text_capacity, "%s", lzkn64_status_string(status));
+    }
+}
+
+f64 get_time(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+
+    return (f64)time.tv_sec + (f64)time.tv_nsec / 1e9;
+}
+
+#define STREAM_BUFFER_SIZE 0x10000
+
+// Decompresses through a fixed size buffer, so memory use doesn't depend on the size of the file. Used for stdin/stdout.
+static int decompress_stream_file(const struct Arguments *arguments) {
+    FILE *input_file = strcmp(arguments->input_file, "-") == 0 ? stdin : fopen(arguments->input_file, "rb");
+    if (input_file == NULL) {
+        fprintf(stderr, "Error: Could not open input file.\n");
+        return EXIT_FAILURE;
+    }
+
+    FILE *output_file = strcmp(arguments->output_file, "-") == 0 ? stdout : fopen(arguments->output_file, "wb");
+    if (output_file == NULL) {
+        fprintf(stderr, "Error: Could not open output file.\n");
+        return EXIT_FAILURE;
+    }
+
+    static u8 input_buffer[STREAM_BUFFER_SIZE];
+    static u8 output_buffer[STREAM_BUFFER_SIZE];
+    struct Lzkn64DecompressStream stream;
+    enum Lzkn64Status status = LZKN64_STATUS_OK;
+
+    lzkn64_decompress_stream_init(&stream);
+
+    while (status == LZKN64_STATUS_OK && !lzkn64_decompress_stream_finished(&stream)) {
+        size_t input_size = fread(input_buffer, 1, sizeof(input_buffer), input_file);
+        size_t input_offset = 0;
+
+        if (input_size == 0) {
+            status = LZKN64_STATUS_TRUNCATED_INPUT;
+            break;
+        }
+
+        // Keep draining the output until all of this input has been used, or the end of the stream was reached.
+        do {
+            size_t input_consumed = 0;
+            size_t output_produced = 0;
+
+            status = lzkn64_decompress_stream(&stream, &input_buffer[input_offset], input_size - input_offset, &input_consumed, output_buffer, sizeof(output_buffer), &output_produced);
+            input_offset += input_consumed;
+
+            if (fwrite(output_buffer, 1, output_produced, output_file) != output_produced) {
+                fprintf(stderr, "Error: Could not write output file.\n");
+                return EXIT_FAILURE;
+            }
+
+            if (output_produced == 0 && input_consumed == 0) {
+                break;
+            }
+        } while (status == LZKN64_STATUS_OK && !lzkn64_decompress_stream_finished(&stream));
+    }
+
+    if (status != LZKN64_STATUS_OK) {
+        fprintf(stderr, "Error: Could not decompress input file (%s).\n", lzkn64_status_string(status));
+        return EXIT_FAILURE;
+    }
+
+    if ((output_file != stdout && fclose(output_file) != 0) || (output_file == stdout && fflush(stdout) != 0)) {
+        fprintf(stderr, "Error: Could not write output file.\n");
+        return EXIT_FAILURE;
+    }
+
+    if (input_file != stdin) {
+        fclose(input_file);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// Collects the compressed data for compress_stream_file, either straight into the output file or in memory if the
+// output can't be seeked back to for the header.
+struct CompressStreamSink {
+    FILE *file;
+    u8 *buffer;
+    size_t length;
+    size_t capacity;
+    bool failed;
+};
+
+static void compress_stream_sink_write(void *user_data, const u8 *data, size_t size) {
+    struct CompressStreamSink *sink = user_data;
+
+    if (sink->buffer == NULL) {
+        sink->failed |= fwrite(data, 1, size, sink->file) != size;
+        return;
+    }
+
+    if ((sink->length + size) > sink->capacity) {
+        size_t capacity = sink->capacity * 2 > (sink->length + size) ? sink->capacity * 2 : (sink->length + size);
+        u8 *buffer = realloc(sink->buffer, capacity);
+
+        if (buffer == NULL) {
+            sink->failed = true;
+            return;
+        }
+
+        sink->buffer = buffer;
+        sink->capacity = capacity;
+    }
+
+    memcpy(&sink->buffer[sink->length], data, size);
+    sink->length += size;
+}
+
+// Compresses through a fixed size buffer, so memory use doesn't depend on the size of the file. Used for stdin/stdout.
+static int compress_stream_file(const struct Arguments *arguments) {
+    FILE *input_file = strcmp(arguments->input_file, "-") == 0 ? stdin : fopen(arguments->input_file, "rb");
+    if (input_file == NULL) {
+        fprintf(stderr, "Error: Could not open input file.\n");
+        return EXIT_FAILURE;
+    }
+
+    FILE *output_file = strcmp(arguments->output_file, "-") == 0 ? stdout : fopen(arguments->output_file, "wb");
+    if (output_file == NULL) {
+        fprintf(stderr, "Error: Could not open output file.\n");
+        return EXIT_FAILURE;
+    }
+
+    struct CompressStreamSink sink;
+    sink.file = output_file;
+    sink.buffer = NULL;
+    sink.length = 0;
+    sink.capacity = 0;
+    sink.failed = false;
+
+    // stdout can't be seeked back to for the header, so hold on to the output until the header is known.
+    if (output_file == stdout) {
+        sink.capacity = STREAM_BUFFER_SIZE;
+        sink.buffer = malloc(sink.capacity);
+
+        if (sink.buffer == NULL) {
+            fprintf(stderr, "Error: Could not allocate memory for output buffer.\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    struct Lzkn64CompressStream *stream = lzkn64_compress_stream_create(arguments->compression_type, compress_stream_sink_write, &sink);
+    if (stream == NULL) {
+        fprintf(stderr, "Error: Could not start compressing, only accurate and efficient compression can be streamed.\n");
+        return EXIT_FAILURE;
+    }
+
+    static u8 input_buffer[STREAM_BUFFER_SIZE];
+    size_t input_size;
+    size_t total_input_size = 0;
+
+    while ((input_size = fread(input_buffer, 1, sizeof(input_buffer), input_file)) > 0) {
+        total_input_size += input_size;
+
+        if (total_input_size > LZKN64_MAXIMUM_FILE_SIZE) {
+            break;
+        }
+
+        lzkn64_compress_stream_write(stream, input_buffer, input_size);
+    }
+
+    u8 header[4];
+    size_t output_size = lzkn64_compress_stream_finish(stream, header);
+    lzkn64_compress_stream_destroy(stream);
+
+    // The header only has 24 bits for the size, so nothing is written for a file that is too large.
+    if (total_input_size > LZKN64_MAXIMUM_FILE_SIZE || output_size > LZKN64_MAXIMUM_COMPRESSED_SIZE) {
+        fprintf(stderr, "Error: Input file is too large, the compressed size has to fit in 24 bits.\n");
+        free(sink.buffer);
+
+        if (output_file != stdout) {
+            fclose(output_file);
+            remove(arguments->output_file);
+        }
+
+        return EXIT_FAILURE;
+    }
+
+    if (arguments->pad_output && (output_size & 1) != 0) {
+        const u8 padding = 0x00;
+        compress_stream_sink_write(&sink, &padding, 1);
+    }
+
+    if (sink.buffer != NULL) {
+        if (!sink.failed) {
+            memcpy(sink.buffer, header, sizeof(header));
+            sink.failed |= fwrite(sink.buffer, 1, sink.length, output_file) != sink.length;
+        }
+
+        free(sink.buffer);
+    } else if (!sink.failed) {
+        sink.failed |= fseek(output_file, 0, SEEK_SET) != 0 || fwrite(header, 1, sizeof(header), output_file) != sizeof(header);
+    }
+
+    if (sink.failed || ferror(input_file) || (output_file != stdout && fclose(output_file) != 0) || (output_file == stdout && fflush(stdout) != 0)) {
+        fprintf(stderr, "Error: Could not compress input file.\n");
+        return EXIT_FAILURE;
+    }
+
+    if (input_file != stdin) {
+        fclose(input_file);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// Size of the slot a compressed file takes up: the compressed size in its header, rounded up like -p does.
+static bool read_fit_size(struct Arguments *arguments) {
+    struct MappedFile fit_file;
+    if (!mapped_file_open(&fit_file, arguments->fit_file, false)) {
+        return false;
+    }
+
+    bool successful = fit_file.size >= 4 && fit_file.data[0] == 0x00;
+
+    if (successful) {
+        arguments->fit_size = ((size_t)fit_file.data[1] << 16) | ((size_t)fit_file.data[2] << 8) | (size_t)fit_file.data[3];
+
+        if (arguments->pad_output && (arguments->fit_size & 1) != 0) {
+            arguments->fit_size++;
+        }
+    }
+
+    mapped_file_close(&fit_file);
+
+    return successful;
+}
+
+// Tries every compression type from the selected one up to optimal, each one slower but usually smaller than the one
+// before, and stops at the first output that fits in arguments->fit_size bytes. A type whose output fails to compress
+// or verify is skipped. output_size is the size of the last output, returns the status of the last compress_buffer.
+static enum Lzkn64Status compress_fit(const struct Arguments *arguments, struct Lzkn64Context *context, const u8 *input_buffer, u8 *output_buffer, size_t input_size, size_t *output_size, struct Lzkn64Mismatch *mismatch) {
+    static const char *compression_type_names[] = { "accurate", "efficient", "optimal" };
+    FILE *report_file = strcmp(arguments->output_file, "-") == 0 ? stderr : stdout;
+    struct Arguments fit_arguments = *arguments;
+    enum Lzkn64Status status = LZKN64_STATUS_OK;
+    f64 start_time = get_time();
+
+    for (size_t compression_type = arguments->compression_type; compression_type <= LZKN64_COMPRESSION_TYPE_OPTIMAL; compression_type++) {
+        fit_arguments.compression_type = (enum Lzkn64CompressionType)compression_type;
+
+        status = compress_buffer(&fit_arguments, context, input_buffer, output_buffer, input_size, output_size, mismatch);
+        if (status != LZKN64_STATUS_OK) {
+            char text[256];
+            format_compress_error(status, mismatch, text, sizeof(text));
+
+            fprintf(report_file, "Fit: %s compression failed after %.3f s (%s).\n", compression_type_names[compression_type], get_time() - start_time, text);
+            fflush(report_file);
+            continue;
+        }
+
+        fprintf(report_file, "Fit: %s compression, %zu of %zu bytes after %.3f s.\n", compression_type_names[compression_type], *output_size, arguments->fit_size, get_time() - start_time);
+        fflush(report_file);
+
+        if (*output_size <= arguments->fit_size) {
+            break;
+        }
+    }
+
+    return status;
+}
+
+// Decompresses the input once to build an index of it, which lets -d start decompressing from the middle of it.
+static int index_file_run(const struct Arguments *arguments) {
+    struct MappedFile input_file;
+    if (!mapped_file_open(&input_file, arguments->input_file, false)) {
+        fprintf(stderr, "Error: Could not read input file.\n");
+        return EXIT_FAILURE;
+    }
+
+    size_t decompressed_size = 0;
+
+    enum Lzkn64Status status = lzkn64_decompressed_size(input_file.data, input_file.size, &decompressed_size);
+    if (status != LZKN64_STATUS_OK) {
+        fprintf(stderr, "Error: Could not decompress input file (%s).\n", lzkn64_status_string(status));
+        return EXIT_FAILURE;
+    }
+
+    u8 *decompressed_buffer = malloc(decompressed_size + 1);
+    if (decompressed_buffer == NULL) {
+        fprintf(stderr, "Error: Could not allocate memory for decompressed buffer.\n");
+        return EXIT_FAILURE;
+    }
+
+    status = lzkn64_decompress_safe(input_file.data, input_file.size, decompressed_buffer, decompressed_size, &decompressed_size);
+    if (status != LZKN64_STATUS_OK) {
+        fprintf(stderr, "Error: Could not decompress input file (%s).\n", lzkn64_status_string(status));
+        return EXIT_FAILURE;
+    }
+
+    struct MappedFile output_file;
+    size_t index_capacity = lzkn64_index_bound(decompressed_size, arguments->index_interval);
+
+    if (!mapped_file_create(&output_file, arguments->output_file, index_capacity)) {
+        fprintf(stderr, "Error: Could not open output file.\n");
+        return EXIT_FAILURE;
+    }
+
+    status = lzkn64_index_build(input_file.data, input_file.size, decompressed_buffer, decompressed_size, arguments->index_interval, output_file.data, index_capacity, &output_file.size);
+    free(decompressed_buffer);
+    mapped_file_close(&input_file);
+
+    if (status != LZKN64_STATUS_OK) {
+        fprintf(stderr, "Error: Could not build index (%s).\n", lzkn64_status_string(status));
+        return EXIT_FAILURE;
+    }
+
+    if (!mapped_file_close(&output_file)) {
+        fprintf(stderr, "Error: Could not write output file.\n");
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
 void print_help(void) {
-    printf("Usage: lzkn64 [-c|-d] <input_file> <output_file> [-a|-e] [-p]\n");
+    printf("Usage: lzkn64 [-c|-d] <input_file> <output_file> [-a|-e|-o] [-p] [-t <threads>] [-f <bytes>|-F <compressed_file>] [-v] [-S] [-J <json_file>]\n");
+    printf("       lzkn64 [-c|-d] <input_directory|manifest_file> <output_directory> -b [-a|-e|-o] [-p] [-t <threads>] [-C <cache_directory> [-M <bytes>] [-V]] [-v] [-S] [-J <json_file>]\n");
+    printf("       lzkn64 -d <input_file> <output_file> [-x <index_file> [-t <threads>]] [-O <offset>] [-L <length>]\n");
+    printf("       lzkn64 -i <input_file> <index_file> [-I <interval>]\n");
+    printf("       lzkn64 -s <rom_file> <output_directory> [-A <alignment>] [-m <minimum_size>] [-t <threads>]\n");
+    printf("       lzkn64 -k <input_directory|manifest_file> <pack_file> [-t <threads>]\n");
+    printf("       lzkn64 -u <pack_file> <output_directory|output_file> [-n <name>] [-z] [-t <threads>]\n");
+    printf("       lzkn64 -D <socket_path> [-t <threads>]\n");
+    printf("       lzkn64 -Q <socket_path>\n");
     printf("Compress or decompress a file using lzkn64.\n");
     printf("\n");
-    printf("  -c  Compress the input file.\n");
-    printf("  -d  Decompress the input file.\n");
+    printf("  -c  Compress the input file, - reads from stdin or writes to stdout.\n");
+    printf("  -d  Decompress the input file, - reads from stdin or writes to stdout.\n");
+    printf("  -i  Build an index of the compressed input file, for decompressing parts of it with -x.\n");
+    printf("  -s  Find every LZKN64 file in a ROM image and decompress them into the output directory.\n");
+    printf("  -k  Store every compressed file in the input directory, or listed in the manifest file, unchanged in one pack file.\n");
+    printf("  -u  Extract every file in the pack into the output directory, or with -n only that one into the output file.\n");
+    printf("  -D  Serve compression and decompression from this many worker threads on a Unix domain socket (default all cores).\n");
+    printf("  -Q  Print the request counts, latencies and throughput of the daemon on this socket.\n");
     printf("  -a  Use accurate compression (default).\n");
     printf("  -e  Use efficient compression.\n");
+    printf("  -o  Use optimal compression (smallest output, slower).\n");
     printf("  -p  Pad the output file to the nearest 2-byte boundary.\n");
+    printf("  -b  Process every file in the input directory, or every path listed in the manifest file, into the output directory.\n");
+    printf("  -t  Search for matches on this many threads when compressing (0 = all cores, default 1).\n");
+    printf("      With -b or -s, process this many files at once instead (0 = all cores, default all cores).\n");
+    printf("  -C  With -b, reuse the output for inputs compressed before with the same settings, kept in this directory.\n");
+    printf("  -M  Delete the least recently used cache entries above this many bytes in total (default 1 GB).\n");
+    printf("  -V  Check that cached output decompresses to the input before using it.\n");
+    printf("  -x  Decompress using this index, split across the threads given with -t.\n");
+    printf("  -I  Put a checkpoint in the index every this many bytes of output (default 16 KB).\n");
+    printf("  -O  Only decompress the output starting at this offset, from the closest checkpoint before it with -x.\n");
+    printf("  -L  Only decompress this many bytes of output (default up to the end).\n");
+    printf("  -f  Make the output fit in this many bytes, trying accurate, efficient then optimal compression until it does.\n");
+    printf("      Starts from the compression selected with -a, -e or -o.\n");
+    printf("  -F  Same as -f, with the slot of this compressed file: its compressed size, rounded up with -p.\n");
+    printf("  -X  Send -c or -d to the daemon on this socket, done here if none is listening (default $LZKN64_DAEMON).\n");
+    printf("  -n  With -u, only extract the file with this name, looked up without reading any other.\n");
+    printf("  -z  With -u, decompress the files while extracting them.\n");
+    printf("  -v  Check every command against the input as it is compressed, and fail without output if any doesn't match, cached outputs are checked as well.\n");
+    printf("      Always on in LZKN64_ALWAYS_VERIFY builds.\n");
+    printf("  -S  Print what the commands of every compressed file are made of, and with LZKN64_STATS builds how many match\n");
+    printf("      candidates were compared per byte.\n");
+    printf("  -J  Write the same statistics as JSON to this file.\n");
+    printf("  -A  Only look for files starting at multiples of this many bytes when scanning (default 2).\n");
+    printf("  -m  Ignore files with a compressed size below this when scanning (default 8).\n");
 }
 
 int main(int argc, const char *argv[]) {
@@ -52,85 +535,242 @@ int main(int argc, const char *argv[]) {
     arguments.mode = MODE_UNDEFINED;
     arguments.input_file = NULL;
     arguments.output_file = NULL;
-    arguments.compression_type = COMPRESSION_TYPE_ACCURATE;
+    arguments.compression_type = LZKN64_COMPRESSION_TYPE_ACCURATE;
     arguments.pad_output = false;
+    arguments.thread_count = 1;
+    arguments.thread_count_set = false;
+    arguments.batch = false;
+    arguments.scan_alignment = 2;
+    arguments.scan_minimum_size = 8;
+    arguments.cache_directory = NULL;
+    arguments.cache_maximum_size = CACHE_DEFAULT_MAXIMUM_SIZE;
+    arguments.cache_verify = false;
+    arguments.index_file = NULL;
+    arguments.index_interval = LZKN64_INDEX_DEFAULT_INTERVAL;
+    arguments.range_offset = 0;
+    arguments.range_length = SIZE_MAX;
+    arguments.range_set = false;
+    arguments.stats = false;
+    arguments.stats_json_file = NULL;
+    arguments.fit_size = 0;
+    arguments.fit_file = NULL;
+    arguments.daemon_socket = getenv("LZKN64_DAEMON");
+    arguments.pack_entry_name = NULL;
+    arguments.pack_decompress = false;
+#if defined(LZKN64_ALWAYS_VERIFY)
+    arguments.verify = true;
+#else
+    arguments.verify = false;
+#endif
 
     if (!parse_arguments(argc, argv, &arguments)) {
         print_help();
         return EXIT_FAILURE;
     }
 
-    FILE *input_file = fopen(arguments.input_file, "rb");
-    if (input_file == NULL) {
-        printf("Error: Could not open input file.\n");
-        return EXIT_FAILURE;
+    if (arguments.batch) {
+        return batch_run(&arguments);
     }
 
-    fseek(input_file, 0, SEEK_END);
-    size_t input_size = ftell(input_file);
-    fseek(input_file, 0, SEEK_SET);
+    if (arguments.mode == MODE_SCAN) {
+        return scan_run(&arguments);
+    }
 
-    u8 *input_buffer = malloc(input_size);
-    if (input_buffer == NULL) {
-        printf("Error: Could not allocate memory for input buffer.\n");
-        return EXIT_FAILURE;
+    if (arguments.mode == MODE_INDEX) {
+        return index_file_run(&arguments);
+    }
+
+    if (arguments.mode == MODE_PACK) {
+        return pack_run(&arguments);
+    }
+
+    if (arguments.mode == MODE_UNPACK) {
+        return unpack_run(&arguments);
+    }
+
+    if (arguments.mode == MODE_DAEMON) {
+        return daemon_run(&arguments);
+    }
+
+    if (arguments.mode == MODE_DAEMON_STATUS) {
+        return daemon_status_run(&arguments);
     }
 
-    if (fread(input_buffer, 1, input_size, input_file) != input_size) {
-        printf("Error: Could not read input file.\n");
+    if (arguments.fit_file != NULL && !read_fit_size(&arguments)) {
+        fprintf(stderr, "Error: Could not read the compressed size of %s.\n", arguments.fit_file);
         return EXIT_FAILURE;
     }
 
-    fclose(input_file);
+    bool report_stats = arguments.stats || arguments.stats_json_file != NULL;
+    int exit_code;
+
+    // The daemon only does plain compression and decompression of a single file.
+    if (arguments.daemon_socket != NULL && arguments.daemon_socket[0] != '\0' && arguments.index_file == NULL && !arguments.range_set && !report_stats && arguments.fit_size == 0 && daemon_client_run(&arguments, &exit_code)) {
+        return exit_code;
+    }
+
+    // An index, a range, the statistics, fitting or verifying need the whole input at once, so those are never streamed.
+    bool streamed = (strcmp(arguments.input_file, "-") == 0 || strcmp(arguments.output_file, "-") == 0) && arguments.index_file == NULL && !arguments.range_set && !report_stats && arguments.fit_size == 0 && !(arguments.verify && arguments.mode == MODE_COMPRESS);
+    struct Lzkn64Stats stats;
 
-    size_t output_size;
-    u8 *output_buffer;
+    lzkn64_stats_init(&stats);
+
+    // Pipes are streamed through fixed size buffers, only the optimal algorithm has to see the whole input first.
+    if (streamed && arguments.mode == MODE_DECOMPRESS) {
+        return decompress_stream_file(&arguments);
+    } else if (streamed && arguments.compression_type != LZKN64_COMPRESSION_TYPE_OPTIMAL) {
+        return compress_stream_file(&arguments);
+    }
+
+    // Creating the output file would cut off a mapped input if both are the same file.
+    struct MappedFile input_file;
+    if (!mapped_file_open(&input_file, arguments.input_file, mapped_file_same(arguments.input_file, arguments.output_file))) {
+        fprintf(stderr, "Error: Could not read input file.\n");
+        return EXIT_FAILURE;
+    }
+
+    // The output is written straight into the mapped output file, or buffered for stdout.
+    struct MappedFile output_file;
 
     if (arguments.mode == MODE_COMPRESS) {
-        // Allocate maximum possible size for compressed file since we don't know the exact size yet.
-        output_buffer = malloc(LZKN64_MAXIMUM_FILE_SIZE);
-        if (output_buffer == NULL) {
-            printf("Error: Could not allocate memory for output buffer.\n");
+        if (input_file.size > LZKN64_MAXIMUM_FILE_SIZE) {
+            fprintf(stderr, "Error: Input file is too large, the compressed size has to fit in 24 bits.\n");
             return EXIT_FAILURE;
         }
 
-        if (arguments.compression_type == COMPRESSION_TYPE_ACCURATE) {
-            output_size = lzkn64_compress_accurate(input_buffer, output_buffer, input_size);
-        } else if (arguments.compression_type == COMPRESSION_TYPE_EFFICIENT) {
-            output_size = lzkn64_compress_efficient(input_buffer, output_buffer, input_size);
+        // Make room for the largest size the compressed file can have, the file is cut down to the real size afterwards.
+        if (!mapped_file_create(&output_file, arguments.output_file, lzkn64_compress_bound(input_file.size))) {
+            fprintf(stderr, "Error: Could not open output file.\n");
+            return EXIT_FAILURE;
+        }
+
+        struct Lzkn64Context *context = lzkn64_context_create(0, arguments.thread_count);
+        if (context == NULL) {
+            fprintf(stderr, "Error: Could not allocate memory for compression.\n");
+            return EXIT_FAILURE;
+        }
+
+        struct Lzkn64Mismatch mismatch;
+        enum Lzkn64Status status;
+
+        lzkn64_stats_take_probe_count();
+
+        if (arguments.fit_size != 0) {
+            status = compress_fit(&arguments, context, input_file.data, output_file.data, input_file.size, &output_file.size, &mismatch);
+        } else {
+            status = compress_buffer(&arguments, context, input_file.data, output_file.data, input_file.size, &output_file.size, &mismatch);
+        }
+
+        lzkn64_context_destroy(context);
+
+        // Nothing that doesn't decompress is left behind.
+        if (status != LZKN64_STATUS_OK) {
+            char text[256];
+            format_compress_error(status, &mismatch, text, sizeof(text));
+
+            fprintf(stderr, "Error: Could not compress input file (%s).\n", text);
+            mapped_file_close(&output_file);
+
+            if (strcmp(arguments.output_file, "-") != 0) {
+                remove(arguments.output_file);
+            }
+
+            return EXIT_FAILURE;
+        }
+
+        if (output_file.size > arguments.fit_size && arguments.fit_size != 0) {
+            fprintf(stderr, "Error: Could not fit the input file in %zu bytes, the optimal output is %zu bytes.\n", arguments.fit_size, output_file.size);
+            mapped_file_close(&output_file);
+
+            if (strcmp(arguments.output_file, "-") != 0) {
+                remove(arguments.output_file);
+            }
+
+            return EXIT_FAILURE;
         }
 
-        if (arguments.pad_output) {
-            output_size = (output_size + 1) & ~1;
+        if (report_stats) {
+            stats.probe_count = lzkn64_stats_take_probe_count();
+            lzkn64_stats_collect(output_file.data, output_file.size, &stats);
         }
     } else if (arguments.mode == MODE_DECOMPRESS) {
-        // Allocate maximum possible size for decompressed file since we don't know the exact size yet.
-        output_buffer = malloc(LZKN64_MAXIMUM_FILE_SIZE);
-        if (output_buffer == NULL) {
-            printf("Error: Could not allocate memory for output buffer.\n");
+        size_t output_size = 0;
+
+        // Find the exact size of the decompressed file first, so the output file can be created at its final size.
+        enum Lzkn64Status status = lzkn64_decompressed_size(input_file.data, input_file.size, &output_size);
+        if (status != LZKN64_STATUS_OK) {
+            fprintf(stderr, "Error: Could not decompress input file (%s).\n", lzkn64_status_string(status));
+            return EXIT_FAILURE;
+        }
+
+        struct MappedFile index_file;
+        index_file.data = NULL;
+        index_file.size = 0;
+
+        if (arguments.index_file != NULL && !mapped_file_open(&index_file, arguments.index_file, false)) {
+            fprintf(stderr, "Error: Could not read index file.\n");
             return EXIT_FAILURE;
         }
-        output_size = lzkn64_decompress(input_buffer, output_buffer, input_size);
+
+        if (arguments.range_set) {
+            if (arguments.range_offset > output_size) {
+                fprintf(stderr, "Error: Could not decompress input file (%s).\n", lzkn64_status_string(LZKN64_STATUS_INVALID_RANGE));
+                return EXIT_FAILURE;
+            }
+
+            // Cut the range down to the end of the output.
+            output_size -= arguments.range_offset;
+            output_size = arguments.range_length < output_size ? arguments.range_length : output_size;
+        }
+
+        if (!mapped_file_create(&output_file, arguments.output_file, output_size)) {
+            fprintf(stderr, "Error: Could not open output file.\n");
+            return EXIT_FAILURE;
+        }
+
+        if (arguments.range_set) {
+            status = lzkn64_decompress_range(input_file.data, input_file.size, index_file.data, index_file.size, arguments.range_offset, output_size, output_file.data);
+            output_file.size = output_size;
+        } else if (arguments.index_file != NULL) {
+            status = lzkn64_decompress_parallel(input_file.data, input_file.size, index_file.data, index_file.size, output_file.data, output_size, arguments.thread_count, &output_file.size);
+        } else {
+            status = lzkn64_decompress_safe(input_file.data, input_file.size, output_file.data, output_size, &output_file.size);
+        }
+
+        if (arguments.index_file != NULL) {
+            mapped_file_close(&index_file);
+        }
+
+        if (status != LZKN64_STATUS_OK) {
+            fprintf(stderr, "Error: Could not decompress input file (%s).\n", lzkn64_status_string(status));
+            mapped_file_close(&output_file);
+
+            if (strcmp(arguments.output_file, "-") != 0) {
+                remove(arguments.output_file);
+            }
+
+            return EXIT_FAILURE;
+        }
+
+        if (report_stats) {
+            lzkn64_stats_collect(input_file.data, input_file.size, &stats);
+        }
     } else {
-        printf("Error: Invalid mode.\n");
+        fprintf(stderr, "Error: Invalid mode.\n");
         return EXIT_FAILURE;
     }
 
-    FILE *output_file = fopen(arguments.output_file, "wb");
-    if (output_file == NULL) {
-        printf("Error: Could not open output file.\n");
+    mapped_file_close(&input_file);
+
+    if (!mapped_file_close(&output_file)) {
+        fprintf(stderr, "Error: Could not write output file.\n");
         return EXIT_FAILURE;
     }
 
-    if (fwrite(output_buffer, 1, output_size, output_file) != output_size) {
-        printf("Error: Could not write output file.\n");
+    if (report_stats && !stats_report(&arguments, &arguments.input_file, &stats, 1)) {
+        fprintf(stderr, "Error: Could not write statistics file.\n");
         return EXIT_FAILURE;
     }
 
-    fclose(output_file);
-
-    free(input_buffer);
-    free(output_buffer);
-
     return EXIT_SUCCESS;
 }
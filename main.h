@@ -1,6 +1,7 @@
 #ifndef MAIN_H
 #define MAIN_H
 
+#include "lzkn64.h"
 #include "types.h"
 
 #define LZKN64_MAXIMUM_FILE_SIZE 0xFFFFFF // 16 MB
@@ -8,23 +9,50 @@
 enum Mode {
     MODE_UNDEFINED,
     MODE_COMPRESS,
-    MODE_DECOMPRESS
-};
-
-enum CompressionType {
-    COMPRESSION_TYPE_ACCURATE,
-    COMPRESSION_TYPE_EFFICIENT,
+    MODE_DECOMPRESS,
+    MODE_SCAN,
+    MODE_INDEX,
+    MODE_DAEMON,
+    MODE_DAEMON_STATUS,
+    MODE_PACK,
+    MODE_UNPACK
 };
 
 struct Arguments {
     enum Mode mode;
     const char *input_file;
     const char *output_file;
-    enum CompressionType compression_type;
+    enum Lzkn64CompressionType compression_type;
     bool pad_output;
+    size_t thread_count;
+    bool thread_count_set;
+    bool batch;
+    size_t scan_alignment;
+    size_t scan_minimum_size;
+    const char *cache_directory; // NULL if batch compression shouldn't use a cache.
+    size_t cache_maximum_size;
+    bool cache_verify;
+    const char *index_file; // NULL if decompression shouldn't use an index.
+    size_t index_interval;
+    size_t range_offset;
+    size_t range_length; // SIZE_MAX decompresses up to the end.
+    bool range_set;
+    bool stats;
+    const char *stats_json_file; // NULL if no JSON report should be written.
+    size_t fit_size; // 0 if the output doesn't have to fit in a given size.
+    const char *fit_file; // Compressed file whose slot the output has to fit in, NULL if fit_size is given directly.
+    const char *daemon_socket; // NULL if the work shouldn't be sent to a daemon.
+    const char *pack_entry_name; // NULL if every file in the pack should be extracted.
+    bool pack_decompress;
+    bool verify;
 };
 
 bool parse_arguments(int argc, const char *argv[], struct Arguments *arguments);
+// Compresses with the settings in arguments. Returns LZKN64_STATUS_OUTPUT_TOO_LARGE if the output doesn't fit in the
+// header, and with arguments->verify LZKN64_STATUS_MISMATCH if it doesn't decompress to the input, with where in mismatch.
+enum Lzkn64Status compress_buffer(const struct Arguments *arguments, struct Lzkn64Context *context, const u8 *input_buffer, u8 *output_buffer, size_t input_size, size_t *output_size, struct Lzkn64Mismatch *mismatch);
+void format_compress_error(enum Lzkn64Status status, const struct Lzkn64Mismatch *mismatch, char *text, size_t text_capacity);
+f64 get_time(void);
 void print_help(void);
 
 #endif // MAIN_H
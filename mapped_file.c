@@ -0,0 +1,187 @@
+#include "mapped_file.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MAPPED_FILE_READ_SIZE 0x10000
+
+// Reads everything left in descriptor into a buffer, for inputs which can't be mapped.
+static bool read_descriptor(struct MappedFile *file, int descriptor) {
+    size_t capacity = MAPPED_FILE_READ_SIZE;
+
+    file->data = malloc(capacity);
+    file->size = 0;
+
+    while (file->data != NULL) {
+        if (file->size == capacity) {
+            u8 *data = realloc(file->data, capacity * 2);
+
+            if (data == NULL) {
+                break;
+            }
+
+            file->data = data;
+            capacity *= 2;
+        }
+
+        ssize_t length = read(descriptor, &file->data[file->size], capacity - file->size);
+
+        if (length == 0) {
+            return true;
+        } else if (length < 0) {
+            break;
+        }
+
+        file->size += (size_t)length;
+    }
+
+    free(file->data);
+    file->data = NULL;
+
+    return false;
+}
+
+bool mapped_file_open(struct MappedFile *file, const char *path, bool copy) {
+    file->data = NULL;
+    file->size = 0;
+    file->mapped_size = 0;
+    file->descriptor = -1;
+    file->mapped = false;
+
+    if (strcmp(path, "-") == 0) {
+        return read_descriptor(file, STDIN_FILENO);
+    }
+
+    int descriptor = open(path, O_RDONLY);
+    if (descriptor < 0) {
+        return false;
+    }
+
+    struct stat file_stat;
+    bool successful = false;
+
+    if (!copy && fstat(descriptor, &file_stat) == 0 && S_ISREG(file_stat.st_mode) && file_stat.st_size > 0) {
+        void *data = mmap(NULL, (size_t)file_stat.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+
+        if (data != MAP_FAILED) {
+            file->data = data;
+            file->size = (size_t)file_stat.st_size;
+            file->mapped_size = file->size;
+            file->mapped = true;
+            successful = true;
+        }
+    }
+
+    // Empty files can't be mapped, and neither can pipes or devices.
+    if (!successful) {
+        successful = read_descriptor(file, descriptor);
+    }
+
+    close(descriptor);
+
+    return successful;
+}
+
+bool mapped_file_same(const char *first_path, const char *second_path) {
+    struct stat first_stat;
+    struct stat second_stat;
+
+    if (stat(first_path, &first_stat) != 0 || stat(second_path, &second_stat) != 0) {
+        return false;
+    }
+
+    return first_stat.st_dev == second_stat.st_dev && first_stat.st_ino == second_stat.st_ino;
+}
+
+bool mapped_file_create(struct MappedFile *file, const char *path, size_t size) {
+    file->data = NULL;
+    file->size = size;
+    file->mapped_size = 0;
+    file->descriptor = -1;
+    file->mapped = false;
+
+    if (strcmp(path, "-") == 0) {
+        file->descriptor = STDOUT_FILENO;
+    } else {
+        file->descriptor = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+
+        if (file->descriptor < 0) {
+            return false;
+        }
+
+        // A file grown with ftruncate is sparse, running out of space while writing to its mapping would be a SIGBUS.
+        // Allocating every block up front makes that fail here instead, where the buffer can still be written out.
+        if (size > 0) {
+            if (posix_fallocate(file->descriptor, 0, (off_t)size) == 0) {
+                void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, file->descriptor, 0);
+
+                if (data != MAP_FAILED) {
+                    file->data = data;
+                    file->mapped_size = size;
+                    file->mapped = true;
+
+                    return true;
+                }
+            }
+
+            // Start over empty, so the buffer written out later doesn't end up in front of leftover space.
+            if (ftruncate(file->descriptor, 0) != 0) {
+                mapped_file_close(file);
+                return false;
+            }
+        }
+    }
+
+    // Written out by mapped_file_close instead.
+    file->data = malloc(size > 0 ? size : 1);
+
+    if (file->data == NULL) {
+        mapped_file_close(file);
+        return false;
+    }
+
+    return true;
+}
+
+bool mapped_file_close(struct MappedFile *file) {
+    bool successful = true;
+
+    if (file->mapped) {
+        munmap(file->data, file->mapped_size);
+
+        if (file->descriptor >= 0 && file->size != file->mapped_size) {
+            successful = ftruncate(file->descriptor, (off_t)file->size) == 0;
+        }
+    } else if (file->descriptor >= 0 && file->data != NULL) {
+        size_t offset = 0;
+
+        while (offset < file->size) {
+            ssize_t length = write(file->descriptor, &file->data[offset], file->size - offset);
+
+            if (length <= 0) {
+                successful = false;
+                break;
+            }
+
+            offset += (size_t)length;
+        }
+    }
+
+    if (!file->mapped) {
+        free(file->data);
+    }
+
+    if (file->descriptor >= 0 && file->descriptor != STDOUT_FILENO) {
+        successful &= close(file->descriptor) == 0;
+    }
+
+    file->data = NULL;
+    file->descriptor = -1;
+    file->mapped = false;
+
+    return successful;
+}
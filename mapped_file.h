@@ -0,0 +1,30 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include "types.h"
+
+// A whole file in memory. Regular files are memory mapped so their data is never copied, anything that can't be mapped
+// (stdin, stdout, pipes and devices) falls back to a buffer that is read or written in one go.
+struct MappedFile {
+    u8 *data;
+    size_t size;
+    size_t mapped_size;
+    int descriptor; // Only kept open for files being written, -1 otherwise.
+    bool mapped;
+};
+
+// Maps path read-only, - reads all of stdin instead. With copy the file is always read into a buffer, which has to be done
+// if it is going to be overwritten while the data is still in use.
+bool mapped_file_open(struct MappedFile *file, const char *path, bool copy);
+
+// Creates path with room for size bytes and maps it for writing, - buffers the data for stdout instead.
+bool mapped_file_create(struct MappedFile *file, const char *path, size_t size);
+
+// Returns true if both paths exist and are the same file.
+bool mapped_file_same(const char *first_path, const char *second_path);
+
+// Releases the file. A file from mapped_file_create is cut down to file->size bytes first, which can be lowered after
+// writing less than was made room for. Returns false if the data couldn't be written out.
+bool mapped_file_close(struct MappedFile *file);
+
+#endif // MAPPED_FILE_H
@@ -0,0 +1,158 @@
+#include "match_length.h"
+
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define MATCH_LENGTH_X86
+#include <immintrin.h>
+#endif
+
+static size_t count_trailing_zero_bytes(u64 value) {
+#if defined(__GNUC__)
+    return (size_t)__builtin_ctzll(value) >> 3;
+#else
+    size_t count = 0;
+
+    while ((value & 0xFF) == 0) {
+        value >>= 8;
+        count++;
+    }
+
+    return count;
+#endif
+}
+
+static size_t count_leading_zero_bytes(u64 value) {
+#if defined(__GNUC__)
+    return (size_t)__builtin_clzll(value) >> 3;
+#else
+    size_t count = 0;
+
+    while ((value >> 56) == 0) {
+        value <<= 8;
+        count++;
+    }
+
+    return count;
+#endif
+}
+
+static bool is_little_endian(void) {
+    const u16 value = 1;
+
+    return *(const u8 *)&value == 1;
+}
+
+size_t match_length_scalar(const u8 *first, const u8 *second, size_t maximum_length) {
+    size_t length = 0;
+
+    while (length < maximum_length && first[length] == second[length]) {
+        length++;
+    }
+
+    return length;
+}
+
+size_t match_length_word(const u8 *first, const u8 *second, size_t maximum_length) {
+    size_t length = 0;
+
+    while ((maximum_length - length) >= sizeof(u64)) {
+        u64 first_word;
+        u64 second_word;
+
+        memcpy(&first_word, &first[length], sizeof(u64));
+        memcpy(&second_word, &second[length], sizeof(u64));
+
+        u64 difference = first_word ^ second_word;
+
+        if (difference != 0) {
+            // The first byte in memory is the lowest byte of the word on little endian CPUs and the highest on big endian ones.
+            if (is_little_endian()) {
+                return length + count_trailing_zero_bytes(difference);
+            } else {
+                return length + count_leading_zero_bytes(difference);
+            }
+        }
+
+        length += sizeof(u64);
+    }
+
+    return length + match_length_scalar(&first[length], &second[length], maximum_length - length);
+}
+
+#ifdef MATCH_LENGTH_X86
+
+__attribute__((target("sse2")))
+static size_t match_length_sse2_kernel(const u8 *first, const u8 *second, size_t maximum_length) {
+    size_t length = 0;
+
+    while ((maximum_length - length) >= 16) {
+        __m128i first_vector = _mm_loadu_si128((const __m128i *)&first[length]);
+        __m128i second_vector = _mm_loadu_si128((const __m128i *)&second[length]);
+        u32 mask = (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(first_vector, second_vector)) ^ 0xFFFF;
+
+        if (mask != 0) {
+            return length + (size_t)__builtin_ctz(mask);
+        }
+
+        length += 16;
+    }
+
+    return length + match_length_word(&first[length], &second[length], maximum_length - length);
+}
+
+__attribute__((target("avx2")))
+static size_t match_length_avx2_kernel(const u8 *first, const u8 *second, size_t maximum_length) {
+    size_t length = 0;
+
+    while ((maximum_length - length) >= 32) {
+        __m256i first_vector = _mm256_loadu_si256((const __m256i *)&first[length]);
+        __m256i second_vector = _mm256_loadu_si256((const __m256i *)&second[length]);
+        u32 mask = ~(u32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(first_vector, second_vector));
+
+        if (mask != 0) {
+            return length + (size_t)__builtin_ctz(mask);
+        }
+
+        length += 32;
+    }
+
+    return length + match_length_sse2_kernel(&first[length], &second[length], maximum_length - length);
+}
+
+const MatchLengthFunction match_length_sse2 = match_length_sse2_kernel;
+const MatchLengthFunction match_length_avx2 = match_length_avx2_kernel;
+
+#else
+
+const MatchLengthFunction match_length_sse2 = NULL;
+const MatchLengthFunction match_length_avx2 = NULL;
+
+#endif // MATCH_LENGTH_X86
+
+static MatchLengthFunction match_length_selected = NULL;
+
+MatchLengthFunction match_length_select(void) {
+    // Every thread picks the same kernel, so threads racing on the first call only store the same pointer twice. The
+    // atomic accesses keep that race defined.
+    MatchLengthFunction selected_function = __atomic_load_n(&match_length_selected, __ATOMIC_ACQUIRE);
+
+    if (selected_function == NULL) {
+        MatchLengthFunction selected = match_length_word;
+
+#ifdef MATCH_LENGTH_X86
+        __builtin_cpu_init();
+
+        if (__builtin_cpu_supports("avx2")) {
+            selected = match_length_avx2;
+        } else if (__builtin_cpu_supports("sse2")) {
+            selected = match_length_sse2;
+        }
+#endif
+
+        __atomic_store_n(&match_length_selected, selected, __ATOMIC_RELEASE);
+        selected_function = selected;
+    }
+
+    return selected_function;
+}
@@ -0,0 +1,25 @@
+#ifndef MATCH_LENGTH_H
+#define MATCH_LENGTH_H
+
+#include "types.h"
+
+// Returns how many bytes at the start of first and second are equal, up to maximum_length.
+// Both buffers must be readable for maximum_length bytes, nothing past that is ever read.
+typedef size_t (*MatchLengthFunction)(const u8 *first, const u8 *second, size_t maximum_length);
+
+// Compares one byte at a time, this is the reference every other kernel has to agree with.
+size_t match_length_scalar(const u8 *first, const u8 *second, size_t maximum_length);
+
+// Compares 8 bytes at a time and finds the first mismatch by counting the trailing zeroes of their XOR.
+size_t match_length_word(const u8 *first, const u8 *second, size_t maximum_length);
+
+// Compares 16 bytes at a time, NULL if the kernel wasn't built for this target.
+extern const MatchLengthFunction match_length_sse2;
+
+// Compares 32 bytes at a time, NULL if the kernel wasn't built for this target.
+extern const MatchLengthFunction match_length_avx2;
+
+// Returns the fastest kernel the running CPU supports, the choice is only made once.
+MatchLengthFunction match_length_select(void);
+
+#endif // MATCH_LENGTH_H
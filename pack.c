@@ -0,0 +1,616 @@
+#include "pack.h"
+#include "batch.h"
+#include "cache.h"
+#include "lzkn64.h"
+#include "mapped_file.h"
+#include "parallel.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define PACK_NAME_HASH_SEED 0x4E414D45 // "NAME"
+#define PACK_CONTENT_HASH_SEED 0x44415441 // "DATA"
+#define PACK_MAXIMUM_BUCKET_BITS 24
+
+struct PackEntry {
+    char *input_path;
+    const char *name;
+    size_t name_length;
+    struct MappedFile file;
+    u64 name_hash;
+    u64 content_hash;
+    u64 data_offset;
+    size_t decompressed_size;
+    bool successful;
+};
+
+struct PackEntryInfo {
+    u64 name_hash;
+    u64 content_hash;
+    u64 data_offset;
+    u32 compressed_size;
+    u32 decompressed_size;
+    const char *name;
+    size_t name_length;
+};
+
+// A pack as it sits in memory, every offset checked against its size.
+struct Pack {
+    const u8 *data;
+    size_t size;
+    u32 entry_count;
+    u32 bucket_bits;
+    u32 name_table_size;
+    u64 name_table_offset;
+    u64 data_offset;
+};
+
+// Buffers owned by one worker thread, they only ever grow so every file after the first largest one reuses them.
+struct PackWorker {
+    u8 *buffer;
+    size_t capacity;
+};
+
+struct PackJob {
+    const struct Arguments *arguments;
+    const struct Pack *pack;
+    struct PackEntry *entries;
+    struct PackWorker *workers;
+    u8 *output_data;
+    bool *successful;
+};
+
+static void write_u32(u8 *data, u32 value) {
+    data[0] = value >> 24;
+    data[1] = value >> 16;
+    data[2] = value >> 8;
+    data[3] = value;
+}
+
+static void write_u64(u8 *data, u64 value) {
+    write_u32(data, (u32)(value >> 32));
+    write_u32(&data[4], (u32)value);
+}
+
+static u32 read_u32(const u8 *data) {
+    return ((u32)data[0] << 24) | ((u32)data[1] << 16) | ((u32)data[2] << 8) | (u32)data[3];
+}
+
+static u64 read_u64(const u8 *data) {
+    return ((u64)read_u32(data) << 32) | read_u32(&data[4]);
+}
+
+static bool reserve_buffer(u8 **buffer, size_t *capacity, size_t size) {
+    if (size > *capacity || *buffer == NULL) {
+        u8 *resized_buffer = realloc(*buffer, size > 0 ? size : 1);
+
+        if (resized_buffer == NULL) {
+            return false;
+        }
+
+        *buffer = resized_buffer;
+        *capacity = size;
+    }
+
+    return true;
+}
+
+static u64 name_hash(const char *name, size_t name_length) {
+    u64 hash[2];
+    cache_hash((const u8 *)name, name_length, PACK_NAME_HASH_SEED, hash);
+
+    return hash[0];
+}
+
+static u64 content_hash(const u8 *data, size_t size) {
+    u64 hash[2];
+    cache_hash(data, size, PACK_CONTENT_HASH_SEED, hash);
+
+    return hash[0];
+}
+
+static u32 bucket_index(u64 hash, u32 bucket_bits) {
+    return bucket_bits == 0 ? 0 : (u32)(hash >> (64 - bucket_bits));
+}
+
+static size_t align_offset(size_t offset) {
+    return (offset + PACK_ALIGNMENT - 1) & ~(size_t)(PACK_ALIGNMENT - 1);
+}
+
+static int compare_entries(const void *first, const void *second) {
+    const struct PackEntry *first_entry = first;
+    const struct PackEntry *second_entry = second;
+
+    if (first_entry->name_hash != second_entry->name_hash) {
+        return first_entry->name_hash < second_entry->name_hash ? -1 : 1;
+    }
+
+    return strcmp(first_entry->name, second_entry->name);
+}
+
+// Maps an input file and checks that it decompresses, the file is kept mapped until it is copied into the pack.
+static void load_task(void *context, size_t task_index, size_t thread_index) {
+    struct PackJob *job = context;
+    struct PackEntry *entry = &job->entries[task_index];
+    struct PackWorker *worker = &job->workers[thread_index];
+    size_t decompressed_size = 0;
+
+    if (!mapped_file_open(&entry->file, entry->input_path, false)) {
+        fprintf(stderr, "Error: Could not read input file %s.\n", entry->input_path);
+        return;
+    }
+
+    enum Lzkn64Status status = lzkn64_decompressed_size(entry->file.data, entry->file.size, &decompressed_size);
+
+    if (status == LZKN64_STATUS_OK && !reserve_buffer(&worker->buffer, &worker->capacity, decompressed_size)) {
+        status = LZKN64_STATUS_OUTPUT_OVERFLOW;
+    }
+
+    if (status == LZKN64_STATUS_OK) {
+        status = lzkn64_decompress_safe(entry->file.data, entry->file.size, worker->buffer, worker->capacity, &entry->decompressed_size);
+    }
+
+    if (status != LZKN64_STATUS_OK || entry->file.size > UINT32_MAX) {
+        fprintf(stderr, "Error: Could not decompress input file %s (%s).\n", entry->input_path, lzkn64_status_string(status));
+        return;
+    }
+
+    entry->name_hash = name_hash(entry->name, entry->name_length);
+    entry->content_hash = content_hash(entry->file.data, entry->file.size);
+    entry->successful = true;
+}
+
+static void copy_task(void *context, size_t task_index, size_t thread_index) {
+    struct PackJob *job = context;
+    struct PackEntry *entry = &job->entries[task_index];
+    (void)thread_index;
+
+    memcpy(&job->output_data[entry->data_offset], entry->file.data, entry->file.size);
+    mapped_file_close(&entry->file);
+}
+
+// Closes the input files that are still mapped and frees the entries.
+static void pack_entries_free(struct PackEntry *entries, size_t entry_count) {
+    for (size_t i = 0; i < entry_count; i++) {
+        if (entries[i].file.data != NULL) {
+            mapped_file_close(&entries[i].file);
+        }
+
+        free(entries[i].input_path);
+    }
+
+    free(entries);
+}
+
+int pack_run(const struct Arguments *arguments) {
+    char **input_paths;
+    size_t entry_count;
+    int result = EXIT_FAILURE;
+
+    if (!batch_collect(arguments->input_file, &input_paths, &entry_count)) {
+        fprintf(stderr, "Error: Could not list the input files.\n");
+        return EXIT_FAILURE;
+    }
+
+    struct PackEntry *entries = calloc(entry_count > 0 ? entry_count : 1, sizeof(struct PackEntry));
+    if (entries == NULL) {
+        fprintf(stderr, "Error: Could not allocate memory for entries.\n");
+
+        for (size_t i = 0; i < entry_count; i++) {
+            free(input_paths[i]);
+        }
+
+        free(input_paths);
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < entry_count; i++) {
+        const char *separator = strrchr(input_paths[i], '/');
+
+        entries[i].input_path = input_paths[i];
+        entries[i].name = separator != NULL ? separator + 1 : input_paths[i];
+        entries[i].name_length = strlen(entries[i].name);
+    }
+
+    free(input_paths);
+
+    size_t thread_count = arguments->thread_count_set ? arguments->thread_count : 0;
+    if (thread_count == 0) {
+        thread_count = parallel_default_thread_count();
+    }
+
+    struct PackWorker *workers = calloc(thread_count, sizeof(struct PackWorker));
+    if (workers == NULL) {
+        fprintf(stderr, "Error: Could not allocate memory for workers.\n");
+        goto cleanup;
+    }
+
+    struct PackJob job;
+    job.arguments = arguments;
+    job.pack = NULL;
+    job.entries = entries;
+    job.workers = workers;
+    job.output_data = NULL;
+    job.successful = NULL;
+
+    f64 start_time = get_time();
+    parallel_for(entry_count, thread_count, load_task, &job);
+
+    for (size_t i = 0; i < thread_count; i++) {
+        free(workers[i].buffer);
+    }
+
+    free(workers);
+
+    for (size_t i = 0; i < entry_count; i++) {
+        if (!entries[i].successful) {
+            goto cleanup;
+        }
+    }
+
+    qsort(entries, entry_count, sizeof(struct PackEntry), compare_entries);
+
+    // Entries are looked up by name alone, so a name can only be in the pack once.
+    for (size_t i = 1; i < entry_count; i++) {
+        if (compare_entries(&entries[i - 1], &entries[i]) == 0) {
+            fprintf(stderr, "Error: %s and %s have the same name.\n", entries[i - 1].input_path, entries[i].input_path);
+            goto cleanup;
+        }
+    }
+
+    // About one entry per bucket.
+    u32 bucket_bits = 0;
+    while (bucket_bits < PACK_MAXIMUM_BUCKET_BITS && ((size_t)1 << bucket_bits) < entry_count) {
+        bucket_bits++;
+    }
+
+    size_t bucket_count = ((size_t)1 << bucket_bits) + 1;
+    size_t name_table_offset = PACK_HEADER_SIZE + entry_count * PACK_ENTRY_SIZE + bucket_count * 4;
+    size_t name_table_size = 0;
+
+    for (size_t i = 0; i < entry_count; i++) {
+        name_table_size += entries[i].name_length;
+    }
+
+    size_t data_offset = align_offset(name_table_offset + name_table_size);
+    size_t output_size = data_offset;
+
+    for (size_t i = 0; i < entry_count; i++) {
+        entries[i].data_offset = output_size;
+        output_size = align_offset(output_size + entries[i].file.size);
+    }
+
+    if (name_table_size > UINT32_MAX) {
+        fprintf(stderr, "Error: The names of the input files are too long.\n");
+        goto cleanup;
+    }
+
+    struct MappedFile output_file;
+    if (!mapped_file_create(&output_file, arguments->output_file, output_size)) {
+        fprintf(stderr, "Error: Could not open output file %s.\n", arguments->output_file);
+        goto cleanup;
+    }
+
+    // The padding between files is left as zeroes.
+    u8 *output_data = output_file.data;
+    memset(output_data, 0, output_size);
+
+    memcpy(output_data, "LZKP", 4);
+    write_u32(&output_data[4], PACK_VERSION);
+    write_u32(&output_data[8], (u32)entry_count);
+    write_u32(&output_data[12], bucket_bits);
+    write_u32(&output_data[16], (u32)name_table_size);
+    write_u64(&output_data[20], data_offset);
+
+    u8 *bucket_data = &output_data[PACK_HEADER_SIZE + entry_count * PACK_ENTRY_SIZE];
+    size_t name_offset = 0;
+    size_t bucket = 0;
+
+    for (size_t i = 0; i < entry_count; i++) {
+        u8 *entry_data = &output_data[PACK_HEADER_SIZE + i * PACK_ENTRY_SIZE];
+
+        write_u64(entry_data, entries[i].name_hash);
+        write_u64(&entry_data[8], entries[i].content_hash);
+        write_u64(&entry_data[16], entries[i].data_offset);
+        write_u32(&entry_data[24], (u32)entries[i].file.size);
+        write_u32(&entry_data[28], (u32)entries[i].decompressed_size);
+        write_u32(&entry_data[32], (u32)name_offset);
+        write_u32(&entry_data[36], (u32)entries[i].name_length);
+
+        memcpy(&output_data[name_table_offset + name_offset], entries[i].name, entries[i].name_length);
+        name_offset += entries[i].name_length;
+
+        // Every bucket up to this entry's starts at the first entry with a hash in it.
+        for (; bucket <= bucket_index(entries[i].name_hash, bucket_bits); bucket++) {
+            write_u32(&bucket_data[bucket * 4], (u32)i);
+        }
+    }
+
+    for (; bucket < bucket_count; bucket++) {
+        write_u32(&bucket_data[bucket * 4], (u32)entry_count);
+    }
+
+    job.output_data = output_data;
+    parallel_for(entry_count, thread_count, copy_task, &job);
+
+    bool written = mapped_file_close(&output_file);
+    f64 elapsed_time = get_time() - start_time;
+
+    if (!written) {
+        fprintf(stderr, "Error: Could not write output file %s.\n", arguments->output_file);
+        goto cleanup;
+    }
+
+    printf("Packed %zu files into %zu bytes in %.3f s.\n", entry_count, output_size, elapsed_time);
+    result = EXIT_SUCCESS;
+
+cleanup:
+    // Every input file that was loaded is still mapped, unless it was copied into the pack.
+    pack_entries_free(entries, entry_count);
+
+    return result;
+}
+
+static bool pack_read(struct Pack *pack, const u8 *data, size_t size) {
+    if (size < PACK_HEADER_SIZE || memcmp(data, "LZKP", 4) != 0 || read_u32(&data[4]) != PACK_VERSION) {
+        return false;
+    }
+
+    pack->data = data;
+    pack->size = size;
+    pack->entry_count = read_u32(&data[8]);
+    pack->bucket_bits = read_u32(&data[12]);
+    pack->name_table_size = read_u32(&data[16]);
+    pack->data_offset = read_u64(&data[20]);
+
+    if (pack->bucket_bits > PACK_MAXIMUM_BUCKET_BITS) {
+        return false;
+    }
+
+    pack->name_table_offset = PACK_HEADER_SIZE + (u64)pack->entry_count * PACK_ENTRY_SIZE + (((u64)1 << pack->bucket_bits) + 1) * 4;
+
+    return pack->name_table_offset + pack->name_table_size <= pack->data_offset && pack->data_offset <= size;
+}
+
+// Reads an entry, false if its name or data would be outside the pack.
+static bool pack_entry(const struct Pack *pack, size_t entry_index, struct PackEntryInfo *info) {
+    const u8 *entry_data = &pack->data[PACK_HEADER_SIZE + entry_index * PACK_ENTRY_SIZE];
+    u32 name_offset = read_u32(&entry_data[32]);
+
+    info->name_hash = read_u64(entry_data);
+    info->content_hash = read_u64(&entry_data[8]);
+    info->data_offset = read_u64(&entry_data[16]);
+    info->compressed_size = read_u32(&entry_data[24]);
+    info->decompressed_size = read_u32(&entry_data[28]);
+    info->name = (const char *)&pack->data[pack->name_table_offset + name_offset];
+    info->name_length = read_u32(&entry_data[36]);
+
+    return (u64)name_offset + info->name_length <= pack->name_table_size && info->data_offset >= pack->data_offset && info->data_offset <= pack->size && info->compressed_size <= pack->size - info->data_offset;
+}
+
+// Looks name up in its bucket, so only the entries sharing the top bits of its hash are compared.
+static bool pack_find(const struct Pack *pack, const char *name, size_t *entry_index) {
+    size_t name_length = strlen(name);
+    u64 hash = name_hash(name, name_length);
+    u32 bucket = bucket_index(hash, pack->bucket_bits);
+    const u8 *bucket_data = &pack->data[PACK_HEADER_SIZE + (size_t)pack->entry_count * PACK_ENTRY_SIZE + bucket * 4];
+    u32 first_index = read_u32(bucket_data);
+    u32 last_index = read_u32(&bucket_data[4]);
+
+    if (last_index > pack->entry_count) {
+        return false;
+    }
+
+    for (u32 i = first_index; i < last_index; i++) {
+        struct PackEntryInfo info;
+
+        if (pack_entry(pack, i, &info) && info.name_hash == hash && info.name_length == name_length && memcmp(info.name, name, name_length) == 0) {
+            *entry_index = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Checks the stored file against its hash and decompresses it if asked to, the result is left in data and size.
+static bool extract_entry(const struct Arguments *arguments, const struct Pack *pack, const struct PackEntryInfo *info, struct PackWorker *worker, const u8 **data, size_t *size, const char **error) {
+    *data = &pack->data[info->data_offset];
+    *size = info->compressed_size;
+
+    if (content_hash(*data, *size) != info->content_hash) {
+        *error = "its data doesn't match its hash";
+        return false;
+    }
+
+    if (!arguments->pack_decompress) {
+        return true;
+    }
+
+    size_t decompressed_size = 0;
+
+    if (!reserve_buffer(&worker->buffer, &worker->capacity, info->decompressed_size)) {
+        *error = "out of memory";
+        return false;
+    }
+
+    enum Lzkn64Status status = lzkn64_decompress_safe(*data, *size, worker->buffer, info->decompressed_size, &decompressed_size);
+
+    if (status != LZKN64_STATUS_OK || decompressed_size != info->decompressed_size) {
+        *error = status != LZKN64_STATUS_OK ? lzkn64_status_string(status) : "wrong decompressed size";
+        return false;
+    }
+
+    *data = worker->buffer;
+    *size = decompressed_size;
+
+    return true;
+}
+
+static void unpack_task(void *context, size_t task_index, size_t thread_index) {
+    struct PackJob *job = context;
+    struct PackEntryInfo info;
+    const char *error = NULL;
+    const u8 *data;
+    size_t size;
+
+    if (!pack_entry(job->pack, task_index, &info)) {
+        fprintf(stderr, "Error: Entry %zu of the pack is out of bounds.\n", task_index);
+        return;
+    }
+
+    // Names come from file names, anything that could leave the output directory is a damaged pack.
+    if (info.name_length == 0 || memchr(info.name, '/', info.name_length) != NULL || (info.name_length <= 2 && memcmp(info.name, "..", info.name_length) == 0)) {
+        fprintf(stderr, "Error: Entry %zu of the pack has an invalid name.\n", task_index);
+        return;
+    }
+
+    if (!extract_entry(job->arguments, job->pack, &info, &job->workers[thread_index], &data, &size, &error)) {
+        fprintf(stderr, "Error: Could not extract %.*s (%s).\n", (int)info.name_length, info.name, error);
+        return;
+    }
+
+    size_t directory_length = strlen(job->arguments->output_file);
+    char *output_path = malloc(directory_length + info.name_length + 2);
+
+    if (output_path == NULL) {
+        fprintf(stderr, "Error: Could not allocate memory for output path.\n");
+        return;
+    }
+
+    sprintf(output_path, "%s/%.*s", job->arguments->output_file, (int)info.name_length, info.name);
+
+    FILE *output_file = fopen(output_path, "wb");
+    if (output_file == NULL) {
+        fprintf(stderr, "Error: Could not open output file %s.\n", output_path);
+        free(output_path);
+        return;
+    }
+
+    bool successful = fwrite(data, 1, size, output_file) == size;
+
+    if (fclose(output_file) != 0 || !successful) {
+        fprintf(stderr, "Error: Could not write output file %s.\n", output_path);
+        free(output_path);
+        return;
+    }
+
+    free(output_path);
+    job->successful[task_index] = true;
+}
+
+static int unpack_entry(const struct Arguments *arguments, const struct Pack *pack) {
+    struct PackWorker worker = { NULL, 0 };
+    struct PackEntryInfo info;
+    const char *error = NULL;
+    const u8 *data;
+    size_t size;
+    size_t entry_index;
+
+    if (!pack_find(pack, arguments->pack_entry_name, &entry_index)) {
+        fprintf(stderr, "Error: The pack has no file named %s.\n", arguments->pack_entry_name);
+        return EXIT_FAILURE;
+    }
+
+    if (!pack_entry(pack, entry_index, &info) || !extract_entry(arguments, pack, &info, &worker, &data, &size, &error)) {
+        fprintf(stderr, "Error: Could not extract %s (%s).\n", arguments->pack_entry_name, error != NULL ? error : "out of bounds");
+        free(worker.buffer);
+        return EXIT_FAILURE;
+    }
+
+    struct MappedFile output_file;
+    if (!mapped_file_create(&output_file, arguments->output_file, size)) {
+        fprintf(stderr, "Error: Could not open output file.\n");
+        free(worker.buffer);
+        return EXIT_FAILURE;
+    }
+
+    memcpy(output_file.data, data, size);
+    output_file.size = size;
+    free(worker.buffer);
+
+    if (!mapped_file_close(&output_file)) {
+        fprintf(stderr, "Error: Could not write output file.\n");
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int unpack_run(const struct Arguments *arguments) {
+    struct MappedFile input_file;
+    struct Pack pack;
+
+    if (!mapped_file_open(&input_file, arguments->input_file, false)) {
+        fprintf(stderr, "Error: Could not read input file.\n");
+        return EXIT_FAILURE;
+    }
+
+    if (!pack_read(&pack, input_file.data, input_file.size)) {
+        fprintf(stderr, "Error: %s is not a pack.\n", arguments->input_file);
+        mapped_file_close(&input_file);
+        return EXIT_FAILURE;
+    }
+
+    // A single file is found through the index without touching the data of any other.
+    if (arguments->pack_entry_name != NULL) {
+        int exit_code = unpack_entry(arguments, &pack);
+        mapped_file_close(&input_file);
+        return exit_code;
+    }
+
+    if (mkdir(arguments->output_file, 0777) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Error: Could not create output directory %s.\n", arguments->output_file);
+        mapped_file_close(&input_file);
+        return EXIT_FAILURE;
+    }
+
+    size_t thread_count = arguments->thread_count_set ? arguments->thread_count : 0;
+    if (thread_count == 0) {
+        thread_count = parallel_default_thread_count();
+    }
+
+    struct PackWorker *workers = calloc(thread_count, sizeof(struct PackWorker));
+    bool *successful = calloc(pack.entry_count > 0 ? pack.entry_count : 1, sizeof(bool));
+
+    if (workers == NULL || successful == NULL) {
+        fprintf(stderr, "Error: Could not allocate memory for workers.\n");
+        free(workers);
+        free(successful);
+        mapped_file_close(&input_file);
+        return EXIT_FAILURE;
+    }
+
+    struct PackJob job;
+    job.arguments = arguments;
+    job.pack = &pack;
+    job.entries = NULL;
+    job.workers = workers;
+    job.output_data = NULL;
+    job.successful = successful;
+
+    f64 start_time = get_time();
+    parallel_for(pack.entry_count, thread_count, unpack_task, &job);
+    f64 elapsed_time = get_time() - start_time;
+
+    size_t failed_count = 0;
+
+    for (size_t i = 0; i < pack.entry_count; i++) {
+        failed_count += !successful[i];
+    }
+
+    for (size_t i = 0; i < thread_count; i++) {
+        free(workers[i].buffer);
+    }
+
+    free(workers);
+    free(successful);
+    mapped_file_close(&input_file);
+
+    printf("Extracted %zu of %u files on %zu threads in %.3f s.\n", pack.entry_count - failed_count, pack.entry_count, thread_count, elapsed_time);
+
+    return failed_count == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
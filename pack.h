@@ -0,0 +1,32 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include "main.h"
+
+// A pack holds many LZKN64 files, stored byte for byte, behind an index that can be used straight from a memory mapping.
+// Every number is big endian, like the LZKN64 header:
+//
+//   header       "LZKP", version, entry count, bucket bits, name table size, data offset (8 bytes)
+//   entries      name hash (8 bytes), content hash (8 bytes), data offset (8 bytes), compressed size,
+//                decompressed size, name offset, name length
+//   buckets      (1 << bucket bits) + 1 entry indices, bucket i holding the entries from buckets[i] to buckets[i + 1]
+//   name table   the names of the entries, without terminators
+//   data         the files, each starting at a multiple of PACK_ALIGNMENT
+//
+// The entries are sorted by name hash and the top bucket bits of a name hash pick its bucket, so a lookup only looks at
+// the one or two entries in it. The content hash is the hash of the stored file.
+#define PACK_HEADER_SIZE 28
+#define PACK_ENTRY_SIZE 40
+#define PACK_ALIGNMENT 8
+#define PACK_VERSION 1
+
+// Stores every LZKN64 file in arguments->input_file, a directory or a manifest file as with -b, in the pack
+// arguments->output_file, named after their file names. Each file is checked to decompress first.
+int pack_run(const struct Arguments *arguments);
+
+// Writes every file in the pack arguments->input_file into the arguments->output_file directory, split across
+// arguments->thread_count threads, or only the one named arguments->pack_entry_name into the arguments->output_file
+// file. Files are decompressed on the way out with arguments->pack_decompress.
+int unpack_run(const struct Arguments *arguments);
+
+#endif // PACK_H
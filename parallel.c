@@ -0,0 +1,261 @@
+#include "parallel.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+struct ParallelWorker {
+    struct ParallelState *state;
+    size_t thread_index;
+};
+
+struct ParallelState {
+    pthread_mutex_t mutex;
+    size_t next_task_index;
+    size_t task_count;
+    ParallelTask task;
+    void *context;
+};
+
+static void *parallel_worker(void *argument) {
+    struct ParallelWorker *worker = argument;
+    struct ParallelState *state = worker->state;
+
+    while (true) {
+        pthread_mutex_lock(&state->mutex);
+        size_t task_index = state->next_task_index;
+        if (task_index < state->task_count) {
+            state->next_task_index++;
+        }
+        pthread_mutex_unlock(&state->mutex);
+
+        if (task_index >= state->task_count) {
+            break;
+        }
+
+        state->task(state->context, task_index, worker->thread_index);
+    }
+
+    return NULL;
+}
+
+size_t parallel_default_thread_count(void) {
+    long processor_count = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (processor_count < 1) {
+        return 1;
+    }
+
+    return (size_t)processor_count;
+}
+
+void parallel_for(size_t task_count, size_t thread_count, ParallelTask task, void *context) {
+    if (thread_count == 0) {
+        thread_count = parallel_default_thread_count();
+    }
+
+    if (thread_count > task_count) {
+        thread_count = task_count;
+    }
+
+    // Nothing to gain from threads, run everything on the calling thread.
+    if (thread_count <= 1) {
+        for (size_t i = 0; i < task_count; i++) {
+            task(context, i, 0);
+        }
+
+        return;
+    }
+
+    struct ParallelState state;
+    pthread_mutex_init(&state.mutex, NULL);
+    state.next_task_index = 0;
+    state.task_count = task_count;
+    state.task = task;
+    state.context = context;
+
+    pthread_t *threads = malloc(thread_count * sizeof(pthread_t));
+    struct ParallelWorker *workers = malloc(thread_count * sizeof(struct ParallelWorker));
+    size_t started_count = 1;
+
+    if (threads != NULL && workers != NULL) {
+        for (size_t i = 1; i < thread_count; i++) {
+            workers[i].state = &state;
+            workers[i].thread_index = i;
+
+            // If a thread can't be started the remaining workers simply pick up its share of the tasks.
+            if (pthread_create(&threads[i], NULL, parallel_worker, &workers[i]) != 0) {
+                break;
+            }
+
+            started_count++;
+        }
+    }
+
+    struct ParallelWorker calling_worker;
+    calling_worker.state = &state;
+    calling_worker.thread_index = 0;
+    parallel_worker(&calling_worker);
+
+    for (size_t i = 1; i < started_count; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    free(threads);
+    free(workers);
+    pthread_mutex_destroy(&state.mutex);
+}
+
+struct ParallelPoolWorker {
+    struct ParallelPool *pool;
+    size_t thread_index;
+};
+
+struct ParallelPool {
+    pthread_mutex_t mutex;
+    pthread_cond_t work_condition; // Signalled when a run starts or the pool is destroyed.
+    pthread_cond_t done_condition; // Signalled when the last worker thread is done with a run.
+    pthread_t *threads;
+    struct ParallelPoolWorker *workers;
+    size_t thread_count; // Started worker threads plus the calling thread.
+    size_t run_index; // Counts the runs, so workers can tell a new run from a spurious wakeup.
+    size_t busy_count; // Worker threads that haven't finished the current run yet.
+    bool stopping;
+    size_t next_task_index;
+    size_t task_count;
+    ParallelTask task;
+    void *context;
+};
+
+// Runs tasks of the current run until there are none left, with the mutex held outside of the tasks.
+static void parallel_pool_work(struct ParallelPool *pool, size_t thread_index) {
+    while (pool->next_task_index < pool->task_count) {
+        size_t task_index = pool->next_task_index++;
+
+        pthread_mutex_unlock(&pool->mutex);
+        pool->task(pool->context, task_index, thread_index);
+        pthread_mutex_lock(&pool->mutex);
+    }
+}
+
+static void *parallel_pool_worker(void *argument) {
+    struct ParallelPoolWorker *worker = argument;
+    struct ParallelPool *pool = worker->pool;
+    size_t thread_index = worker->thread_index;
+    size_t run_index = 0;
+
+    pthread_mutex_lock(&pool->mutex);
+
+    while (true) {
+        while (!pool->stopping && pool->run_index == run_index) {
+            pthread_cond_wait(&pool->work_condition, &pool->mutex);
+        }
+
+        if (pool->stopping) {
+            break;
+        }
+
+        run_index = pool->run_index;
+        parallel_pool_work(pool, thread_index);
+
+        if (--pool->busy_count == 0) {
+            pthread_cond_signal(&pool->done_condition);
+        }
+    }
+
+    pthread_mutex_unlock(&pool->mutex);
+
+    return NULL;
+}
+
+struct ParallelPool *parallel_pool_create(size_t thread_count) {
+    if (thread_count == 0) {
+        thread_count = parallel_default_thread_count();
+    }
+
+    struct ParallelPool *pool = calloc(1, sizeof(struct ParallelPool));
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    pool->threads = malloc(thread_count * sizeof(pthread_t));
+    pool->workers = malloc(thread_count * sizeof(struct ParallelPoolWorker));
+
+    if (pool->threads == NULL || pool->workers == NULL) {
+        free(pool->threads);
+        free(pool->workers);
+        free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->work_condition, NULL);
+    pthread_cond_init(&pool->done_condition, NULL);
+    pool->thread_count = 1;
+
+    for (size_t i = 1; i < thread_count; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].thread_index = i;
+
+        // Same as parallel_for, the threads that did start pick up the share of the ones that didn't.
+        if (pthread_create(&pool->threads[i], NULL, parallel_pool_worker, &pool->workers[i]) != 0) {
+            break;
+        }
+
+        pool->thread_count++;
+    }
+
+    return pool;
+}
+
+void parallel_pool_destroy(struct ParallelPool *pool) {
+    if (pool == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->work_condition);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (size_t i = 1; i < pool->thread_count; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool->work_condition);
+    pthread_cond_destroy(&pool->done_condition);
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool->threads);
+    free(pool->workers);
+    free(pool);
+}
+
+void parallel_pool_run(struct ParallelPool *pool, size_t task_count, ParallelTask task, void *context) {
+    // Nothing to gain from waking the workers, run everything on the calling thread.
+    if (pool->thread_count <= 1 || task_count <= 1) {
+        for (size_t i = 0; i < task_count; i++) {
+            task(context, i, 0);
+        }
+
+        return;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+
+    pool->next_task_index = 0;
+    pool->task_count = task_count;
+    pool->task = task;
+    pool->context = context;
+    pool->busy_count = pool->thread_count - 1;
+    pool->run_index++;
+    pthread_cond_broadcast(&pool->work_condition);
+
+    parallel_pool_work(pool, 0);
+
+    // Every worker has to have seen the run before the next one can change it.
+    while (pool->busy_count > 0) {
+        pthread_cond_wait(&pool->done_condition, &pool->mutex);
+    }
+
+    pthread_mutex_unlock(&pool->mutex);
+}
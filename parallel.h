@@ -0,0 +1,28 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "types.h"
+
+// Runs a single task, thread_index identifies the worker (0 <= thread_index < thread_count) so that tasks can use per-worker state.
+typedef void (*ParallelTask)(void *context, size_t task_index, size_t thread_index);
+
+// Returns the number of online processors, or 1 if it can't be determined.
+size_t parallel_default_thread_count(void);
+
+// Runs task_count tasks across thread_count workers, the calling thread being one of them, and returns once every task is done.
+// Tasks are handed out in order as workers become free. A thread_count of 0 uses parallel_default_thread_count().
+void parallel_for(size_t task_count, size_t thread_count, ParallelTask task, void *context);
+
+// Worker threads kept waiting between runs, for callers that run many small jobs and shouldn't start threads each time.
+struct ParallelPool;
+
+// Starts thread_count - 1 worker threads, the thread calling parallel_pool_run being the last one. A thread_count of 0
+// uses parallel_default_thread_count(). Returns NULL if out of memory, threads that can't be started are left out.
+struct ParallelPool *parallel_pool_create(size_t thread_count);
+void parallel_pool_destroy(struct ParallelPool *pool);
+
+// Same as parallel_for on the threads of the pool, without allocating or starting threads. A pool must only be run by
+// one thread at a time.
+void parallel_pool_run(struct ParallelPool *pool, size_t task_count, ParallelTask task, void *context);
+
+#endif // PARALLEL_H
@@ -0,0 +1,380 @@
+// Python bindings for the codec, so tools can compress and decompress in-process instead of running the CLI per file.
+// Inputs are read straight from anything that supports the buffer protocol (bytes, bytearray, memoryview, mmap) and
+// outputs are written straight into the bytes objects that are returned. The GIL is released while the codec runs.
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "lzkn64.h"
+#include "parallel.h"
+
+// Same as the CLI's compression, a single call doesn't need a context. Fails if the output doesn't fit in the header.
+static enum Lzkn64Status compress_buffer(struct Lzkn64Context *context, enum Lzkn64CompressionType compression_type, bool pad_output, const u8 *input_buffer, u8 *output_buffer, size_t input_size, size_t *output_size) {
+    if (context != NULL) {
+        *output_size = lzkn64_context_compress(context, compression_type, input_buffer, output_buffer, input_size);
+    } else if (compression_type == LZKN64_COMPRESSION_TYPE_EFFICIENT) {
+        *output_size = lzkn64_compress_efficient(input_buffer, output_buffer, input_size);
+    } else if (compression_type == LZKN64_COMPRESSION_TYPE_OPTIMAL) {
+        *output_size = lzkn64_compress_optimal(input_buffer, output_buffer, input_size);
+    } else {
+        *output_size = lzkn64_compress_accurate(input_buffer, output_buffer, input_size);
+    }
+
+    if (*output_size > LZKN64_MAXIMUM_COMPRESSED_SIZE) {
+        return LZKN64_STATUS_OUTPUT_TOO_LARGE;
+    }
+
+    if (pad_output && (*output_size & 1) != 0) {
+        output_buffer[(*output_size)++] = 0x00;
+    }
+
+    return LZKN64_STATUS_OK;
+}
+
+static bool parse_compression_type(int value, enum Lzkn64CompressionType *compression_type) {
+    if (value < LZKN64_COMPRESSION_TYPE_ACCURATE || value > LZKN64_COMPRESSION_TYPE_OPTIMAL) {
+        PyErr_SetString(PyExc_ValueError, "compression_type must be ACCURATE, EFFICIENT or OPTIMAL");
+        return false;
+    }
+
+    *compression_type = (enum Lzkn64CompressionType)value;
+
+    return true;
+}
+
+static PyObject *lzkn64_python_compress(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *keywords[] = { "data", "compression_type", "pad", NULL };
+    Py_buffer input;
+    int compression_type_value = LZKN64_COMPRESSION_TYPE_ACCURATE;
+    int pad_output = 0;
+    enum Lzkn64CompressionType compression_type;
+
+    (void)self;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "y*|ip", keywords, &input, &compression_type_value, &pad_output)) {
+        return NULL;
+    }
+
+    if (!parse_compression_type(compression_type_value, &compression_type) || (size_t)input.len > 0xFFFFFF) {
+        if (!PyErr_Occurred()) {
+            PyErr_SetString(PyExc_ValueError, "data is larger than the 16 MB the format can hold");
+        }
+
+        PyBuffer_Release(&input);
+        return NULL;
+    }
+
+    // Compress straight into a bytes object of the compression bound, which is then cut down to the real size in place.
+    PyObject *output = PyBytes_FromStringAndSize(NULL, lzkn64_compress_bound(input.len));
+    size_t output_size = 0;
+    enum Lzkn64Status status = LZKN64_STATUS_OK;
+
+    if (output != NULL) {
+        u8 *output_buffer = (u8 *)PyBytes_AS_STRING(output);
+
+        Py_BEGIN_ALLOW_THREADS
+        status = compress_buffer(NULL, compression_type, pad_output, input.buf, output_buffer, input.len, &output_size);
+        Py_END_ALLOW_THREADS
+    }
+
+    PyBuffer_Release(&input);
+
+    if (status != LZKN64_STATUS_OK) {
+        PyErr_Format(PyExc_ValueError, "could not compress data (%s)", lzkn64_status_string(status));
+        Py_DECREF(output);
+        return NULL;
+    }
+
+    if (output != NULL && _PyBytes_Resize(&output, output_size) != 0) {
+        return NULL;
+    }
+
+    return output;
+}
+
+// Decompresses into a new bytes object of exactly the decompressed size, found by walking the commands first.
+static PyObject *decompress_to_bytes(const u8 *input_buffer, size_t input_size, enum Lzkn64Status *status) {
+    size_t output_size = 0;
+
+    Py_BEGIN_ALLOW_THREADS
+    *status = lzkn64_decompressed_size(input_buffer, input_size, &output_size);
+    Py_END_ALLOW_THREADS
+
+    if (*status != LZKN64_STATUS_OK) {
+        return NULL;
+    }
+
+    PyObject *output = PyBytes_FromStringAndSize(NULL, output_size);
+    if (output == NULL) {
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    *status = lzkn64_decompress_safe(input_buffer, input_size, (u8 *)PyBytes_AS_STRING(output), output_size, &output_size);
+    Py_END_ALLOW_THREADS
+
+    if (*status != LZKN64_STATUS_OK) {
+        Py_DECREF(output);
+        return NULL;
+    }
+
+    return output;
+}
+
+static PyObject *lzkn64_python_decompress(PyObject *self, PyObject *args) {
+    Py_buffer input;
+    enum Lzkn64Status status = LZKN64_STATUS_OK;
+
+    (void)self;
+
+    if (!PyArg_ParseTuple(args, "y*", &input)) {
+        return NULL;
+    }
+
+    PyObject *output = decompress_to_bytes(input.buf, input.len, &status);
+    PyBuffer_Release(&input);
+
+    if (status != LZKN64_STATUS_OK) {
+        PyErr_Format(PyExc_ValueError, "could not decompress data (%s)", lzkn64_status_string(status));
+    }
+
+    return output;
+}
+
+// One input of a batch call, every field but the output size and status is filled in while holding the GIL.
+struct BatchItem {
+    Py_buffer input;
+    PyObject *output;
+    u8 *output_buffer;
+    size_t output_capacity;
+    size_t output_size;
+    enum Lzkn64Status status;
+};
+
+struct BatchJob {
+    struct BatchItem *items;
+    struct Lzkn64Context **contexts; // One per worker thread, NULL for decompression.
+    enum Lzkn64CompressionType compression_type;
+    bool pad_output;
+};
+
+static void compress_batch_task(void *context, size_t task_index, size_t thread_index) {
+    struct BatchJob *job = context;
+    struct BatchItem *item = &job->items[task_index];
+
+    item->status = compress_buffer(job->contexts[thread_index], job->compression_type, job->pad_output, item->input.buf, item->output_buffer, item->input.len, &item->output_size);
+}
+
+static void decompress_batch_task(void *context, size_t task_index, size_t thread_index) {
+    struct BatchJob *job = context;
+    struct BatchItem *item = &job->items[task_index];
+
+    (void)thread_index;
+
+    item->status = lzkn64_decompress_safe(item->input.buf, item->input.len, item->output_buffer, item->output_capacity, &item->output_size);
+}
+
+static void batch_items_release(struct BatchItem *items, size_t item_count) {
+    for (size_t i = 0; i < item_count; i++) {
+        if (items[i].input.obj != NULL) {
+            PyBuffer_Release(&items[i].input);
+        }
+
+        Py_XDECREF(items[i].output);
+    }
+
+    PyMem_Free(items);
+}
+
+// Runs a list of buffers through the codec across thread_count threads (0 uses every online processor) and returns
+// a list of bytes objects in the same order. Every input and output is held on to until the whole batch is done.
+static PyObject *run_batch(PyObject *inputs, bool compress, enum Lzkn64CompressionType compression_type, bool pad_output, size_t thread_count) {
+    PyObject *sequence = PySequence_Fast(inputs, "inputs must be a sequence of buffers");
+    if (sequence == NULL) {
+        return NULL;
+    }
+
+    size_t item_count = PySequence_Fast_GET_SIZE(sequence);
+    struct BatchItem *items = PyMem_Calloc(item_count > 0 ? item_count : 1, sizeof(struct BatchItem));
+    PyObject *result = NULL;
+
+    if (items == NULL) {
+        Py_DECREF(sequence);
+        return PyErr_NoMemory();
+    }
+
+    for (size_t i = 0; i < item_count; i++) {
+        struct BatchItem *item = &items[i];
+
+        if (PyObject_GetBuffer(PySequence_Fast_GET_ITEM(sequence, i), &item->input, PyBUF_SIMPLE) != 0) {
+            item->input.obj = NULL;
+            goto cleanup;
+        }
+
+        if (compress) {
+            if ((size_t)item->input.len > 0xFFFFFF) {
+                PyErr_Format(PyExc_ValueError, "input %zu is larger than the 16 MB the format can hold", i);
+                goto cleanup;
+            }
+
+            item->output_capacity = lzkn64_compress_bound(item->input.len);
+        } else {
+            item->status = lzkn64_decompressed_size(item->input.buf, item->input.len, &item->output_capacity);
+
+            if (item->status != LZKN64_STATUS_OK) {
+                PyErr_Format(PyExc_ValueError, "could not decompress input %zu (%s)", i, lzkn64_status_string(item->status));
+                goto cleanup;
+            }
+        }
+
+        item->output = PyBytes_FromStringAndSize(NULL, item->output_capacity);
+        if (item->output == NULL) {
+            goto cleanup;
+        }
+
+        item->output_buffer = (u8 *)PyBytes_AS_STRING(item->output);
+    }
+
+    if (thread_count == 0) {
+        thread_count = parallel_default_thread_count();
+    }
+
+    struct BatchJob job;
+    job.items = items;
+    job.contexts = NULL;
+    job.compression_type = compression_type;
+    job.pad_output = pad_output;
+
+    // Each worker keeps its compression scratch memory from one input to the next.
+    if (compress) {
+        job.contexts = PyMem_Calloc(thread_count, sizeof(struct Lzkn64Context *));
+
+        for (size_t i = 0; job.contexts != NULL && i < thread_count; i++) {
+            job.contexts[i] = lzkn64_context_create(0, 1);
+
+            if (job.contexts[i] == NULL) {
+                break;
+            }
+        }
+
+        if (job.contexts == NULL || job.contexts[thread_count - 1] == NULL) {
+            PyErr_NoMemory();
+            goto cleanup_contexts;
+        }
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    parallel_for(item_count, thread_count, compress ? compress_batch_task : decompress_batch_task, &job);
+    Py_END_ALLOW_THREADS
+
+    result = PyList_New(item_count);
+
+    for (size_t i = 0; result != NULL && i < item_count; i++) {
+        struct BatchItem *item = &items[i];
+
+        if (item->status != LZKN64_STATUS_OK) {
+            PyErr_Format(PyExc_ValueError, "could not %s input %zu (%s)", compress ? "compress" : "decompress", i, lzkn64_status_string(item->status));
+            Py_CLEAR(result);
+        } else if (_PyBytes_Resize(&item->output, item->output_size) != 0) {
+            Py_CLEAR(result);
+        } else {
+            // The list takes over the reference.
+            PyList_SET_ITEM(result, i, item->output);
+            item->output = NULL;
+        }
+    }
+
+cleanup_contexts:
+    if (job.contexts != NULL) {
+        for (size_t i = 0; i < thread_count; i++) {
+            lzkn64_context_destroy(job.contexts[i]);
+        }
+
+        PyMem_Free(job.contexts);
+    }
+
+cleanup:
+    batch_items_release(items, item_count);
+    Py_DECREF(sequence);
+
+    return result;
+}
+
+static PyObject *lzkn64_python_compress_batch(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *keywords[] = { "inputs", "compression_type", "pad", "threads", NULL };
+    PyObject *inputs;
+    int compression_type_value = LZKN64_COMPRESSION_TYPE_ACCURATE;
+    int pad_output = 0;
+    Py_ssize_t thread_count = 0;
+    enum Lzkn64CompressionType compression_type;
+
+    (void)self;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|ipn", keywords, &inputs, &compression_type_value, &pad_output, &thread_count)) {
+        return NULL;
+    }
+
+    if (!parse_compression_type(compression_type_value, &compression_type)) {
+        return NULL;
+    }
+
+    if (thread_count < 0) {
+        PyErr_SetString(PyExc_ValueError, "threads must not be negative");
+        return NULL;
+    }
+
+    return run_batch(inputs, true, compression_type, pad_output, thread_count);
+}
+
+static PyObject *lzkn64_python_decompress_batch(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *keywords[] = { "inputs", "threads", NULL };
+    PyObject *inputs;
+    Py_ssize_t thread_count = 0;
+
+    (void)self;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|n", keywords, &inputs, &thread_count)) {
+        return NULL;
+    }
+
+    if (thread_count < 0) {
+        PyErr_SetString(PyExc_ValueError, "threads must not be negative");
+        return NULL;
+    }
+
+    return run_batch(inputs, false, LZKN64_COMPRESSION_TYPE_ACCURATE, false, thread_count);
+}
+
+static PyMethodDef lzkn64_python_methods[] = {
+    { "compress", (PyCFunction)(void (*)(void))lzkn64_python_compress, METH_VARARGS | METH_KEYWORDS, "compress(data, compression_type=ACCURATE, pad=False) -> bytes\n\nCompresses a buffer, pad rounds the output up to an even size like the CLI's -p." },
+    { "decompress", lzkn64_python_decompress, METH_VARARGS, "decompress(data) -> bytes\n\nDecompresses a buffer, raises ValueError if it isn't valid LZKN64 data." },
+    { "compress_batch", (PyCFunction)(void (*)(void))lzkn64_python_compress_batch, METH_VARARGS | METH_KEYWORDS, "compress_batch(inputs, compression_type=ACCURATE, pad=False, threads=0) -> list\n\nCompresses every buffer of a list across threads (0 = all cores)." },
+    { "decompress_batch", (PyCFunction)(void (*)(void))lzkn64_python_decompress_batch, METH_VARARGS | METH_KEYWORDS, "decompress_batch(inputs, threads=0) -> list\n\nDecompresses every buffer of a list across threads (0 = all cores)." },
+    { NULL, NULL, 0, NULL },
+};
+
+static struct PyModuleDef lzkn64_python_module = {
+    PyModuleDef_HEAD_INIT,
+    "lzkn64",
+    "Compression and decompression of LZKN64 data.",
+    -1,
+    lzkn64_python_methods,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+};
+
+PyMODINIT_FUNC PyInit_lzkn64(void) {
+    PyObject *module = PyModule_Create(&lzkn64_python_module);
+    if (module == NULL) {
+        return NULL;
+    }
+
+    if (PyModule_AddIntConstant(module, "ACCURATE", LZKN64_COMPRESSION_TYPE_ACCURATE) != 0 || PyModule_AddIntConstant(module, "EFFICIENT", LZKN64_COMPRESSION_TYPE_EFFICIENT) != 0 || PyModule_AddIntConstant(module, "OPTIMAL", LZKN64_COMPRESSION_TYPE_OPTIMAL) != 0) {
+        Py_DECREF(module);
+        return NULL;
+    }
+
+    return module;
+}
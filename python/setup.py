@@ -0,0 +1,23 @@
+# Builds the lzkn64 Python module from the codec sources in the parent directory:
+#   python3 setup.py build_ext --inplace
+
+import os
+
+from setuptools import Extension, setup
+
+root = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..")
+
+setup(
+    name="lzkn64",
+    version="1.0",
+    description="Compression and decompression of LZKN64 data.",
+    ext_modules=[
+        Extension(
+            "lzkn64",
+            sources=["lzkn64module.c"] + [os.path.relpath(os.path.join(root, source)) for source in ["lzkn64.c", "match_length.c", "parallel.c"]],
+            include_dirs=[root],
+            extra_compile_args=["-O3", "-pthread"],
+            extra_link_args=["-pthread"],
+        )
+    ],
+)
@@ -0,0 +1,219 @@
+#include "scan.h"
+#include "lzkn64.h"
+#include "mapped_file.h"
+#include "parallel.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#define SCAN_CHUNK_SIZE 0x100000 // 1 MB of candidate offsets per task.
+
+struct ScanBlob {
+    size_t offset;
+    size_t compressed_size;
+    size_t decompressed_size;
+};
+
+// The blobs found in one chunk of the ROM, in order of their offset.
+struct ScanChunk {
+    struct ScanBlob *blobs;
+    size_t blob_count;
+    size_t blob_capacity;
+    bool failed;
+};
+
+struct ScanJob {
+    const struct Arguments *arguments;
+    const u8 *rom;
+    size_t rom_size;
+    struct ScanChunk *chunks;
+    struct ScanBlob *blobs;
+    bool *written;
+};
+
+static void scan_chunk(void *context, size_t task_index, size_t thread_index) {
+    struct ScanJob *job = context;
+    struct ScanChunk *chunk = &job->chunks[task_index];
+    size_t alignment = job->arguments->scan_alignment;
+
+    (void)thread_index;
+
+    size_t chunk_end = (task_index + 1) * SCAN_CHUNK_SIZE;
+    if (chunk_end > job->rom_size) {
+        chunk_end = job->rom_size;
+    }
+
+    // Round the start of the chunk up to the alignment.
+    size_t offset = ((task_index * SCAN_CHUNK_SIZE + alignment - 1) / alignment) * alignment;
+
+    for (; offset < chunk_end && (job->rom_size - offset) >= 4; offset += alignment) {
+        const u8 *header = &job->rom[offset];
+
+        // Cheap checks on the header first, most offsets fail these.
+        if (header[0] != 0x00) {
+            continue;
+        }
+
+        size_t compressed_size = ((size_t)header[1] << 16) | ((size_t)header[2] << 8) | (size_t)header[3];
+        if (compressed_size <= 4 || compressed_size < job->arguments->scan_minimum_size || compressed_size > (job->rom_size - offset)) {
+            continue;
+        }
+
+        size_t decompressed_size = 0;
+        if (lzkn64_decompressed_size(header, compressed_size, &decompressed_size) != LZKN64_STATUS_OK || decompressed_size == 0) {
+            continue;
+        }
+
+        if (chunk->blob_count == chunk->blob_capacity) {
+            size_t capacity = chunk->blob_capacity == 0 ? 16 : chunk->blob_capacity * 2;
+            struct ScanBlob *blobs = realloc(chunk->blobs, capacity * sizeof(struct ScanBlob));
+
+            if (blobs == NULL) {
+                chunk->failed = true;
+                return;
+            }
+
+            chunk->blobs = blobs;
+            chunk->blob_capacity = capacity;
+        }
+
+        struct ScanBlob *blob = &chunk->blobs[chunk->blob_count++];
+        blob->offset = offset;
+        blob->compressed_size = compressed_size;
+        blob->decompressed_size = decompressed_size;
+    }
+}
+
+static void write_blob(void *context, size_t task_index, size_t thread_index) {
+    struct ScanJob *job = context;
+    struct ScanBlob *blob = &job->blobs[task_index];
+
+    (void)thread_index;
+
+    job->written[task_index] = false;
+
+    u8 *output_buffer = malloc(blob->decompressed_size);
+    if (output_buffer == NULL) {
+        return;
+    }
+
+    size_t output_size = 0;
+    if (lzkn64_decompress_safe(&job->rom[blob->offset], blob->compressed_size, output_buffer, blob->decompressed_size, &output_size) == LZKN64_STATUS_OK) {
+        char output_path[4096];
+        snprintf(output_path, sizeof(output_path), "%s/%08zX.bin", job->arguments->output_file, blob->offset);
+
+        FILE *output_file = fopen(output_path, "wb");
+        if (output_file != NULL) {
+            bool successful = fwrite(output_buffer, 1, output_size, output_file) == output_size;
+            job->written[task_index] = (fclose(output_file) == 0) && successful;
+        }
+    }
+
+    free(output_buffer);
+}
+
+int scan_run(const struct Arguments *arguments) {
+    struct MappedFile rom_file;
+    if (!mapped_file_open(&rom_file, arguments->input_file, false)) {
+        fprintf(stderr, "Error: Could not read ROM file.\n");
+        return EXIT_FAILURE;
+    }
+
+    const u8 *rom = rom_file.data;
+    size_t rom_size = rom_file.size;
+
+    if (mkdir(arguments->output_file, 0777) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Error: Could not create output directory %s.\n", arguments->output_file);
+        mapped_file_close(&rom_file);
+        return EXIT_FAILURE;
+    }
+
+    f64 start_time = get_time();
+
+    size_t thread_count = arguments->thread_count_set ? arguments->thread_count : 0;
+    size_t chunk_count = (rom_size + SCAN_CHUNK_SIZE - 1) / SCAN_CHUNK_SIZE;
+
+    struct ScanJob job;
+    job.arguments = arguments;
+    job.rom = rom;
+    job.rom_size = rom_size;
+    job.chunks = calloc(chunk_count, sizeof(struct ScanChunk));
+    job.blobs = NULL;
+    job.written = NULL;
+
+    if (job.chunks == NULL) {
+        fprintf(stderr, "Error: Could not allocate memory for the scan.\n");
+        mapped_file_close(&rom_file);
+        return EXIT_FAILURE;
+    }
+
+    parallel_for(chunk_count, thread_count, scan_chunk, &job);
+
+    size_t candidate_count = 0;
+    bool failed = false;
+
+    for (size_t i = 0; i < chunk_count; i++) {
+        candidate_count += job.chunks[i].blob_count;
+        failed |= job.chunks[i].failed;
+    }
+
+    job.blobs = malloc((candidate_count > 0 ? candidate_count : 1) * sizeof(struct ScanBlob));
+    size_t blob_count = 0;
+    size_t accepted_end = 0;
+
+    // Data inside a file can look like a valid file as well, so anything starting inside a file that was already
+    // accepted is dropped. The chunks are in order, so this goes through every candidate by increasing offset.
+    for (size_t i = 0; i < chunk_count && job.blobs != NULL; i++) {
+        for (size_t j = 0; j < job.chunks[i].blob_count; j++) {
+            struct ScanBlob *blob = &job.chunks[i].blobs[j];
+
+            if (blob->offset >= accepted_end) {
+                job.blobs[blob_count++] = *blob;
+                accepted_end = blob->offset + blob->compressed_size;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < chunk_count; i++) {
+        free(job.chunks[i].blobs);
+    }
+
+    free(job.chunks);
+
+    job.written = calloc(blob_count > 0 ? blob_count : 1, sizeof(bool));
+
+    if (failed || job.blobs == NULL || job.written == NULL) {
+        fprintf(stderr, "Error: Could not allocate memory for the scan.\n");
+        free(job.blobs);
+        free(job.written);
+        mapped_file_close(&rom_file);
+        return EXIT_FAILURE;
+    }
+
+    parallel_for(blob_count, thread_count, write_blob, &job);
+
+    f64 elapsed_time = get_time() - start_time;
+    size_t failed_count = 0;
+
+    printf("Offset      Compressed  Decompressed\n");
+
+    for (size_t i = 0; i < blob_count; i++) {
+        struct ScanBlob *blob = &job.blobs[i];
+
+        printf("0x%08zX  %10zu  %12zu%s\n", blob->offset, blob->compressed_size, blob->decompressed_size, job.written[i] ? "" : "  (could not be written)");
+
+        if (!job.written[i]) {
+            failed_count++;
+        }
+    }
+
+    printf("Found %zu files in %zu bytes (%zu candidates) in %.3f s.\n", blob_count, rom_size, candidate_count, elapsed_time);
+
+    free(job.blobs);
+    free(job.written);
+    mapped_file_close(&rom_file);
+
+    return failed_count == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,11 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include "main.h"
+
+// Finds every LZKN64 file in the ROM image arguments->input_file and decompresses each one into the
+// arguments->output_file directory, named after its offset in the ROM. A file is only accepted if its header fits in
+// the ROM and every command up to the compressed size in the header decodes cleanly.
+int scan_run(const struct Arguments *arguments);
+
+#endif // SCAN_H
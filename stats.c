@@ -0,0 +1,163 @@
+#include "stats.h"
+#include "lzkn64.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static const char *stats_command_names[LZKN64_STATS_COMMAND_COUNT] = {
+    "sliding_window_copy",
+    "raw_copy",
+    "rle_write_short_any_value",
+    "rle_write_short_zero",
+    "rle_write_long_zero",
+};
+
+static f64 stats_ratio(size_t numerator, size_t denominator) {
+    return denominator > 0 ? (f64)numerator / (f64)denominator : 0.0;
+}
+
+static void print_histogram(FILE *file, const size_t *histogram, size_t bucket_count) {
+    for (size_t bucket = 0; bucket < bucket_count; bucket++) {
+        fprintf(file, " %8zu", histogram[bucket]);
+    }
+
+    fprintf(file, "\n");
+}
+
+static void print_text(FILE *file, const char *name, const struct Lzkn64Stats *stats) {
+    fprintf(file, "%s: %zu bytes compressed to %zu bytes (%.2f%%)", name, stats->decompressed_size, stats->compressed_size, stats_ratio(stats->compressed_size, stats->decompressed_size) * 100.0);
+
+#if defined(LZKN64_STATS)
+    // Nothing is counted for decompressed or cached files.
+    if (stats->probe_count > 0) {
+        fprintf(file, ", %.2f match candidates per byte", stats_ratio(stats->probe_count, stats->decompressed_size));
+    }
+#endif
+
+    fprintf(file, "\n  %-26s %10s %12s %12s %8s\n", "command", "count", "compressed", "decompressed", "average");
+
+    for (size_t i = 0; i < LZKN64_STATS_COMMAND_COUNT; i++) {
+        fprintf(file, "  %-26s %10zu %12zu %12zu %8.2f\n", stats_command_names[i], stats->command_counts[i], stats->command_compressed_bytes[i], stats->command_decompressed_bytes[i], stats_ratio(stats->command_decompressed_bytes[i], stats->command_counts[i]));
+    }
+
+    // Every raw copy costs a command byte on top of its data.
+    size_t raw_copy_literal_size = stats->command_decompressed_bytes[LZKN64_STATS_RAW_COPY];
+    size_t raw_copy_overhead = stats->command_compressed_bytes[LZKN64_STATS_RAW_COPY] - raw_copy_literal_size;
+
+    fprintf(file, "  raw copy overhead: %zu command bytes for %zu literal bytes (%.2f%%)\n", raw_copy_overhead, raw_copy_literal_size, stats_ratio(raw_copy_overhead, raw_copy_literal_size) * 100.0);
+    fprintf(file, "  %-26s", "lengths from");
+
+    for (size_t bucket = 0; bucket < LZKN64_STATS_LENGTH_BUCKETS; bucket++) {
+        fprintf(file, " %8zu", bucket == 0 ? 0 : (size_t)1 << bucket);
+    }
+
+    fprintf(file, "\n");
+
+    for (size_t i = 0; i < LZKN64_STATS_COMMAND_COUNT; i++) {
+        fprintf(file, "  %-26s", stats_command_names[i]);
+        print_histogram(file, stats->length_histograms[i], LZKN64_STATS_LENGTH_BUCKETS);
+    }
+
+    fprintf(file, "  %-26s", "offsets from");
+
+    for (size_t bucket = 0; bucket < LZKN64_STATS_OFFSET_BUCKETS; bucket++) {
+        fprintf(file, " %8zu", (size_t)1 << bucket);
+    }
+
+    fprintf(file, "\n  %-26s", stats_command_names[LZKN64_STATS_SLIDING_WINDOW_COPY]);
+    print_histogram(file, stats->offset_histogram, LZKN64_STATS_OFFSET_BUCKETS);
+}
+
+static void write_json_string(FILE *file, const char *text) {
+    fputc('"', file);
+
+    for (; *text != '\0'; text++) {
+        if (*text == '"' || *text == '\\') {
+            fprintf(file, "\\%c", *text);
+        } else if ((u8)*text < 0x20) {
+            fprintf(file, "\\u%04x", (u8)*text);
+        } else {
+            fputc(*text, file);
+        }
+    }
+
+    fputc('"', file);
+}
+
+static void write_json_histogram(FILE *file, const size_t *histogram, size_t bucket_count) {
+    fprintf(file, "[");
+
+    for (size_t bucket = 0; bucket < bucket_count; bucket++) {
+        fprintf(file, "%s%zu", bucket > 0 ? ", " : "", histogram[bucket]);
+    }
+
+    fprintf(file, "]");
+}
+
+// Writes the members of one object, name is left out for the total.
+static void write_json_stats(FILE *file, const char *indent, const char *name, const struct Lzkn64Stats *stats) {
+    if (name != NULL) {
+        fprintf(file, "%s\"name\": ", indent);
+        write_json_string(file, name);
+        fprintf(file, ",\n");
+    }
+
+    fprintf(file, "%s\"files\": %zu,\n", indent, stats->file_count);
+    fprintf(file, "%s\"compressed_size\": %zu,\n", indent, stats->compressed_size);
+    fprintf(file, "%s\"decompressed_size\": %zu,\n", indent, stats->decompressed_size);
+    fprintf(file, "%s\"match_candidates\": %zu,\n", indent, stats->probe_count);
+    fprintf(file, "%s\"commands\": {\n", indent);
+
+    for (size_t i = 0; i < LZKN64_STATS_COMMAND_COUNT; i++) {
+        fprintf(file, "%s  \"%s\": { \"count\": %zu, \"compressed_bytes\": %zu, \"decompressed_bytes\": %zu, \"lengths\": ", indent, stats_command_names[i], stats->command_counts[i], stats->command_compressed_bytes[i], stats->command_decompressed_bytes[i]);
+        write_json_histogram(file, stats->length_histograms[i], LZKN64_STATS_LENGTH_BUCKETS);
+        fprintf(file, " }%s\n", i + 1 < LZKN64_STATS_COMMAND_COUNT ? "," : "");
+    }
+
+    fprintf(file, "%s},\n%s\"offsets\": ", indent, indent);
+    write_json_histogram(file, stats->offset_histogram, LZKN64_STATS_OFFSET_BUCKETS);
+    fprintf(file, "\n");
+}
+
+// Histogram bucket n of the JSON report holds the values from 2^n to 2^(n + 1) - 1, like in lzkn64.h.
+static bool write_json(const char *path, const char *const *names, const struct Lzkn64Stats *stats, size_t count, const struct Lzkn64Stats *total) {
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        return false;
+    }
+
+    fprintf(file, "{\n  \"files\": [\n");
+
+    for (size_t i = 0; i < count; i++) {
+        fprintf(file, "    {\n");
+        write_json_stats(file, "      ", names[i], &stats[i]);
+        fprintf(file, "    }%s\n", i + 1 < count ? "," : "");
+    }
+
+    fprintf(file, "  ],\n  \"total\": {\n");
+    write_json_stats(file, "    ", NULL, total);
+    fprintf(file, "  }\n}\n");
+
+    return fclose(file) == 0;
+}
+
+bool stats_report(const struct Arguments *arguments, const char *const *names, const struct Lzkn64Stats *stats, size_t count) {
+    FILE *file = strcmp(arguments->output_file, "-") == 0 ? stderr : stdout;
+    struct Lzkn64Stats total;
+
+    lzkn64_stats_init(&total);
+
+    for (size_t i = 0; i < count; i++) {
+        if (arguments->stats) {
+            print_text(file, names[i], &stats[i]);
+        }
+
+        lzkn64_stats_add(&total, &stats[i]);
+    }
+
+    if (arguments->stats && count > 1) {
+        print_text(file, "Total", &total);
+    }
+
+    return arguments->stats_json_file == NULL || write_json(arguments->stats_json_file, names, stats, count, &total);
+}
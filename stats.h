@@ -0,0 +1,10 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "main.h"
+
+// Prints the statistics of every file and of all of them together as text if arguments->stats is set, to stdout or to
+// stderr if the output goes to stdout, and writes them as JSON to arguments->stats_json_file if set. Returns false if the JSON couldn't be written.
+bool stats_report(const struct Arguments *arguments, const char *const *names, const struct Lzkn64Stats *stats, size_t count);
+
+#endif // STATS_H
@@ -0,0 +1,420 @@
+// Compresses every file of the uncompressed directory in memory and compares the result to the compressed directory.
+// Replaces the per-file subprocesses of matching_compression.py: files are checked in parallel with the library linked
+// directly. Each file is checked for a bit-exact match of the padded accurate output, and for round-trip decompression
+// of the reference file (also through a stream and from an index of it) and of the accurate, efficient and optimal
+// outputs. The streamed accurate and efficient outputs have to match the one-shot ones, whether the input is written in
+// tiny pieces or all at once. The optimal output goes through a context per worker thread, so its scratch memory is
+// reused across files of different sizes. Every type also has to give the same output on several threads, through the
+// parallel functions and a threaded context, as on one.
+
+#include "lzkn64.h"
+#include "parallel.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef LZKN64_TEST_DIRECTORY
+#define LZKN64_TEST_DIRECTORY "."
+#endif
+
+#define PARALLEL_THREAD_COUNT 3
+
+struct TestContext {
+    const char *test_directory;
+    char (*file_names)[256];
+    struct Lzkn64Context **contexts; // One for each worker thread.
+    struct Lzkn64Context **threaded_contexts; // One for each worker thread, with PARALLEL_THREAD_COUNT threads of its own.
+    const char **failures; // The first failed check of each file, NULL if it passed.
+};
+
+static u8 *read_file(const char *path, size_t *size) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    *size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    u8 *buffer = malloc(*size > 0 ? *size : 1);
+    if (buffer != NULL && fread(buffer, 1, *size, file) != *size) {
+        free(buffer);
+        buffer = NULL;
+    }
+
+    fclose(file);
+
+    return buffer;
+}
+
+static int compare_names(const void *first, const void *second) {
+    return strcmp(first, second);
+}
+
+// Decompresses compressed_buffer and checks that it gives back uncompressed_buffer.
+static bool round_trips(const u8 *compressed_buffer, size_t compressed_size, const u8 *uncompressed_buffer, size_t uncompressed_size, u8 *scratch_buffer) {
+    size_t decompressed_size = 0;
+
+    if (lzkn64_decompressed_size(compressed_buffer, compressed_size, &decompressed_size) != LZKN64_STATUS_OK || decompressed_size != uncompressed_size) {
+        return false;
+    }
+
+    if (lzkn64_decompress_safe(compressed_buffer, compressed_size, scratch_buffer, uncompressed_size, &decompressed_size) != LZKN64_STATUS_OK) {
+        return false;
+    }
+
+    return decompressed_size == uncompressed_size && memcmp(scratch_buffer, uncompressed_buffer, uncompressed_size) == 0;
+}
+
+// Builds an index of the compressed file with a checkpoint every interval bytes, then decompresses its second half from
+// a checkpoint and the whole file in segments across thread_count threads.
+static bool index_decompresses(const u8 *compressed_buffer, size_t compressed_size, const u8 *uncompressed_buffer, size_t uncompressed_size, size_t interval, size_t thread_count, u8 *scratch_buffer) {
+    size_t index_capacity = lzkn64_index_bound(uncompressed_size, interval);
+    size_t index_size = 0;
+    size_t decompressed_size = 0;
+    size_t range_offset = uncompressed_size / 2;
+    bool matches = false;
+
+    u8 *index_buffer = malloc(index_capacity);
+    if (index_buffer == NULL) {
+        return false;
+    }
+
+    if (lzkn64_index_build(compressed_buffer, compressed_size, uncompressed_buffer, uncompressed_size, interval, index_buffer, index_capacity, &index_size) == LZKN64_STATUS_OK &&
+        lzkn64_decompress_range(compressed_buffer, compressed_size, index_buffer, index_size, range_offset, uncompressed_size - range_offset, scratch_buffer) == LZKN64_STATUS_OK &&
+        memcmp(scratch_buffer, &uncompressed_buffer[range_offset], uncompressed_size - range_offset) == 0 &&
+        lzkn64_decompress_parallel(compressed_buffer, compressed_size, index_buffer, index_size, scratch_buffer, uncompressed_size, thread_count, &decompressed_size) == LZKN64_STATUS_OK) {
+        matches = decompressed_size == uncompressed_size && memcmp(scratch_buffer, uncompressed_buffer, uncompressed_size) == 0;
+    }
+
+    free(index_buffer);
+
+    return matches;
+}
+
+// Piece sizes that cycle from 1 to 13 bytes, so the streams see commands cut at every possible place.
+static size_t piece_size(size_t piece_index, size_t remaining_size) {
+    size_t size = 1 + (piece_index * 7) % 13;
+
+    return size < remaining_size ? size : remaining_size;
+}
+
+struct StreamSink {
+    u8 *buffer;
+    size_t length;
+};
+
+static void stream_sink_write(void *user_data, const u8 *data, size_t size) {
+    struct StreamSink *sink = user_data;
+
+    memcpy(&sink->buffer[sink->length], data, size);
+    sink->length += size;
+}
+
+// Compresses the input through a stream, in tiny pieces or all at once, and checks that it gives the same output as
+// compressed_buffer, the output of the one-shot function of the same type.
+static bool stream_compresses(enum Lzkn64CompressionType compression_type, bool tiny_pieces, const u8 *uncompressed_buffer, size_t uncompressed_size, const u8 *compressed_buffer, size_t compressed_size, u8 *scratch_buffer) {
+    struct StreamSink sink = { scratch_buffer, 0 };
+    u8 header[4];
+
+    struct Lzkn64CompressStream *stream = lzkn64_compress_stream_create(compression_type, stream_sink_write, &sink);
+    if (stream == NULL) {
+        return false;
+    }
+
+    for (size_t input_offset = 0, piece_index = 0; input_offset < uncompressed_size; piece_index++) {
+        size_t size = tiny_pieces ? piece_size(piece_index, uncompressed_size - input_offset) : uncompressed_size;
+
+        lzkn64_compress_stream_write(stream, &uncompressed_buffer[input_offset], size);
+        input_offset += size;
+    }
+
+    size_t output_size = lzkn64_compress_stream_finish(stream, header);
+    lzkn64_compress_stream_destroy(stream);
+
+    memcpy(sink.buffer, header, sizeof(header));
+
+    return output_size == compressed_size && sink.length == compressed_size && memcmp(sink.buffer, compressed_buffer, compressed_size) == 0;
+}
+
+// Decompresses through a stream with both the input and the output in tiny pieces.
+static bool stream_decompresses(const u8 *compressed_buffer, size_t compressed_size, const u8 *uncompressed_buffer, size_t uncompressed_size, u8 *scratch_buffer) {
+    struct Lzkn64DecompressStream stream;
+    size_t input_offset = 0;
+    size_t output_offset = 0;
+
+    lzkn64_decompress_stream_init(&stream);
+
+    for (size_t piece_index = 0; !lzkn64_decompress_stream_finished(&stream); piece_index++) {
+        size_t input_consumed = 0;
+        size_t output_produced = 0;
+
+        // Reversed, so the input and output pieces don't line up.
+        size_t output_capacity = piece_size(12 - piece_index % 13, uncompressed_size - output_offset);
+
+        if (lzkn64_decompress_stream(&stream, &compressed_buffer[input_offset], piece_size(piece_index, compressed_size - input_offset), &input_consumed, &scratch_buffer[output_offset], output_capacity, &output_produced) != LZKN64_STATUS_OK) {
+            return false;
+        }
+
+        // Neither side moving means the stream wants more than there is.
+        if (input_consumed == 0 && output_produced == 0 && (input_offset == compressed_size || output_offset == uncompressed_size)) {
+            return false;
+        }
+
+        input_offset += input_consumed;
+        output_offset += output_produced;
+    }
+
+    return output_offset == uncompressed_size && memcmp(scratch_buffer, uncompressed_buffer, uncompressed_size) == 0;
+}
+
+// Compresses with every type on PARALLEL_THREAD_COUNT threads, through the parallel functions and threaded_context, and
+// checks that both give the same output as the serial functions byte for byte. Returns the first failure, NULL if none.
+static const char *parallel_compression_failure(struct Lzkn64Context *threaded_context, const u8 *uncompressed_buffer, size_t uncompressed_size, u8 *output_buffer, u8 *parallel_buffer) {
+    static const char *failures[] = { "parallel accurate compression doesn't match", "parallel efficient compression doesn't match", "parallel optimal compression doesn't match" };
+    static const char *context_failures[] = { "threaded context accurate compression doesn't match", "threaded context efficient compression doesn't match", "threaded context optimal compression doesn't match" };
+
+    for (size_t compression_type = LZKN64_COMPRESSION_TYPE_ACCURATE; compression_type <= LZKN64_COMPRESSION_TYPE_OPTIMAL; compression_type++) {
+        size_t output_size = 0;
+        size_t parallel_size = 0;
+
+        if (compression_type == LZKN64_COMPRESSION_TYPE_ACCURATE) {
+            output_size = lzkn64_compress_accurate(uncompressed_buffer, output_buffer, uncompressed_size);
+            parallel_size = lzkn64_compress_accurate_parallel(uncompressed_buffer, parallel_buffer, uncompressed_size, PARALLEL_THREAD_COUNT);
+        } else if (compression_type == LZKN64_COMPRESSION_TYPE_EFFICIENT) {
+            output_size = lzkn64_compress_efficient(uncompressed_buffer, output_buffer, uncompressed_size);
+            parallel_size = lzkn64_compress_efficient_parallel(uncompressed_buffer, parallel_buffer, uncompressed_size, PARALLEL_THREAD_COUNT);
+        } else {
+            output_size = lzkn64_compress_optimal(uncompressed_buffer, output_buffer, uncompressed_size);
+            parallel_size = lzkn64_compress_optimal_parallel(uncompressed_buffer, parallel_buffer, uncompressed_size, PARALLEL_THREAD_COUNT);
+        }
+
+        if (parallel_size != output_size || memcmp(parallel_buffer, output_buffer, output_size) != 0) {
+            return failures[compression_type];
+        }
+
+        parallel_size = lzkn64_context_compress(threaded_context, (enum Lzkn64CompressionType)compression_type, uncompressed_buffer, parallel_buffer, uncompressed_size);
+
+        if (parallel_size != output_size || memcmp(parallel_buffer, output_buffer, output_size) != 0) {
+            return context_failures[compression_type];
+        }
+    }
+
+    return NULL;
+}
+
+static const char *check_file(const char *test_directory, const char *file_name, struct Lzkn64Context *context, struct Lzkn64Context *threaded_context) {
+    char path[4096];
+    size_t uncompressed_size = 0;
+    size_t compressed_size = 0;
+
+    snprintf(path, sizeof(path), "%s/uncompressed/%s", test_directory, file_name);
+    u8 *uncompressed_buffer = read_file(path, &uncompressed_size);
+
+    snprintf(path, sizeof(path), "%s/compressed/%s", test_directory, file_name);
+    u8 *compressed_buffer = read_file(path, &compressed_size);
+
+    u8 *output_buffer = malloc(lzkn64_compress_bound(uncompressed_size));
+    u8 *stream_buffer = malloc(lzkn64_compress_bound(uncompressed_size));
+    u8 *scratch_buffer = malloc(uncompressed_size > 0 ? uncompressed_size : 1);
+
+    const char *failure = NULL;
+
+    if (uncompressed_buffer == NULL || compressed_buffer == NULL || output_buffer == NULL || stream_buffer == NULL || scratch_buffer == NULL) {
+        failure = "could not be read";
+    }
+
+    if (failure == NULL) {
+        // Same as the CLI's -c with -p: accurate compression padded to an even size.
+        size_t output_size = lzkn64_compress_accurate(uncompressed_buffer, output_buffer, uncompressed_size);
+
+        if ((output_size & 1) != 0) {
+            output_buffer[output_size++] = 0x00;
+        }
+
+        if (output_size != compressed_size || memcmp(output_buffer, compressed_buffer, compressed_size) != 0) {
+            failure = "accurate compression doesn't match";
+        }
+    }
+
+    if (failure == NULL) {
+        struct Lzkn64Mismatch mismatch;
+        size_t output_size = 0;
+
+        // Verifying while compressing has to pass and leave the output as it is.
+        if (lzkn64_context_compress_verified(context, LZKN64_COMPRESSION_TYPE_ACCURATE, uncompressed_buffer, output_buffer, uncompressed_size, &output_size, &mismatch) != LZKN64_STATUS_OK || memcmp(output_buffer, compressed_buffer, output_size) != 0) {
+            failure = "verified accurate compression doesn't match";
+        }
+    }
+
+    if (failure == NULL && !round_trips(compressed_buffer, compressed_size, uncompressed_buffer, uncompressed_size, scratch_buffer)) {
+        failure = "decompression doesn't match";
+    }
+
+    if (failure == NULL && !stream_decompresses(compressed_buffer, compressed_size, uncompressed_buffer, uncompressed_size, scratch_buffer)) {
+        failure = "stream decompression doesn't match";
+    }
+
+    if (failure == NULL && !index_decompresses(compressed_buffer, compressed_size, uncompressed_buffer, uncompressed_size, 0x400, 1, scratch_buffer)) {
+        failure = "decompression from the index doesn't match";
+    }
+
+    // Checkpoints this close together fall inside most long commands, and every thread gets many segments.
+    if (failure == NULL && !index_decompresses(compressed_buffer, compressed_size, uncompressed_buffer, uncompressed_size, 0x40, PARALLEL_THREAD_COUNT, scratch_buffer)) {
+        failure = "parallel decompression from a dense index doesn't match";
+    }
+
+    if (failure == NULL) {
+        size_t output_size = lzkn64_compress_accurate(uncompressed_buffer, output_buffer, uncompressed_size);
+
+        if (!stream_compresses(LZKN64_COMPRESSION_TYPE_ACCURATE, true, uncompressed_buffer, uncompressed_size, output_buffer, output_size, stream_buffer) ||
+            !stream_compresses(LZKN64_COMPRESSION_TYPE_ACCURATE, false, uncompressed_buffer, uncompressed_size, output_buffer, output_size, stream_buffer)) {
+            failure = "stream accurate compression doesn't match";
+        }
+    }
+
+    if (failure == NULL) {
+        size_t output_size = lzkn64_compress_efficient(uncompressed_buffer, output_buffer, uncompressed_size);
+
+        if (!round_trips(output_buffer, output_size, uncompressed_buffer, uncompressed_size, scratch_buffer)) {
+            failure = "efficient compression doesn't round-trip";
+        } else if (!stream_compresses(LZKN64_COMPRESSION_TYPE_EFFICIENT, true, uncompressed_buffer, uncompressed_size, output_buffer, output_size, stream_buffer) ||
+                   !stream_compresses(LZKN64_COMPRESSION_TYPE_EFFICIENT, false, uncompressed_buffer, uncompressed_size, output_buffer, output_size, stream_buffer)) {
+            failure = "stream efficient compression doesn't match";
+        }
+    }
+
+    if (failure == NULL) {
+        size_t output_size = lzkn64_context_compress(context, LZKN64_COMPRESSION_TYPE_OPTIMAL, uncompressed_buffer, output_buffer, uncompressed_size);
+
+        if (!round_trips(output_buffer, output_size, uncompressed_buffer, uncompressed_size, scratch_buffer)) {
+            failure = "optimal compression doesn't round-trip";
+        }
+    }
+
+    if (failure == NULL) {
+        failure = parallel_compression_failure(threaded_context, uncompressed_buffer, uncompressed_size, output_buffer, stream_buffer);
+    }
+
+    free(uncompressed_buffer);
+    free(compressed_buffer);
+    free(output_buffer);
+    free(stream_buffer);
+    free(scratch_buffer);
+
+    return failure;
+}
+
+// Inputs that once compressed into streams that don't decompress. Returns the first failure, NULL if they all pass.
+static const char *check_regressions(struct Lzkn64Context *context) {
+    // A zero run of exactly 33 bytes, which efficient compression used to write as 0xFF: a long zero RLE command.
+    u8 zero_run[37] = { 0x01, 0x02, 0x03 };
+    zero_run[36] = 0x05;
+
+    u8 output_buffer[64];
+    u8 scratch_buffer[sizeof(zero_run)];
+
+    for (size_t compression_type = LZKN64_COMPRESSION_TYPE_ACCURATE; compression_type <= LZKN64_COMPRESSION_TYPE_OPTIMAL; compression_type++) {
+        struct Lzkn64Mismatch mismatch;
+        size_t output_size = 0;
+
+        if (lzkn64_context_compress_verified(context, (enum Lzkn64CompressionType)compression_type, zero_run, output_buffer, sizeof(zero_run), &output_size, &mismatch) != LZKN64_STATUS_OK || !round_trips(output_buffer, output_size, zero_run, sizeof(zero_run), scratch_buffer)) {
+            return "a 33 byte zero run doesn't round-trip";
+        }
+    }
+
+    return NULL;
+}
+
+static void check_file_task(void *context, size_t task_index, size_t thread_index) {
+    struct TestContext *test_context = context;
+
+    test_context->failures[task_index] = check_file(test_context->test_directory, test_context->file_names[task_index], test_context->contexts[thread_index], test_context->threaded_contexts[thread_index]);
+}
+
+int main(int argc, const char *argv[]) {
+    const char *test_directory = argc > 1 ? argv[1] : LZKN64_TEST_DIRECTORY;
+    char path[4096];
+
+    snprintf(path, sizeof(path), "%s/uncompressed", test_directory);
+
+    DIR *directory = opendir(path);
+    if (directory == NULL) {
+        printf("Error: Could not open %s.\n", path);
+        return EXIT_FAILURE;
+    }
+
+    char (*file_names)[256] = NULL;
+    size_t file_count = 0;
+    size_t file_capacity = 0;
+    struct dirent *directory_entry;
+
+    while ((directory_entry = readdir(directory)) != NULL) {
+        if (directory_entry->d_name[0] == '.') {
+            continue;
+        }
+
+        if (file_count == file_capacity) {
+            file_capacity = file_capacity == 0 ? 1024 : file_capacity * 2;
+            file_names = realloc(file_names, file_capacity * sizeof(*file_names));
+
+            if (file_names == NULL) {
+                printf("Error: Could not allocate memory for the file list.\n");
+                closedir(directory);
+                return EXIT_FAILURE;
+            }
+        }
+
+        snprintf(file_names[file_count++], sizeof(*file_names), "%s", directory_entry->d_name);
+    }
+
+    closedir(directory);
+
+    if (file_count == 0) {
+        printf("Error: No test files found in %s.\n", path);
+        return EXIT_FAILURE;
+    }
+
+    qsort(file_names, file_count, sizeof(*file_names), compare_names);
+
+    size_t thread_count = parallel_default_thread_count();
+    struct TestContext context = { test_directory, file_names, calloc(thread_count, sizeof(struct Lzkn64Context *)), calloc(thread_count, sizeof(struct Lzkn64Context *)), calloc(file_count, sizeof(const char *)) };
+
+    for (size_t i = 0; i < thread_count; i++) {
+        context.contexts[i] = lzkn64_context_create(0, 1);
+        context.threaded_contexts[i] = lzkn64_context_create(0, PARALLEL_THREAD_COUNT);
+    }
+
+    parallel_for(file_count, thread_count, check_file_task, &context);
+
+    size_t failure_count = 0;
+    const char *regression_failure = check_regressions(context.contexts[0]);
+
+    if (regression_failure != NULL) {
+        printf("FAIL regressions: %s.\n", regression_failure);
+    }
+
+    for (size_t i = 0; i < file_count; i++) {
+        if (context.failures[i] != NULL) {
+            printf("FAIL %s: %s.\n", file_names[i], context.failures[i]);
+            failure_count++;
+        }
+    }
+
+    printf("%zu of %zu files passed.\n", file_count - failure_count, file_count);
+
+    for (size_t i = 0; i < thread_count; i++) {
+        lzkn64_context_destroy(context.contexts[i]);
+        lzkn64_context_destroy(context.threaded_contexts[i]);
+    }
+
+    free(context.contexts);
+    free(context.threaded_contexts);
+    free(context.failures);
+    free(file_names);
+
+    return failure_count == 0 && regression_failure == NULL ? EXIT_SUCCESS : EXIT_FAILURE;
+}
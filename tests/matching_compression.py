@@ -6,6 +6,7 @@ import subprocess
 import filecmp
 import shutil
 import argparse
+import time
 from colorama import Fore
 from colorama import Style
 
@@ -14,6 +15,8 @@ parser.add_argument("--uncompressed_dir", help="The directory containing the unc
 parser.add_argument("--compressed_dir", help="The directory containing the compressed files.", default="compressed")
 parser.add_argument("--temp_dir", help="The temporary directory to store the compressed files in.", default="recompressed")
 parser.add_argument("--lzkn64", help="The path to the lzkn64 executable.", default="../build/lzkn64")
+parser.add_argument("--module_dir", help="The directory containing the lzkn64 Python module (built with python3 setup.py build_ext --inplace).", default="../python")
+parser.add_argument("--subprocess", help="Runs the lzkn64 executable for every file instead of using the Python module.", action="store_true")
 parser.add_argument("--verbose", help="Prints more information.", action="store_true")
 args = parser.parse_args()
 
@@ -28,39 +31,68 @@ if __name__ == "__main__":
     lzkn64 = args.lzkn64
     verbose = args.verbose
 
-    # Create a temporary directory to store the compressed files.
-    if os.path.exists(temp_dir):
-        shutil.rmtree(temp_dir)
+    start_time = time.time()
+
+    if args.subprocess:
+        # Create a temporary directory to store the compressed files.
+        if os.path.exists(temp_dir):
+            shutil.rmtree(temp_dir)
     
-    os.mkdir(temp_dir)
+        os.mkdir(temp_dir)
+
+        # Compress the files in the uncompressed directory.
+        for root, dirs, files in os.walk(uncompressed_dir):
+            for file in files:
+                # Create the output file path.
+                output_file = os.path.join(temp_dir, os.path.relpath(os.path.join(root, file), uncompressed_dir))
 
-    # Compress the files in the uncompressed directory.
-    for root, dirs, files in os.walk(uncompressed_dir):
-        for file in files:
-            # Create the output file path.
-            output_file = os.path.join(temp_dir, os.path.relpath(os.path.join(root, file), uncompressed_dir))
+                # Create the output directory if it doesn't exist.
+                output_dir = os.path.dirname(output_file)
+                if not os.path.exists(output_dir):
+                    os.makedirs(output_dir)
 
-            # Create the output directory if it doesn't exist.
-            output_dir = os.path.dirname(output_file)
-            if not os.path.exists(output_dir):
-                os.makedirs(output_dir)
+                # Compress the file.
+                subprocess.call([lzkn64, "-c", os.path.join(root, file), output_file, "-p"])
 
-            # Compress the file.
-            subprocess.call([lzkn64, "-c", os.path.join(root, file), output_file, "-p"])
+        # Compare the compressed files to the files in the compressed directory.
+        for root, dirs, files in os.walk(temp_dir):
+            for file in files:
+                # Create the output file path.
+                output_file = os.path.join(compressed_dir, os.path.relpath(os.path.join(root, file), temp_dir))
 
-    # Compare the compressed files to the files in the compressed directory.
-    for root, dirs, files in os.walk(temp_dir):
-        for file in files:
-            # Create the output file path.
-            output_file = os.path.join(compressed_dir, os.path.relpath(os.path.join(root, file), temp_dir))
+                # Compare the files.
+                if not filecmp.cmp(os.path.join(root, file), output_file):
+                    test_successful = False
+                    nonmatching_files.append(file)
+
+        # Remove the temporary directory.
+        shutil.rmtree(temp_dir)
+    else:
+        sys.path.insert(0, args.module_dir)
+        import lzkn64 as lzkn64_module
 
-            # Compare the files.
-            if not filecmp.cmp(os.path.join(root, file), output_file):
-                test_successful = False
-                nonmatching_files.append(file)
+        # Read every file up front, so the whole corpus can be compressed in one call without holding the GIL.
+        relative_paths = []
+        uncompressed_data = []
 
-    # Remove the temporary directory.
-    shutil.rmtree(temp_dir)
+        for root, dirs, files in os.walk(uncompressed_dir):
+            for file in files:
+                relative_paths.append(os.path.relpath(os.path.join(root, file), uncompressed_dir))
+
+                with open(os.path.join(root, file), "rb") as uncompressed_file:
+                    uncompressed_data.append(uncompressed_file.read())
+
+        # Compress the files the same way as the lzkn64 executable with -p.
+        compressed_data = lzkn64_module.compress_batch(uncompressed_data, compression_type=lzkn64_module.ACCURATE, pad=True)
+
+        # Compare the compressed files to the files in the compressed directory.
+        for relative_path, data in zip(relative_paths, compressed_data):
+            with open(os.path.join(compressed_dir, relative_path), "rb") as compressed_file:
+                if data != compressed_file.read():
+                    test_successful = False
+                    nonmatching_files.append(os.path.basename(relative_path))
+
+    elapsed_time = time.time() - start_time
 
     # Print the result.
     if test_successful:
@@ -73,4 +105,6 @@ if __name__ == "__main__":
             for file in nonmatching_files:
                 print(file)
 
+    print(f"Took {elapsed_time:.3f} s.")
+
     sys.exit(0 if test_successful else 1)
\ No newline at end of file